@@ -0,0 +1,12 @@
+#!/usr/bin/env python3
+# Write N rows of input for bench/batch.666 (default 2000000).
+import random
+import sys
+
+n = int(sys.argv[1]) if len(sys.argv) > 1 else 2000000
+random.seed(666)
+out = sys.stdout
+out.write("price,qty,discount\n")
+for _ in range(n):
+    out.write("%d,%d,%d\n" % (random.randint(1, 500), random.randint(0, 20),
+        random.randint(0, 3000)))
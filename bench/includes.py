@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# Time many programs that share a helper file, pasted into each one or
+# included with #<.
+# Run with: bench/includes.py [path/to/x666] [programs] [helper lines]
+#
+# Each program is a few lines of its own after the helper (default 200
+# programs, 5000 helper lines). They are run one process each, without
+# and with --include-cache, and all in one --farm process, where the
+# helper is parsed once. Prints the CPU time of each way, from wait4().
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+x666 = sys.argv[1] if len(sys.argv) > 1 else "./x666"
+programs = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+helperLines = int(sys.argv[3]) if len(sys.argv) > 3 else 5000
+
+# Identifiers are letters only
+names = ["h" + a + b for a in "abcde" for b in "abcdefghij"]
+
+def helper(n):
+    lines = []
+    for i in range(n):
+        lines.append("%s <- (%d + %d * 3) %% 7 + #\"item %d\"" % (
+            names[i % len(names)], i, i % 11, i))
+    return "\n".join(lines) + "\n"
+
+def own(k):
+    return "x <- %d\n@# i, 1, 10\n  x +<- i * hac\n&>\n#> x\n" % k
+
+def measure(args):
+    """CPU seconds of running x666 with args."""
+    p = subprocess.Popen([x666] + args, stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL)
+    _, status, usage = os.wait4(p.pid, 0)
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        sys.exit("x666 %s failed" % " ".join(args))
+    return usage.ru_utime + usage.ru_stime
+
+def each(files, extra=[]):
+    return sum(measure(["--run"] + extra + [f]) for f in files)
+
+with tempfile.TemporaryDirectory() as d:
+    text = helper(helperLines)
+    with open(os.path.join(d, "helper.666"), "w") as f:
+        f.write(text)
+    pasted, included = [], []
+    for k in range(programs):
+        name = os.path.join(d, "pasted%d.666" % k)
+        with open(name, "w") as f:
+            f.write(text + own(k))
+        pasted.append(name)
+        name = os.path.join(d, "included%d.666" % k)
+        with open(name, "w") as f:
+            f.write("#< \"helper.666\"\n" + own(k))
+        included.append(name)
+    cache = os.path.join(d, "cache")
+    os.mkdir(cache)
+    results = [
+        ("pasted, a process each", each(pasted)),
+        ("#<, a process each", each(included)),
+        ("#<, --include-cache", each(included, ["--include-cache", cache])),
+        ("pasted, one --farm", measure(["--farm"] + pasted)),
+        ("#<, one --farm", measure(["--farm"] + included)),
+    ]
+    for name, t in results:
+        print("%-24s %8.3f s  %8.3f ms a program" % (
+            name, t, 1000 * t / programs))
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+# Parse pathological programs at growing sizes and check that time and
+# peak memory grow no faster than expected.
+# Run with: bench/pathological.py [path/to/x666] [max size]
+#
+# Each shape is written at sizes 1000, 10000, ... up to the maximum
+# (default 1000000) and traced by x666 in a child process, whose CPU
+# time and peak RSS come from wait4(). Each is run three times and the
+# least time kept, to ride out a busy machine. The cost of an empty
+# program is subtracted, a line is fitted to log(cost) against
+# log(size), and the slope is the growth exponent: about 1 for linear,
+# 2 for quadratic.
+# Exits with status 1 if any shape grows faster than its bound, or
+# crashes. Programs nested deeper than maxNesting (see Parser.h) fail
+# to parse, so past that the deep shapes time how that is reported.
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+x666 = sys.argv[1] if len(sys.argv) > 1 else "./x666"
+maxSize = int(sys.argv[2]) if len(sys.argv) > 2 else 1000000
+
+# name: (program of size n, bound on the exponent)
+shapes = {
+    "statements": (lambda n: "x<-1\n" * n, 1.25),
+    "sum spine": (lambda n: "x<-" + "+".join(["1"] * n) + "\n", 1.25),
+    "assignment chain": (lambda n: "a<-" * n + "1\n", 1.25),
+    "juxtaposition": (lambda n: "a<-2\n#>" + "2a" * n + "\n", 1.25),
+    "negation chain": (lambda n: "#>" + "- " * n + "1\n", 1.25),
+    "nested (": (lambda n: "#>" + "(" * n + "1" + ")" * n + "\n",
+        1.25),
+    "nested [": (lambda n: "#>" + "[" * n + "1" + "]" * n + "\n",
+        1.25),
+    "nested blocks": (lambda n: "??1\n" * n + "&>\n" * n, 1.25),
+    "long string": (lambda n: "#>\"" + "a" * n + "\"\n", 1.25),
+    "long comment": (lambda n: "##" + "a" * n + "\n#>1\n", 1.25),
+    "error per line": (lambda n: "x y\n" * n, 1.25),
+}
+
+def measure(source, runs=3):
+    """CPU seconds and peak RSS in KiB of tracing source."""
+    best = None
+    with tempfile.NamedTemporaryFile("w", suffix=".666") as f:
+        f.write(source)
+        f.flush()
+        for _ in range(runs):
+            p = subprocess.Popen([x666, f.name], stdout=subprocess.DEVNULL,
+                stderr=subprocess.DEVNULL)
+            _, status, usage = os.wait4(p.pid, 0)
+            if not os.WIFEXITED(status):
+                return None
+            t = usage.ru_utime + usage.ru_stime
+            if best is None or t < best[0]:
+                best = t, usage.ru_maxrss
+    return best
+
+def slope(points):
+    """Least-squares slope of log(y) against log(x)."""
+    if len(points) < 2:
+        return None
+    xs = [math.log(x) for x, _ in points]
+    ys = [math.log(y) for _, y in points]
+    mx, my = sum(xs) / len(xs), sum(ys) / len(ys)
+    sxx = sum((x - mx) ** 2 for x in xs)
+    return sum((x - mx) * (y - my) for x, y in zip(xs, ys)) / sxx
+
+baseTime, baseMemory = measure("#>1\n")
+failed = False
+for name, (make, bound) in shapes.items():
+    times, memory = [], []
+    crashed = None
+    n = 1000
+    while n <= maxSize:
+        result = measure(make(n))
+        if result is None:
+            crashed = n
+            break
+        t, m = result
+        # Too little to measure against the cost of starting up
+        if t - baseTime >= 0.005:
+            times.append((n, t - baseTime))
+        if m - baseMemory >= 1024:
+            memory.append((n, m - baseMemory))
+        n *= 10
+    timeSlope, memorySlope = slope(times), slope(memory)
+    line = "%-18s" % name
+    line += " time ^%s" % ("%.2f" % timeSlope if timeSlope else " -  ")
+    line += "  memory ^%s" % ("%.2f" % memorySlope if memorySlope else " -  ")
+    if times:
+        line += "  (%.3f s at %d)" % (times[-1][1], times[-1][0])
+    if memory:
+        line += "  (%d KiB at %d)" % (memory[-1][1], memory[-1][0])
+    if crashed is not None:
+        line += "  CRASHED at %d" % crashed
+        failed = True
+    elif (timeSlope or 0) > bound or (memorySlope or 0) > bound:
+        line += "  FAILED: bound is ^%.2f" % bound
+        failed = True
+    print(line)
+sys.exit(1 if failed else 0)
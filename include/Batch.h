@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "Interpreter.h"
+#include "Parser.h"
+
+namespace x666 {
+  /**
+   * Runs one program over many rows of inputs, a block of rows at a
+   * time. The program's free variables (read but never assigned) are
+   * the input columns.
+   *
+   * The statements are lowered to kernels that each run one operation
+   * over a whole block of int64_t columns, written so that the
+   * compiler can vectorize them. Branches (?? chains, ?:, & and |)
+   * become selection masks: every row runs every kernel, and a
+   * statement only takes effect on the rows whose mask is set.
+   *
+   * A row that hits anything the kernels don't model exactly (an
+   * overflow, a division by zero, a variable read before it is
+   * assigned, or an input that isn't a 64-bit integer) is rerun on its
+   * own in the Interpreter, so the output is the same as running the
+   * program once per row. An input too big for 64 bits is bound as a
+   * BigInt there, as the lexer would promote it.
+   */
+  class Batch {
+  public:
+    static constexpr size_t blockSize = 1024;
+    Batch(
+      const std::vector<Statement>& statements,
+      const std::vector<std::string>& slotNames,
+      const std::vector<size_t>& inputSlots);
+    /**
+     * Lower the program. Returns false (with the error in errorLog)
+     * if it uses loops, strings, lists or assignments inside
+     * expressions.
+     */
+    bool compile(std::vector<RuntimeError>& errorLog);
+    /**
+     * Read rows of comma-separated values from `rows`, the first of
+     * which names the columns, and run the program on each. A row
+     * that fails, or that is too short to have every input column, is
+     * reported and skipped. Returns false if an input column is
+     * missing from the header or any row failed. source is the
+     * program text, for error messages.
+     */
+    bool run(std::istream& rows, std::ostream& out, std::istream& source);
+  private:
+    enum class Kernel {
+      constant, // dst = imm
+      copy, // dst = a
+      binary, // dst = a o b, on rows in mask c
+      neg, // dst = -a, on rows in mask c
+      logicalNot, // dst = !a
+      truthy, // dst = a != 0
+      select, // dst = a ? b : c
+      maskAnd, // dst = a & b
+      maskAndNot, // dst = a & !b
+      maskOr, // dst = a | b
+      blend, // dst = b ? a : dst
+      checkDefined, // rows in mask b where a is 0 are rerun
+    };
+    struct Op {
+      Kernel kernel;
+      Operator o;
+      uint32_t dst, a, b, c;
+      int64_t imm;
+    };
+    // Values printed by #>, on the rows in mask
+    struct Print {
+      uint32_t value, mask;
+    };
+    uint32_t newRegister();
+    void emit(Kernel k, uint32_t dst, uint32_t a = 0, uint32_t b = 0,
+      uint32_t c = 0, Operator o = Operator::plus);
+    uint32_t lower(const Expression* ex, uint32_t mask);
+    uint32_t load(size_t slot, uint32_t mask);
+    void store(size_t slot, uint32_t value, uint32_t mask);
+    bool lowerRange(size_t& pc, uint32_t mask);
+    bool lowerIf(size_t& pc, uint32_t mask);
+    bool lowerStatement(const Statement& st, uint32_t mask);
+    bool error(RuntimeErrorCode c);
+    int64_t* reg(uint32_t r) { return &regs[r * blockSize]; }
+    void execute(size_t n);
+    // lineNumbers are those of lines in the input, for errors.
+    void runBlock(
+      const std::vector<std::string>& lines,
+      const std::vector<size_t>& lineNumbers,
+      const std::vector<size_t>& columnOf,
+      std::ostream& out, std::istream& source);
+    bool runRow(
+      const std::string& line, size_t lineNumber,
+      const std::vector<size_t>& columnOf,
+      std::ostream& out, std::istream& source);
+    const std::vector<Statement>& statements;
+    const std::vector<std::string>& slotNames;
+    const std::vector<size_t>& inputSlots;
+    std::vector<RuntimeError>* errorLog = nullptr;
+    size_t current = 0;
+    std::vector<Op> ops;
+    std::vector<Print> prints;
+    // For each slot: registers holding its value and whether it has
+    // been assigned
+    std::vector<uint32_t> valueOf, definedOf;
+    uint32_t registers = 0;
+    std::vector<int64_t> regs;
+    size_t failedRows = 0;
+  };
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace x666 {
+  /**
+   * An arbitrary-precision integer, stored as a sign and a magnitude
+   * of 32-bit limbs (least significant first, no leading zeros).
+   * Values that fit in int64_t should be kept as int64_t; BigInt is
+   * only the slow path for when they don't.
+   */
+  class BigInt {
+  public:
+    BigInt() : negative(false) {}
+    BigInt(int64_t n);
+    bool isZero() const { return limbs.empty(); }
+    bool isNegative() const { return negative; }
+    /** Store the value in n and return true if it fits in int64_t. */
+    bool toInt64(int64_t& n) const;
+    /** Set *this to *this * m + a, ignoring the sign (for lexing). */
+    void mulAdd(uint32_t m, uint32_t a);
+    BigInt operator-() const;
+    BigInt operator+(const BigInt& b) const;
+    BigInt operator-(const BigInt& b) const;
+    BigInt operator*(const BigInt& b) const;
+    /**
+     * Truncating division, matching int64_t's / and %.
+     * b must not be zero.
+     */
+    void divMod(const BigInt& b, BigInt& q, BigInt& r) const;
+    int compare(const BigInt& b) const;
+    std::string toString() const;
+  private:
+    static int compareMagnitude(
+      const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+    static std::vector<uint32_t> addMagnitude(
+      const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+    // Needs a >= b
+    static std::vector<uint32_t> subMagnitude(
+      const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+    uint32_t divSmall(uint32_t d);
+    void trim();
+    bool negative;
+    std::vector<uint32_t> limbs;
+  };
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Lexer.h"
+#include "Module.h"
+#include "Parser.h"
+#include "Resolver.h"
+
+namespace x666 {
+  /**
+   * Parses a program lazily. load() parses only the top level: the
+   * body of each block is skipped with a quick scan for the ?&, !! or
+   * &> that ends it and left as a single Operator::block placeholder.
+   * An Interpreter that reaches a placeholder calls expand() to parse
+   * the body (its own blocks skipped in turn) and splice it in.
+   *
+   * So the time to the first statement, and the memory for the tree,
+   * grow with the code that runs rather than with the whole program.
+   * Errors in a body are only found when it is first reached, and
+   * never if it isn't, so a program can print some output and only
+   * then fail to parse; x666 --lazy exits with status 1 when it does.
+   * The same goes for a #< in a body, so the names that its file
+   * assigns don't count as assigned until then.
+   *
+   * Only the interpreter can run a program that isn't all parsed, so
+   * --lazy can't be combined with options that need the whole tree
+   * (--types, --dedup, --profile, --emit-ir, --emit-c, --batch, --farm).
+   */
+  class BlockLoader {
+  public:
+    /**
+     * source must outlive the loader. name is its file name, which #<
+     * paths are relative to.
+     */
+    BlockLoader(
+        const std::string& source, const std::string& name = "-",
+        const std::string& includeCache = std::string()) :
+        source(source), resolver(statements), includes(name, includeCache) {}
+    /** Parse and resolve the top level. Returns false on errors. */
+    bool load();
+    /**
+     * Replace the placeholder at statements[at] with the body it
+     * stands for, setting count to the number of statements put in
+     * its place. Returns false (with errors in errorLog) if the body
+     * doesn't parse.
+     */
+    bool expand(size_t at, size_t& count);
+    size_t slotCount() const { return resolver.slotCount(); }
+    std::vector<Statement> statements;
+    std::vector<LexError> errorLog;
+    size_t blocksSkipped = 0, blocksParsed = 0;
+  private:
+    const std::string& source;
+    Resolver resolver;
+    Includes includes;
+    // Where each unparsed body ends, by the byte it starts at
+    std::unordered_map<size_t, size_t> ends;
+  };
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "Interpreter.h"
+#include "Parser.h"
+
+namespace x666 {
+  /**
+   * Translate resolved statements into a standalone C program.
+   * The program includes runtime/x666rt.h and marks each statement
+   * with a #line directive pointing back at sourceName.
+   * Returns false (with the error in errorLog) if the block structure
+   * of the statements is invalid.
+   */
+  bool emitC(
+    const std::vector<Statement>& statements,
+    const std::vector<std::string>& slotNames,
+    const std::string& sourceName, std::ostream& out,
+    std::vector<RuntimeError>& errorLog);
+}
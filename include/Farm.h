@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "Interpreter.h"
+#include "Program.h"
+
+namespace x666 {
+  /**
+   * Runs many independent program instances on a pool of threads.
+   *
+   * Each instance runs for at most `fuel` statements at a time before
+   * it is suspended and put back in a queue, so a runaway loop only
+   * slows down the others instead of starving them. Every thread has
+   * its own queue of instances and steals from the others when it runs
+   * out. A thread that finds nothing to steal sleeps until an instance
+   * is queued again or the last one finishes.
+   */
+  class Farm {
+  public:
+    /** One running copy of a program, with its own variables. */
+    struct Instance {
+      Instance(std::shared_ptr<const Program> program);
+      std::shared_ptr<const Program> program;
+      std::ostringstream out;
+      Interpreter interpreter;
+      Interpreter::Status status = Interpreter::Status::suspended;
+      // Accounting
+      uint64_t cpuNanos = 0; // Thread CPU time spent running it
+      size_t slices = 0;
+    };
+    /**
+     * Instances that run more than limit statements in total are
+     * stopped with an error; 0 means no limit.
+     */
+    Farm(size_t threads, size_t fuel, size_t limit = 0) :
+      threads(threads), fuel(fuel), limit(limit) {}
+    /** Add an instance of program. Returns its index. */
+    size_t add(std::shared_ptr<const Program> program);
+    /** Run every instance to completion. */
+    void run();
+    const std::vector<std::unique_ptr<Instance>>& instances() const {
+      return all;
+    }
+  private:
+    struct Queue {
+      std::mutex lock;
+      std::deque<Instance*> instances;
+    };
+    void work(size_t self);
+    Instance* take(size_t self);
+    void slice(Instance& in);
+    void signal();
+    size_t threads, fuel, limit;
+    std::vector<std::unique_ptr<Instance>> all;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<size_t> remaining{0};
+    std::atomic<size_t> queued{0}; // Instances in the queues
+    // For threads with nothing to run
+    std::mutex idleLock;
+    std::condition_variable wake;
+    std::atomic<size_t> waiting{0};
+  };
+}
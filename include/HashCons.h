@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Parser.h"
+
+namespace x666 {
+  /**
+   * Merges structurally identical subexpressions of the statements, so
+   * that each distinct one is stored once and the trees become a DAG.
+   * Only pure subexpressions (without <- or compound assignments) are
+   * merged. Nothing that reads the statements can tell the difference,
+   * except that a merged variable keeps the position of its first
+   * read: the interpreter reports an unassigned one read on another
+   * line at the start of its statement.
+   *
+   * Run it after Resolver, which rewrites nodes in place, and before
+   * the statements are shared between threads.
+   */
+  class HashConser {
+  public:
+    HashConser(std::vector<Statement>& statements) :
+      statements(statements) {}
+    void run();
+    /** Print how many nodes and bytes were saved. */
+    void report(std::ostream& out) const;
+    size_t nodesBefore = 0, nodesAfter = 0;
+    // Estimated from the sizes of the nodes and their strings
+    size_t bytesBefore = 0, bytesAfter = 0;
+  private:
+    // A node, with its children already merged
+    struct Key {
+      size_t id;
+      int op;
+      const Expression* a;
+      const Expression* b;
+      std::string text; // Of a literal or variable
+      bool operator==(const Key& o) const {
+        return id == o.id && op == o.op && a == o.a && b == o.b &&
+          text == o.text;
+      }
+    };
+    struct KeyHash {
+      size_t operator()(const Key& k) const;
+    };
+    bool visit(ExpressionPtr& ex);
+    std::vector<Statement>& statements;
+    std::unordered_map<Key, Expression*, KeyHash> nodes;
+  };
+}
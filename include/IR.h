@@ -0,0 +1,97 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Interpreter.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Value.h"
+
+namespace x666 {
+  /**
+   * An SSA form of a program, which the C backend is generated from
+   * after optimize(); `x666 --emit-ir` prints it. It traps where the
+   * interpreter would fail, with the same error at the same place, so
+   * the passes must keep each trap and the order of traps and output.
+   */
+  namespace ir {
+    /** The kind of an instruction. */
+    enum class Opcode {
+      constant, // constant
+      undef, // a variable read before any assignment on some path
+      phi, // one argument per predecessor of the block, in order
+      copy, // the value of an assignment
+      check, // args[0], a variable read; traps if it is undef
+      checkInt, // args[0], which must be a 64-bit integer
+      binary, // op args[0], args[1]
+      unary, // op args[0]
+      truthy, // 1 if args[0] is truthy, else 0
+      index, // args[0][args[1]]
+      makeList, // (args...)
+      forCheck, // args[0] is within args[1] for the step args[2]
+      forStep, // args[0] + args[1], for an @# loop's variable
+      print, // #> args[0]
+      fail, // raise error
+    };
+    struct Block;
+    /** An instruction. Each instruction defines one SSA value. */
+    struct Instr {
+      Opcode opcode;
+      Operator op = Operator::plus;
+      std::vector<Instr*> args;
+      Value constant;
+      RuntimeErrorCode error = RuntimeErrorCode::typeMismatch;
+      Block* block = nullptr;
+      size_t id = 0;
+      // The variable slot this value was assigned to, if any
+      size_t slot = SIZE_MAX;
+      LineInfo li;
+      /** Printing has a side effect; it must stay where it is. */
+      bool hasSideEffects() const;
+      /** Can this instruction raise a runtime error? */
+      bool mayTrap() const;
+    };
+    using InstrPtr = std::unique_ptr<Instr>;
+    enum class Terminator {
+      jump, // to succs[0]
+      branch, // to succs[0] if cond is truthy, else succs[1]
+      exit,
+    };
+    /** A basic block. */
+    struct Block {
+      size_t id = 0;
+      std::vector<InstrPtr> phis;
+      std::vector<InstrPtr> instrs;
+      std::vector<Block*> preds, succs;
+      Terminator term = Terminator::exit;
+      Instr* cond = nullptr;
+    };
+    using BlockPtr = std::unique_ptr<Block>;
+    /** A whole program in SSA form. blocks[0] is the entry. */
+    struct Function {
+      std::vector<BlockPtr> blocks;
+      std::vector<std::string> slotNames;
+      /** Renumber blocks and values and print them to out. */
+      void dump(std::ostream& out);
+    };
+    /**
+     * Build SSA form from resolved statements.
+     * Returns false (with the error in errorLog) if the block
+     * structure of the statements is invalid.
+     */
+    bool build(
+      const std::vector<Statement>& statements,
+      const std::vector<std::string>& slotNames,
+      Function& f, std::vector<RuntimeError>& errorLog);
+    // Optimization passes. Each returns true if it changed anything.
+    bool propagateCopies(Function& f);
+    bool eliminateCommonSubexpressions(Function& f);
+    bool hoistLoopInvariants(Function& f);
+    bool eliminateDeadCode(Function& f);
+    /** Run all of the above to a fixed point. */
+    void optimize(Function& f);
+  }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "JIT.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Probes.h"
+#include "Profile.h"
+#include "Value.h"
+
+namespace x666 {
+  class BlockLoader;
+  /** Enum of runtime error codes. */
+  enum class RuntimeErrorCode {
+    unmatchedEnd,
+    unterminatedBlock,
+    misplacedBranch,
+    undefinedVariable,
+    invalidAssignment,
+    typeMismatch,
+    integerOverflow,
+    divisionByZero,
+    indexOutOfRange,
+    invalidForLoop,
+    notBatchable,
+    limitExceeded,
+    blockParseFailed,
+  };
+  /** The array of runtime error messages. */
+  extern const char* runtimeErrorMessages[];
+  /** An error raised while linking or executing statements. */
+  struct RuntimeError {
+    RuntimeError(RuntimeErrorCode c, const LineInfo& li) :
+      c(c), li(li) {
+      X666_PROBE2(runtime_error, (int) c, li.byte);
+    }
+    RuntimeErrorCode c;
+    LineInfo li;
+    void print(std::istream& fh) const;
+    void print(std::istream& fh, std::ostream& out) const;
+  };
+  /**
+   * A tree-walking interpreter over the statements of a parsed program.
+   * The statements must have been resolved (see Resolver), so that
+   * variables live in a flat array of slots.
+   *
+   * Blocks are matched up front: ?? cond / ?& cond / !! / &> is an
+   * if-chain, @ cond a while loop, @@ cond a TI-Basic style Repeat
+   * (the body runs until cond holds, checked at the &>) and
+   * @# var,start,end[,step] an inclusive for loop.
+   */
+  class Interpreter {
+  public:
+    Interpreter(
+      const std::vector<Statement>& statements, size_t slotCount,
+      std::ostream& out, bool jit = true);
+    /**
+     * Run the program. Returns false (with the error in errorLog)
+     * if the block structure is invalid or execution fails.
+     */
+    bool run();
+    enum class Status { finished, suspended, failed };
+    /**
+     * Check the block structure and get ready to run. Returns false
+     * (with the error in errorLog) if it is invalid.
+     */
+    bool start();
+    /**
+     * Run at most fuel more statements, then return. A suspended
+     * program can be resumed later, from any thread. Native loops
+     * count as one statement, so turn off the JIT if fuel matters.
+     */
+    Status resume(size_t fuel);
+    /** The number of statements executed so far. */
+    size_t executed() const { return steps; }
+    /**
+     * End a suspended program with an error at the statement it would
+     * have run next.
+     */
+    void stop(RuntimeErrorCode c);
+    /** Count each statement run in profile, which must outlive this. */
+    void profileWith(Profile* p) { profile = p; }
+    /**
+     * Parse the bodies of blocks with loader as they are reached. The
+     * statements must be loader's.
+     */
+    void loadBlocksWith(BlockLoader* l) { loader = l; }
+    /** Give a variable a value before the program runs. */
+    void bind(size_t slot, Value&& v);
+    std::vector<RuntimeError> errorLog;
+  private:
+    bool link();
+    template<bool profiled> void execute();
+    Value evaluate(const Expression* ex);
+    /**
+     * Evaluate an unboxed expression (see TypeInference) on int64_t.
+     * Returns false if some value is a BigInt or would become one;
+     * the expression has no side effects, so it can then be evaluated
+     * again the usual way.
+     */
+    bool evaluateUnboxed(const Expression* ex, int64_t& r);
+    Value evaluateBinary(const BinaryOp* ex);
+    Value evaluateUnary(const UnaryOp* ex);
+    Value evaluateAssign(const BinaryOp* ex);
+    /** Apply a binary operator to evaluated operands. */
+    Value apply(Operator o, Value a, const Value& b);
+    Value applyBig(Operator o, const BigInt& x, const BigInt& y);
+    /** Store a ~ b into var, reusing its buffer where possible. */
+    Value append(const Variable* var, Value a, const Value& b);
+    Value evaluateList(const Expression* ex);
+    int64_t evaluateInt(const Expression* ex);
+    Value& load(const Variable* v);
+    Value& store(const Variable* v);
+    [[noreturn]] void fail(RuntimeErrorCode c);
+    /**
+     * At the &> in statements[pc], run the rest of the loop natively
+     * if it is hot and compilable. Returns false if the interpreter
+     * should handle the &> itself.
+     */
+    bool enterNative();
+    /** Replace the placeholder at statements[pc] with its body. */
+    void expandBlock();
+    const std::vector<Statement>& statements;
+    std::ostream& out;
+    // For each statement: the next clause of an if-chain, or the
+    // matching &> of a loop; for &>, the statement that opened it.
+    std::vector<size_t> jumps;
+    // Limit and step of each active @# loop, by statement index.
+    std::vector<std::pair<int64_t, int64_t>> forBounds;
+    std::vector<Value> slots;
+    std::vector<char> assigned;
+    size_t pc;
+    size_t fuel = SIZE_MAX;
+    size_t steps = 0;
+    Profile* profile = nullptr;
+    BlockLoader* loader = nullptr;
+    // Compiled loops, by the index of the statement that opens them
+    struct HotLoop {
+      std::unique_ptr<NativeLoop> code;
+      size_t hits = 0;
+      size_t deopts = 0;
+      bool failed = false;
+    };
+    bool jit;
+    std::vector<HotLoop> hotLoops;
+    std::vector<int64_t> nativeVars;
+    // Lists made only of integer literals, built once and shared;
+    // nullptr for comma chains that aren't.
+    std::unordered_map<const Expression*, ListPtr> constantLists;
+  };
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "Parser.h"
+
+namespace x666 {
+  /**
+   * Native x86-64 code for the body of one integer loop.
+   *
+   * The code works on a flat array of int64_t: the limit and the step
+   * (for @# loops; unused otherwise), then one entry per slot in
+   * `slots`. It is entered at the loop's &>, as if an iteration had
+   * just finished, and returns the index of the statement at which
+   * the interpreter should resume: the statement after &> when the
+   * loop exits, or the statement that hit an overflow or a division
+   * by zero (deopt).
+   * Every statement is all-or-nothing, so resuming there is exact.
+   */
+  class NativeLoop {
+  public:
+    NativeLoop(
+        void* code, size_t size, std::vector<size_t>&& slots,
+        std::vector<std::pair<uint32_t, uint32_t>>&& marks) :
+      slots(std::move(slots)), code(code), size(size),
+      marks(std::move(marks)) {}
+    ~NativeLoop();
+    NativeLoop(const NativeLoop&) = delete;
+    NativeLoop& operator=(const NativeLoop&) = delete;
+    size_t run(int64_t* vars) const;
+    /**
+     * The statement whose code contains address, or SIZE_MAX if it
+     * isn't in this loop. Safe to call from a signal handler.
+     */
+    size_t statementAt(const void* address) const;
+    /** The variable slots used by the loop, in array order. */
+    const std::vector<size_t> slots;
+  private:
+    void* code;
+    size_t size;
+    // Where the code of each statement starts: (offset, statement),
+    // by offset
+    std::vector<std::pair<uint32_t, uint32_t>> marks;
+  };
+  /**
+   * Compile the loop opened by statements[header] and closed by
+   * statements[end]. jumps is the block structure computed by the
+   * interpreter. Returns nullptr if the loop uses anything other than
+   * integer arithmetic, comparisons and ?? chains (strings, lists,
+   * printing, nested loops), or if the JIT isn't supported here.
+   *
+   * If counts is set, the code adds to counts[i] each time it runs
+   * statement i, as a profiled Interpreter would (see Profile.h),
+   * except for the &> it is entered at.
+   */
+  std::unique_ptr<NativeLoop> compileLoop(
+    const std::vector<Statement>& statements,
+    const std::vector<size_t>& jumps, size_t header, size_t end,
+    uint64_t* counts = nullptr);
+}
@@ -4,21 +4,31 @@
 
 #include <iosfwd>
 #include <string>
+#include <unordered_set>
 #include <variant>
 
+#include "BigInt.h"
+#include "Probes.h"
+
 namespace x666 {
   /**
-   * Information about the current line and column.
+   * Information about the current line and column. Columns count code
+   * points; byte and sot (the start of the token) count bytes. file is
+   * 0 in the program itself, or says which file it included with #<
+   * (see Module.h).
    */
   struct LineInfo {
-    LineInfo() : line(0), col(0), byte(0), sot(0) {}
+    LineInfo() : line(0), col(0), byte(0), sot(0), file(0) {}
     size_t line, col;
     size_t byte, sot;
+    uint32_t file;
   };
-  /** An identifier token. */
+  /** An identifier token. The parser sets li to where it appears. */
   struct Identifier {
     Identifier(char c) : name{c} {}
+    Identifier(std::string&& name) : name(std::move(name)) {}
     std::string name;
+    LineInfo li;
   };
   /** A string literal. */
   struct StringLiteral {
@@ -31,6 +41,11 @@ namespace x666 {
     IntLiteral(int64_t n) : n(n) {}
     int64_t n;
   };
+  /** An integer literal too big for IntLiteral. */
+  struct BigIntLiteral {
+    BigIntLiteral(BigInt&& n) : n(std::move(n)) {}
+    BigInt n;
+  };
   /** An operator. */
   enum class Operator {
     leftBracket,
@@ -66,7 +81,24 @@ namespace x666 {
     length,
     comma,
     print,
+    plusAssign,
+    minusAssign,
+    timesAssign,
+    divideAssign,
+    moduloAssign,
+    concatAssign,
+    include,
+    // Never lexed: stands in for the unparsed body of a block (see
+    // skipBlockBody)
+    block,
   };
+  /** Is o <- or a compound assignment such as +<-? */
+  bool isAssignment(Operator o);
+  /**
+   * The operator applied by a compound assignment (plus for +<-),
+   * or Operator::assign for a plain <-.
+   */
+  Operator assignedOperator(Operator o);
   /** Token to denote a newline. */
   struct Newline {};
   /** Token to denote the end of the file. */
@@ -82,6 +114,12 @@ namespace x666 {
     mismatchedBrackets,
     statementNeedsExpression,
     statementHasExpression,
+    unassignedVariable,
+    invalidUtf8,
+    includeNeedsPath,
+    includeNotFound,
+    includeCycle,
+    nestedTooDeeply,
   };
   /** The array of lex error messages. */
   extern const char* lexErrorMessages[];
@@ -89,15 +127,30 @@ namespace x666 {
   /** A token to denote that a lexing error has occurred. */
   struct LexError {
     LexError(LexErrorCode c, const LineInfo& li) :
-      c(c), li(li) {}
+      c(c), li(li) {
+      X666_PROBE2(lex_error, (int) c, li.byte);
+    }
     LexErrorCode c;
     LineInfo li;
+    // Rendered when the error is found if the source can't be reread
+    std::string snippet;
     void print(std::istream& fh) const;
+    void print(std::istream& fh, std::ostream& out) const;
   };
+  /**
+   * Print the source lines spanned by li from fh, with a caret
+   * underneath the offending token. If li is in an included file,
+   * they come from that file instead.
+   */
+  void printSnippet(std::istream& fh, const LineInfo& li);
+  void printSnippet(std::istream& fh, const LineInfo& li, std::ostream& out);
+  /** Print " in <path>" if li is in an included file. */
+  void printFileOf(const LineInfo& li, std::ostream& out);
   using Token = std::variant<
     Identifier,
     StringLiteral,
     IntLiteral,
+    BigIntLiteral,
     Operator,
     Newline,
     EndOfFile,
@@ -108,4 +161,13 @@ namespace x666 {
    * token read after this function returns.
    */
   Token getNextToken(std::istream& fh, LineInfo& li);
+  /**
+   * Skip the body of a block without tokenising it: stop before the
+   * ?&, !! or &> that ends it, counting the blocks nested inside, or
+   * at the end of the file. Names that the body assigns with a plain
+   * <- or as an @# loop variable are added to stores. Returns false
+   * if the body had no statements.
+   */
+  bool skipBlockBody(
+    std::istream& fh, LineInfo& li, std::unordered_set<std::string>& stores);
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Lexer.h"
+#include "Parser.h"
+
+namespace x666 {
+  /**
+   * A file included with #<. Each is read and parsed once per process
+   * and kept for the rest of it (or until the file changes, when it is
+   * read again as a new Module and the old one is freed once no
+   * program uses it). A file included under two names, such as from
+   * programs in different directories, is a Module for each, so that
+   * errors name it the way its includer did.
+   */
+  struct Module {
+    std::string path; // As included
+    std::string canonical; // Its real path
+    std::string source;
+    uint64_t hash; // Of source
+    uint32_t file; // The LineInfo::file of its statements
+    /**
+     * Its statements, parsed but neither resolved nor with their own
+     * #< expanded, in a compact form that each program that includes
+     * the file decodes into a tree of its own (see Module.cpp).
+     */
+    std::string encoded;
+    std::vector<LexError> errorLog; // With their snippets rendered
+  };
+  /**
+   * Holds a module. A module superseded by a newer version of its file
+   * is freed once nothing holds it, so a program that needs its
+   * included files (for their LineInfos, say) keeps their handles.
+   */
+  using ModuleHandle = std::shared_ptr<const Module>;
+  /**
+   * The module that LineInfo::file refers to, or nullptr for 0 (the
+   * program itself). The caller must hold a handle to it, as the
+   * program the LineInfo belongs to does.
+   */
+  const Module* includedFile(uint32_t file);
+  /** Whether the file m was read from still holds the same source. */
+  bool unchanged(const Module& m);
+  /**
+   * Expands the #< "path" statements of one program into the
+   * statements of the files they name. A path is relative to the
+   * directory of the file the #< is in.
+   *
+   * Resolver and TypeInference rewrite and annotate nodes in place,
+   * so programs can't share trees: the program that a file is parsed
+   * for takes the statements, and the others decode Module::encoded,
+   * which takes a fraction of the time. Within a program, a file
+   * included again shares the nodes of its first copy (as HashConser's
+   * merged nodes are shared), so only the statement list grows with
+   * every #<.
+   *
+   * With cacheDirectory set, a module parsed without errors is also
+   * written there in that form, and another process that includes the
+   * same unchanged file decodes it instead of parsing it.
+   */
+  class Includes {
+  public:
+    /**
+     * includer is the file name of the program, or - for stdin.
+     * Relative names, including includer, are found from
+     * workingDirectory if it is set, but errors still name files
+     * relative to it, as a process started there would.
+     */
+    Includes(
+      const std::string& includer,
+      const std::string& cacheDirectory = std::string(),
+      const std::string& workingDirectory = std::string());
+    /**
+     * Replace each #< in statements with what it includes. Returns
+     * false, with the errors (from included files too) in errorLog,
+     * if any include fails.
+     */
+    bool expand(
+      std::vector<Statement>& statements, std::vector<LexError>& errorLog);
+    /**
+     * Every module that the program read, with or without errors, so
+     * that a cached build can be checked against them (see unchanged).
+     * It is only complete if no #< named a file that couldn't be read.
+     */
+    const std::unordered_set<ModuleHandle>& modules() const {
+      return read;
+    }
+    bool complete() const { return !missing; }
+  private:
+    // The statements of this program's copy of what st includes
+    const std::vector<Statement>* include(
+      const Statement& st, std::vector<LexError>& errorLog);
+    // Where to open the file named path
+    std::string located(const std::string& path) const;
+    std::string workingDirectory;
+    std::string directory; // Of the program
+    std::string canonical; // Of the program, if a file
+    std::string cacheDirectory;
+    std::unordered_map<const Module*, std::vector<Statement>> copies;
+    std::vector<const Module*> active; // Being expanded
+    std::unordered_set<const Module*> reported;
+    std::unordered_set<ModuleHandle> read;
+    bool missing = false;
+  };
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "x666.h"
+
+namespace x666 {
+  /**
+   * Writes to a file descriptor, handing several buffers to the system
+   * at once with writev().
+   */
+  class FileOutput : public OutputSink {
+  public:
+    FileOutput(int fd) : fd(fd) {}
+    void write(const char* data, size_t size) override;
+    void writeAll(
+      const char* const* data, const size_t* sizes, size_t count) override;
+    /**
+     * Set once a write fails, after which nothing more is written.
+     * error is its errno.
+     */
+    bool failed = false;
+    int error = 0;
+  private:
+    int fd;
+  };
+  /**
+   * Collects #> output on its way to an OutputSink. The sink gets it
+   * when a buffer fills up, at each flush (at the latest, when the
+   * buffer is destroyed) and, with flushLines, at the end of each
+   * line.
+   *
+   * With background set, a writer thread calls the sink. A buffer that
+   * fills up is queued for it and printing carries on into a spare
+   * one. The writer hands the sink every buffer queued by then in one
+   * writeAll(). Printing only waits when all of the buffers are queued.
+   */
+  class OutputBuffer : public std::streambuf {
+  public:
+    OutputBuffer(
+      OutputSink& sink, size_t size = 1 << 16, bool flushLines = false,
+      bool background = false);
+    ~OutputBuffer();
+    /** Write out everything so far, waiting until the sink has it. */
+    void flush() { pubsync(); }
+  protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+  private:
+    struct Chunk {
+      std::unique_ptr<char[]> data;
+      size_t size;
+    };
+    // Pass what's in the put area on, and start a fresh one.
+    void submit();
+    void writeOut();
+    OutputSink& sink;
+    size_t size;
+    bool flushLines;
+    std::unique_ptr<char[]> current;
+    // Shared with the writer thread
+    std::mutex mutex;
+    std::condition_variable queued, written;
+    std::vector<Chunk> queue;
+    std::vector<std::unique_ptr<char[]>> spare;
+    size_t chunks = 1; // Allocated, including current
+    bool writing = false;
+    bool stopping = false;
+    std::thread writer;
+  };
+}
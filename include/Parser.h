@@ -1,13 +1,20 @@
 #pragma once
 
+#include <cstddef>
 #include <iosfwd>
 #include <memory>
 #include <stack>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "Lexer.h"
+#include "StreamBuffer.h"
 
 namespace x666 {
+  class Includes;
+  class ExpressionPtr;
   class Expression {
   public:
     virtual ~Expression() = 0;
@@ -16,55 +23,115 @@ namespace x666 {
     virtual size_t id() const = 0;
     /**
      * Imbue a binary operator and its other operand into an expression.
-     * a is the recipient, and it should also be the invoker.
-     * b is the RHS for la operators and the LHS for ra operators.
+     * a is the recipient (the LHS), and it should also be the invoker.
+     * b is the RHS.
      * prec should receive the entry in the precedence table,
      * right-shifted by 3.
      * 
-     * Ex (give std::unique_ptr<Expression> a, b;):
-     * std::unique_ptr<Expression> ex = a->imbue(a, op, prec, b);
+     * Ex (give ExpressionPtr a, b;):
+     * ExpressionPtr ex = a->imbue(a, op, prec, b);
      * After this call, a should no longer be used.
      */
-    virtual std::unique_ptr<Expression> imbue(
-      std::unique_ptr<Expression> a,
+    virtual ExpressionPtr imbue(
+      ExpressionPtr a,
       Operator o, size_t precedence,
-      std::unique_ptr<Expression> b);
-    virtual std::unique_ptr<Expression> imbueLeft(
-      std::unique_ptr<Expression> b,
+      ExpressionPtr b);
+    virtual ExpressionPtr imbueLeft(
+      ExpressionPtr b,
       Operator o, size_t precedence,
-      std::unique_ptr<Expression> a);
+      ExpressionPtr a);
     /**
      * Imbue a unary operator into an expression.
      * a is the recipient, and it should also be the invoker.
      * prec should receive the entry in the precedence table,
      * right-shifted by 3.
      */
-    virtual std::unique_ptr<Expression> imbue(
-      std::unique_ptr<Expression> a,
+    virtual ExpressionPtr imbue(
+      ExpressionPtr a,
       Operator o, size_t precedence);
     /**
      * Returns the semantic result of juxtaposing a and b.
      */
-    virtual std::unique_ptr<Expression> juxtapose(
-      std::unique_ptr<Expression> b,
-      std::unique_ptr<Expression> a);
+    virtual ExpressionPtr juxtapose(
+      ExpressionPtr b,
+      ExpressionPtr a);
     /**
-     * Prints a representation of the expression to stdout.
+     * Prints a representation of the expression to out.
      * BTW, did you know that `hack` means trace in Arka?
      */
-    virtual void trace() const = 0;
+    virtual void trace(std::ostream& out) const = 0;
+    /** What the expression can evaluate to (see Types.h). */
+    uint8_t type = 0;
+    /**
+     * Always an integer, and free of side effects, so it can be
+     * evaluated without boxing values (set by TypeInference).
+     */
+    bool unboxed = false;
+  private:
+    friend class ExpressionPtr;
+    // Owners besides the first
+    mutable uint32_t extraOwners = 0;
+  };
+  /**
+   * An owning pointer to an Expression. There is normally one per
+   * node, making the expressions trees, but share() adds another (see
+   * HashCons.h), so nodes count their owners. The count isn't atomic:
+   * share only while nothing else is using the nodes.
+   */
+  class ExpressionPtr {
+  public:
+    ExpressionPtr() : p(nullptr) {}
+    ExpressionPtr(std::nullptr_t) : p(nullptr) {}
+    template<typename T>
+    ExpressionPtr(std::unique_ptr<T>&& u) : p(u.release()) {}
+    ExpressionPtr(ExpressionPtr&& o) : p(o.p) { o.p = nullptr; }
+    ExpressionPtr(const ExpressionPtr&) = delete;
+    ~ExpressionPtr() { drop(); }
+    ExpressionPtr& operator=(ExpressionPtr&& o) {
+      if (this != &o) {
+        drop();
+        p = o.p;
+        o.p = nullptr;
+      }
+      return *this;
+    }
+    ExpressionPtr& operator=(const ExpressionPtr&) = delete;
+    /** Another owner of e, which must already have one. */
+    static ExpressionPtr share(Expression* e);
+    Expression* get() const { return p; }
+    Expression* operator->() const { return p; }
+    Expression& operator*() const { return *p; }
+    explicit operator bool() const { return p != nullptr; }
+    bool operator==(std::nullptr_t) const { return p == nullptr; }
+    bool operator!=(std::nullptr_t) const { return p != nullptr; }
+  private:
+    void drop();
+    // Delete e and the nodes that only it owns, without recursing
+    static void destroy(Expression* e);
+    Expression* p;
   };
-  using ExpressionPtr = std::unique_ptr<Expression>;
+  inline ExpressionPtr ExpressionPtr::share(Expression* e) {
+    ExpressionPtr q;
+    q.p = e;
+    if (e != nullptr) ++e->extraOwners;
+    return q;
+  }
+  inline void ExpressionPtr::drop() {
+    if (p == nullptr) return;
+    if (p->extraOwners > 0) --p->extraOwners;
+    else destroy(p);
+  }
   class Literal : public Expression {
   public:
-    using LiteralValue = std::variant<Identifier, IntLiteral, StringLiteral>;
+    using LiteralValue =
+      std::variant<Identifier, IntLiteral, StringLiteral, BigIntLiteral>;
     Literal(LiteralValue&& val) : val(std::move(val)) {}
     LiteralValue val;
     size_t id() const override { return 1; }
-    void trace() const override;
-    std::unique_ptr<Expression> juxtapose(
-      std::unique_ptr<Expression> b,
-      std::unique_ptr<Expression> a) override;
+    void trace(std::ostream& out) const override;
+    ExpressionPtr juxtapose(
+      ExpressionPtr b,
+      ExpressionPtr a) override;
   };
   class BinaryOp : public Expression {
   public:
@@ -74,6 +141,11 @@ namespace x666 {
     // but RHS for right-associative operators
     ExpressionPtr a, b;
     Operator o;
+    /** The left and right operands, regardless of associativity. */
+    const Expression* lhs() const;
+    const Expression* rhs() const;
+    Expression* lhs();
+    Expression* rhs();
     size_t id() const override { return 2; }
     ExpressionPtr imbue(
       ExpressionPtr ax,
@@ -86,7 +158,7 @@ namespace x666 {
     ExpressionPtr imbue(
       ExpressionPtr ax,
       Operator o, size_t precedence) override;
-    void trace() const override;
+    void trace(std::ostream& out) const override;
   };
   class UnaryOp : public Expression {
   public:
@@ -105,7 +177,7 @@ namespace x666 {
       ExpressionPtr bx,
       Operator o, size_t precedence,
       ExpressionPtr a) override;
-    void trace() const override;
+    void trace(std::ostream& out) const override;
   };
   class Bracket : public Expression {
   public:
@@ -114,7 +186,7 @@ namespace x666 {
     ExpressionPtr ex;
     Operator bracket;
     size_t id() const override { return 4; }
-    void trace() const override;
+    void trace(std::ostream& out) const override;
     ExpressionPtr juxtapose(
       ExpressionPtr b,
       ExpressionPtr a) override;
@@ -127,13 +199,44 @@ namespace x666 {
     // but RHS for right-associative operators
     ExpressionPtr a, b;
     size_t id() const override { return 5; }
-    void trace() const override;
+    void trace(std::ostream& out) const override;
+  };
+  /**
+   * A variable reference after resolution (see Resolver):
+   * name is kept for tracing, slot indexes the variable storage and li
+   * is where it is read or assigned, for error messages.
+   */
+  class Variable : public Expression {
+  public:
+    Variable(const std::string& name, size_t slot, const LineInfo& li) :
+      name(name), slot(slot), li(li) {}
+    std::string name;
+    size_t slot;
+    LineInfo li;
+    size_t id() const override { return 6; }
+    void trace(std::ostream& out) const override;
   };
   struct Statement {
     ExpressionPtr ex;
     Operator statementOp;
+    LineInfo li; // Position of the first token of the statement
     void trace() const;
+    void trace(std::ostream& out) const;
   };
+  /**
+   * How deeply expressions and blocks may nest. The parser and the
+   * passes over the trees recurse once per level, and this many levels
+   * take a few MiB of stack at most, so a program that parses can be
+   * compiled and run on an ordinary thread. Deeper programs fail to
+   * parse with LexErrorCode::nestedTooDeeply.
+   */
+  constexpr size_t maxNesting = 2000;
+  /**
+   * The stack that x666 gives the threads it parses and runs programs
+   * on, with room to spare for sanitizer builds, whose frames are
+   * several times larger. Its pages are only touched as needed.
+   */
+  constexpr size_t threadStackSize = (size_t) 64 << 20;
   /**
    * A parser object.
    */
@@ -144,9 +247,13 @@ namespace x666 {
       size_t thisLineSize; // The size of thisLine when pushed
     };
     /**
-     * Initialise the parser object.
+     * Initialise the parser object. If fh reads from stream, which
+     * can't be reread from the start, error snippets are rendered as
+     * each statement ends, and only the input from the current
+     * statement on is kept. The statements themselves are kept too,
+     * unless traceTo is set.
      */
-    Parser(std::istream* fh);
+    Parser(std::istream* fh, StreamBuffer* stream = nullptr);
     void parse();
     /**
      * Accept a token (passed as a parameter)
@@ -163,13 +270,62 @@ namespace x666 {
     ExpressionPtr parseExpression();
     const LineInfo& getLastLineInfo() const;
     void foldStack();
+    /**
+     * Imbue a binary operator and its RHS b into the expression on top
+     * of thisLine. prec is right-shifted by 3, as for imbue.
+     */
+    void imbueTop(Operator o, size_t prec, ExpressionPtr b);
+    /**
+     * Render the snippets of new errors and release their lines, and
+     * with traceTo set, trace and drop the statements.
+     */
+    void finishStatement();
+    /**
+     * After a statement that opens a block body, skip the body and
+     * leave a placeholder (Operator::block) in its place.
+     */
+    void skipBlock();
+    /** Expand the #< statements not yet expanded, with includes. */
+    void expandIncludes();
     std::vector<Statement> statements;
     std::stack<ExpressionPtr> thisLine;
     std::stack<LineInfo> positions;
     std::stack<BracketEntry> brackets;
     std::vector<LexError> errorLog;
     std::istream* fh;
+    StreamBuffer* stream;
+    size_t rendered = 0; // Errors whose snippets have been rendered
+    // If set, #< statements are expanded (see Module.h): when parsing
+    // from a stream, as each ends, while its line is still there for
+    // error snippets, otherwise once all are parsed.
+    Includes* includes = nullptr;
+    size_t expanded = 0; // Statements with their #< expanded
+    // If set when parsing from a stream, each statement is traced here
+    // as it ends (until there is an error, when nothing more needs to
+    // be) and then dropped, so the trees don't pile up.
+    std::ostream* traceTo = nullptr;
+    // Leave block bodies unparsed (see BlockLoader)
+    bool lazy = false;
+    // Where each skipped body ends, by the byte it starts at
+    std::unordered_map<size_t, size_t> blockEnds;
+    // Variables assigned in the skipped bodies
+    std::unordered_set<std::string> skippedStores;
+    // Where imbueTop last put an operator, so that a chain of them
+    // (a <- b <- c ...) doesn't walk down from the root each time. Only
+    // valid while root is still on top of thisLine, unchanged since.
+    struct Spine {
+      const Expression* root = nullptr;
+      ExpressionPtr* slot = nullptr; // nullptr => the root itself
+      size_t prec = 0;
+    } spine;
+    // Calls of pushExpression under way, each for an operand
+    size_t pushDepth = 0;
+    // Blocks open at the statement being parsed
+    size_t blockDepth = 0;
+    // The line nests too deeply: ignore its tokens until it ends
+    bool tooDeep = false;
     LineInfo li;
+    LineInfo statementStart;
     // plus => no explicit statement
     // minus => already taken in a token
     Operator currentStatement;
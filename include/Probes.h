@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * Static tracepoints (USDT probes) for perf and bpftrace, under the
+ * provider x666. With X666_PROBES they compile to a nop plus a note
+ * in the ELF file, using <sys/sdt.h>; without it they vanish. Build
+ * with cmake -DX666_PROBES=ON to get them, and tests/probes.py (run by
+ * ctest) checks that every probe below made it into .note.stapsdt.
+ *
+ *   token(kind, byte)        getNextToken returns a token; kind is its
+ *                            index in Token, byte where it starts
+ *   accept(kind, byte)       Parser::acceptToken is handed a token
+ *   fold(count)              foldStack juxtaposes count expressions
+ *   commit(op, byte)         a statement is finished
+ *   lex_error(code, byte)    a LexError is created
+ *   runtime_error(code, byte)
+ *   parse_start(), parse_done(statements, errors)
+ *   resolve_start(), resolve_done(slots, errors)
+ *   run_start(pc), run_done(pc, statements executed)
+ *
+ * For example, to time parsing:
+ *
+ *   bpftrace -e 'usdt:./x666:x666:parse_start { @s[tid] = nsecs; }
+ *     usdt:./x666:x666:parse_done { @ns = hist(nsecs - @s[tid]); }'
+ */
+
+#ifdef X666_PROBES
+#include <sys/sdt.h>
+#define X666_PROBE0(name) DTRACE_PROBE(x666, name)
+#define X666_PROBE1(name, a) DTRACE_PROBE1(x666, name, a)
+#define X666_PROBE2(name, a, b) DTRACE_PROBE2(x666, name, a, b)
+#else
+#define X666_PROBE0(name) ((void) 0)
+#define X666_PROBE1(name, a) ((void) 0)
+#define X666_PROBE2(name, a, b) ((void) 0)
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iosfwd>
+#include <vector>
+
+namespace x666 {
+  class NativeLoop;
+  struct Program;
+  /**
+   * Where a run of a program spends its time, by statement: how many
+   * times each statement ran, and how many CPU time samples (taken on
+   * SIGPROF) landed on it.
+   *
+   * A profiled Interpreter calls enter() before every statement. An
+   * Interpreter without a Profile runs a separate copy of its loop, so
+   * profiling costs nothing when it is off.
+   *
+   * The JIT stays on: loops compiled while profiling add to counters()
+   * themselves, and samples that land in their code go to the
+   * statement it was compiled from (see NativeLoop::statementAt).
+   */
+  class Profile {
+  public:
+    Profile(const Program& program);
+    /**
+     * Start sampling, hz times a second of CPU time. Only one Profile
+     * can sample at a time.
+     */
+    void start(unsigned hz = 1000);
+    void stop();
+    void enter(size_t pc) {
+      ++counts[pc];
+      current = pc;
+    }
+    /** How many times each statement has run, for native code. */
+    uint64_t* counters() { return counts.data(); }
+    /**
+     * Attribute samples taken in loop's code to its statements, until
+     * called again with nullptr.
+     */
+    void runningNative(const NativeLoop* loop) { native = loop; }
+    /**
+     * Print the source with the counts and samples of each line, then
+     * the same for each file that the program included.
+     */
+    void listing(std::ostream& out) const;
+    /**
+     * Print the samples in the folded stack format of flamegraph.pl:
+     * one line per statement, with the blocks around it as callers.
+     * Frames of included statements start with the file's path.
+     */
+    void folded(std::ostream& out) const;
+  private:
+    static void onSample(int, siginfo_t*, void* context);
+    const Program& program;
+    std::vector<uint64_t> counts;
+    // One more than there are statements, for samples taken before
+    // the first statement runs
+    std::vector<uint64_t> samples;
+    volatile size_t current;
+    const NativeLoop* volatile native = nullptr;
+    uint64_t cpuNanos = 0; // Between start() and stop()
+  };
+}
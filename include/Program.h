@@ -0,0 +1,24 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Parser.h"
+
+namespace x666 {
+  struct Module;
+  /**
+   * A parsed and resolved program. It is never modified after it is
+   * built, so any number of instances on any threads can share it.
+   */
+  struct Program {
+    std::string name;
+    std::string source; // For error snippets
+    std::vector<Statement> statements;
+    std::vector<std::string> slotNames;
+    // The files it included, so a cached build can be checked against
+    // them (see Module.h)
+    std::vector<std::shared_ptr<const Module>> included;
+  };
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Lexer.h"
+#include "Parser.h"
+
+namespace x666 {
+  /**
+   * Resolves variables to dense slot indices.
+   * Every identifier in the statements is replaced with a Variable
+   * node; each distinct name gets its own slot, numbered in order of
+   * first appearance.
+   */
+  class Resolver {
+  public:
+    Resolver(std::vector<Statement>& statements) : statements(statements) {}
+    /**
+     * Rewrite the statements in place. Reads of variables that are
+     * never assigned anywhere (by <- or as an @# loop variable) are
+     * reported to errorLog, unless allowInputs is set, in which case
+     * they are recorded in inputSlots. Returns true if no errors were
+     * found.
+     */
+    bool resolve(std::vector<LexError>& errorLog, bool allowInputs = false);
+    /**
+     * Resolve more statements against the same slots, such as the body
+     * of a block parsed after the rest. New names get new slots.
+     */
+    bool resolve(std::vector<Statement>& more, std::vector<LexError>& errorLog);
+    /** Count names as assigned by statements that aren't parsed yet. */
+    void assumeAssigned(const std::unordered_set<std::string>& names) {
+      assigned.insert(names.begin(), names.end());
+    }
+    size_t slotCount() const { return slotNames.size(); }
+    /** The name of each slot. */
+    std::vector<std::string> slotNames;
+    /** Slots that are read but never assigned, in order of first use. */
+    std::vector<size_t> inputSlots;
+  private:
+    size_t slotFor(const std::string& name);
+    void collectStores(const Expression* ex);
+    void rewrite(ExpressionPtr& ex);
+    bool resolveAll(std::vector<Statement>& list);
+    std::vector<Statement>& statements;
+    std::unordered_map<std::string, size_t> slots;
+    std::unordered_set<std::string> assigned;
+    std::unordered_set<std::string> reported;
+    std::vector<LexError>* errorLog;
+    bool allowInputs = false;
+  };
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iosfwd>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "x666.h"
+
+namespace x666 {
+  struct Module;
+  /** What a client asks the server to do with a program. */
+  enum class Request : uint8_t {
+    trace, // Parse it and print the statements, like plain x666
+    run, // Like x666 --run
+    runNoJit, // Like x666 --run --no-jit
+  };
+  /**
+   * A daemon that parses and runs programs for clients over a Unix
+   * domain socket, so that short invocations don't pay for process
+   * startup and parsing every time.
+   *
+   * Parsed programs (or, for traces, the text they print) are cached
+   * by the hash of their source, name and the client's directory in
+   * an LRU holding up to cacheBytes, and used again while the files
+   * they include with #< hold what they did. Programs that fail to
+   * parse aren't kept, since the fix may be in a file they include.
+   * Each connection is handled on its own thread, with a stack of
+   * threadStackSize (see Parser.h) as x666 itself has.
+   */
+  class Server {
+  public:
+    Server(std::string socketPath, size_t cacheBytes) :
+      socketPath(std::move(socketPath)), cacheBytes(cacheBytes) {}
+    /**
+     * Serve until the process is killed. Returns false (with the
+     * reason in log) if the socket can't be opened.
+     */
+    bool serve(std::ostream& log);
+  private:
+    // A program as the client sent it
+    struct Source {
+      std::string name; // Its file name, or - for stdin
+      std::string directory; // The client's working directory
+      std::string text;
+    };
+    struct Entry {
+      uint64_t key;
+      Source source;
+      // What the request prints before running anything: the trace,
+      // or the parse errors. program is null unless it parsed.
+      std::string text;
+      ProgramHandle program;
+      std::vector<std::shared_ptr<const Module>> included;
+      bool keep = false; // Whether to cache it
+      size_t bytes;
+    };
+    struct Connection {
+      Server* server;
+      int fd;
+    };
+    void handle(int fd);
+    /** Handle a Connection on a thread of its own, then delete it. */
+    static void* handleThread(void* connection);
+    std::shared_ptr<const Entry> lookup(Request r, Source s);
+    std::shared_ptr<const Entry> build(Request r, uint64_t key, Source s);
+    std::string socketPath;
+    size_t cacheBytes;
+    std::mutex lock;
+    // Most recently used first
+    std::list<std::shared_ptr<const Entry>> entries;
+    std::unordered_map<
+      uint64_t, std::list<std::shared_ptr<const Entry>>::iterator> index;
+    size_t usedBytes = 0;
+  };
+  /**
+   * Ask the server at socketPath to carry out r on source, read from
+   * the file name (relative to this process's working directory, as
+   * are the files it includes), copying what it prints to out and its
+   * exit status to status. Returns false if no server is listening
+   * there.
+   */
+  bool sendRequest(
+    const std::string& socketPath, Request r, const std::string& name,
+    const std::string& source, std::ostream& out, int& status);
+  /** $XDG_RUNTIME_DIR/x666.sock, or a per-user path under /tmp. */
+  std::string defaultSocketPath();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <streambuf>
+#include <vector>
+
+namespace x666 {
+  /**
+   * A stream buffer over a file descriptor that can't seek, such as a
+   * pipe. Input is read a chunk at a time as the lexer asks for it, so
+   * parsing starts before the writer is done.
+   *
+   * Only a window of recent input is kept: everything from the last
+   * position passed to release() onwards. Seeking back within that
+   * window works, which is enough to print error snippets; seeking
+   * anywhere before it fails.
+   */
+  class StreamBuffer : public std::streambuf {
+  public:
+    StreamBuffer(int fd, size_t chunkSize = 65536) :
+      fd(fd), chunkSize(chunkSize) {}
+    /** Allow the input before byte to be dropped. */
+    void release(size_t byte) {
+      if (byte > released) released = byte;
+    }
+  protected:
+    int_type underflow() override;
+    pos_type seekoff(
+      off_type off, std::ios_base::seekdir dir,
+      std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+  private:
+    int fd;
+    size_t chunkSize;
+    std::vector<char> window;
+    size_t base = 0; // Offset of window[0] in the input
+    size_t released = 0;
+  };
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "Parser.h"
+
+namespace x666 {
+  /** A set of the types a value can have, one bit each. */
+  using TypeSet = uint8_t;
+  constexpr TypeSet integerType = 1; // int64_t or BigInt
+  constexpr TypeSet stringType = 2;
+  constexpr TypeSet listType = 4;
+  constexpr TypeSet anyType = integerType | stringType | listType;
+  // A variable that may not have been assigned yet
+  constexpr TypeSet unsetType = 8;
+  /** Names the types in t, such as "integer|string". */
+  std::string typeName(TypeSet t);
+  /**
+   * Works out which types each variable can have at each statement,
+   * following the blocks: a variable assigned an integer is an integer
+   * from there on, an if-chain joins what its clauses leave, and a
+   * loop is walked again until its variables stop widening.
+   *
+   * Every expression gets the set of types it can evaluate to (type),
+   * and those that are always integers and have no side effects are
+   * marked unboxed; the Interpreter evaluates them on bare int64_t
+   * values and only falls back to Values on overflow or a BigInt.
+   *
+   * Run it after Resolver, and after HashConser, whose merged nodes
+   * get the union of their types.
+   */
+  class TypeInference {
+  public:
+    TypeInference(std::vector<Statement>& statements, size_t slotCount) :
+      statements(statements), slotCount(slotCount),
+      variables(slotCount, 0) {}
+    /**
+     * Annotate the expressions. Returns false, leaving them alone, if
+     * the block structure is invalid.
+     */
+    bool run();
+    /**
+     * Print each statement with its type, each variable with every
+     * type it can have, and how many expressions were proven what.
+     */
+    void report(
+      std::ostream& out, const std::vector<std::string>& slotNames) const;
+    size_t expressions = 0, integers = 0, strings = 0, lists = 0;
+    size_t unboxed = 0;
+  private:
+    using State = std::vector<TypeSet>;
+    TypeSet expr(Expression* ex, State& s);
+    TypeSet binary(BinaryOp* b, State& s);
+    void range(size_t i, size_t stop, State& s);
+    size_t ifChain(size_t i, State& s);
+    size_t loop(size_t h, State& s);
+    bool markUnboxed(Expression* ex);
+    void count(const Expression* ex);
+    std::vector<Statement>& statements;
+    size_t slotCount;
+    // As in Interpreter: the next clause or matching &> of each block
+    std::vector<size_t> jumps;
+    // Every type each variable has anywhere
+    State variables;
+  };
+}
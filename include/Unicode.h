@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace x666 {
+  /** Is every byte of s[0 .. n) below 0x80? */
+  bool isAscii(const char* s, size_t n);
+  /**
+   * Is s[0 .. n) well-formed UTF-8? Overlong forms, surrogates and
+   * code points past U+10FFFF are not.
+   */
+  bool isValidUtf8(const char* s, size_t n);
+  /** The number of code points in the UTF-8 s[0 .. n). */
+  size_t countCodePoints(const char* s, size_t n);
+  /**
+   * The length of the UTF-8 sequence that starts with lead, or 0 if
+   * lead can't start one.
+   */
+  size_t sequenceLength(unsigned char lead);
+  /**
+   * Decode the code point at the start of s[0 .. n) into cp. Returns
+   * its length in bytes, or 0 if it isn't well-formed.
+   */
+  size_t decodeUtf8(const char* s, size_t n, uint32_t& cp);
+  /**
+   * Can the code point cp (not ASCII) appear in an identifier? These
+   * are the letters and combining marks (categories L and M).
+   */
+  bool isLetter(uint32_t cp);
+}
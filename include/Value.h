@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "BigInt.h"
+
+namespace x666 {
+  /**
+   * A runtime string.
+   * Concatenation either appends in place (when this string holds the
+   * only reference to a flat buffer) or produces a rope node in O(1).
+   * Ropes are flattened lazily, the first time contiguous bytes are
+   * needed (indexing, comparison, printing).
+   */
+  class String {
+  public:
+    String();
+    String(std::string&& s);
+    String(const std::string& s);
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+    /** Get the contents as contiguous bytes, flattening if needed. */
+    const std::string& flat() const;
+    char at(size_t i) const { return flat()[i]; }
+    int compare(const String& other) const;
+    bool sameRep(const String& other) const { return rep == other.rep; }
+    /**
+     * Concatenate two strings. Pass a by value (moving when possible)
+     * so that an exclusively-owned buffer can be reused.
+     */
+    static String concat(String a, const String& b);
+    struct Rep;
+  private:
+    String(std::shared_ptr<Rep> rep) : rep(std::move(rep)) {}
+    std::shared_ptr<Rep> rep;
+  };
+  /**
+   * Write n in decimal to the characters that end at end, returning
+   * where they start. It takes at most 20 of them.
+   */
+  char* formatInteger(int64_t n, char* end);
+  class List;
+  using ListPtr = std::shared_ptr<const List>;
+  using BigIntPtr = std::shared_ptr<const BigInt>;
+  /**
+   * A runtime value: an integer, a string or a list.
+   * Integers that fit in 64 bits are always stored as int64_t;
+   * BigInt is used only for those that don't.
+   */
+  struct Value {
+    using Data = std::variant<int64_t, String, ListPtr, BigIntPtr>;
+    Value() : v((int64_t) 0) {}
+    Value(int64_t n) : v(n) {}
+    Value(String&& s) : v(std::move(s)) {}
+    Value(ListPtr&& l) : v(std::move(l)) {}
+    /** Demotes n to int64_t if it fits. */
+    Value(BigInt&& n);
+    Data v;
+    bool isInt() const { return v.index() == 0; }
+    bool isString() const { return v.index() == 1; }
+    bool isList() const { return v.index() == 2; }
+    bool isBigInt() const { return v.index() == 3; }
+    bool isInteger() const { return isInt() || isBigInt(); }
+    /** Get an integer value as a BigInt, whichever way it is stored. */
+    BigInt toBigInt() const;
+    bool truthy() const;
+    /** Convert to a string for `~`. Lists have no string form. */
+    bool toString(String& out) const;
+    void print(std::ostream& out) const;
+  };
+  /**
+   * A runtime list. Lists of integers that fit in 64 bits are packed
+   * into contiguous int64_t; the first element of any other kind boxes
+   * the whole list as Values.
+   */
+  class List {
+  public:
+    size_t size() const { return packed ? ints.size() : values.size(); }
+    bool empty() const { return size() == 0; }
+    Value at(size_t i) const { return packed ? Value(ints[i]) : values[i]; }
+    bool isPacked() const { return packed; }
+    /** The elements of a packed list. */
+    const std::vector<int64_t>& integers() const { return ints; }
+    void reserve(size_t n);
+    void push(Value&& v);
+    /** Append n integers at once. */
+    void append(const int64_t* p, size_t n);
+  private:
+    void box();
+    bool packed = true;
+    std::vector<int64_t> ints;
+    std::vector<Value> values;
+  };
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+/*
+ * The embedding API of libx666. Only this header and Profile.h are
+ * installed; the others describe internals that may change between
+ * versions.
+ */
+
+namespace x666 {
+  struct Program;
+  class Profile;
+  /** A parse or runtime error. */
+  struct Diagnostic {
+    enum class Kind { parse, runtime };
+    Kind kind;
+    size_t line, column; // 1-based
+    /** The file it is in, if it was included with #<. */
+    std::string file;
+    std::string message;
+    /** The source lines it covers, with a caret under the error. */
+    std::string snippet;
+    /** Print it the way the x666 command does. */
+    void print(std::ostream& out) const;
+  };
+  /** Receives the diagnostics of compile() and run(). */
+  class DiagnosticSink {
+  public:
+    virtual ~DiagnosticSink() = default;
+    virtual void report(const Diagnostic& d) = 0;
+  };
+  /** Receives what a program prints with #>. */
+  class OutputSink {
+  public:
+    virtual ~OutputSink() = default;
+    virtual void write(const char* data, size_t size) = 0;
+    /**
+     * Write count buffers in order. By default this calls write() on
+     * each; a sink that can take them all at once may override it.
+     */
+    virtual void writeAll(
+      const char* const* data, const size_t* sizes, size_t count);
+  };
+  /**
+   * A compiled program. It is immutable, so one handle can be run any
+   * number of times, from any number of threads at once.
+   */
+  using ProgramHandle = std::shared_ptr<const Program>;
+  struct CompileOptions {
+    /**
+     * Store identical subexpressions once (see HashCons.h), for
+     * programs that repeat themselves a lot.
+     */
+    bool hashCons = false;
+    /**
+     * A directory in which to keep the files included with #< once
+     * parsed, for other processes to read instead of parsing them.
+     */
+    std::string includeCache;
+    /**
+     * The directory that a relative name and the files it includes are
+     * found from, if not the working directory of this process. Errors
+     * still name those files relative to it.
+     */
+    std::string workingDirectory;
+  };
+  /**
+   * Compile source. name identifies it, and if it is the name of a
+   * file, the files that it includes with #< are found relative to
+   * its directory. Returns null, having reported the errors to
+   * diagnostics, if it doesn't parse. Expressions and blocks nested
+   * more than 2000 deep don't, so that compiling and running a program
+   * fit on the stack of an ordinary thread.
+   */
+  ProgramHandle compile(
+    std::string source, std::string name, DiagnosticSink& diagnostics,
+    const CompileOptions& options = CompileOptions());
+  struct RunOptions {
+    /** Compile hot loops to native code. */
+    bool jit = true;
+    /** If set, count the statements run in it (see Profile.h). */
+    Profile* profile = nullptr;
+    /** Bytes of #> output to collect before writing to the sink. */
+    size_t outputBuffer = 1 << 16;
+    /** Also write at the end of each line, for a reader watching. */
+    bool flushLines = false;
+    /**
+     * Write to the sink from a thread of its own, so the program
+     * doesn't wait for it. The sink is then called from that thread.
+     */
+    bool outputThread = false;
+  };
+  /**
+   * Run program from the start, with fresh variables. Returns false,
+   * having reported the error to diagnostics, if it fails.
+   */
+  bool run(
+    const Program& program, OutputSink& out, DiagnosticSink& diagnostics,
+    const RunOptions& options = RunOptions());
+}
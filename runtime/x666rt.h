@@ -0,0 +1,754 @@
+/*
+ * Runtime support for C programs generated by `x666 --emit-c`.
+ *
+ * Everything here is static, so a generated program is a single
+ * translation unit: cc -O2 -I<this directory> prog.c
+ *
+ * Values are reference counted. Every function below takes ownership
+ * of the values passed to it and returns a new reference, except where
+ * noted. As in the interpreter, integers are 64 bits wide until a
+ * result doesn't fit, when it becomes a big integer.
+ */
+#ifndef X666RT_H
+#define X666RT_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { X6_INT, X6_STR, X6_LIST, X6_UNDEF, X6_BIG };
+
+/* Must match RuntimeErrorCode in Interpreter.h */
+enum {
+  X6_UNMATCHED_END,
+  X6_UNTERMINATED_BLOCK,
+  X6_MISPLACED_BRANCH,
+  X6_UNDEFINED_VARIABLE,
+  X6_INVALID_ASSIGNMENT,
+  X6_TYPE_MISMATCH,
+  X6_INTEGER_OVERFLOW,
+  X6_DIVISION_BY_ZERO,
+  X6_INDEX_OUT_OF_RANGE,
+  X6_INVALID_FOR_LOOP,
+};
+
+typedef struct x6_str {
+  size_t refs;
+  size_t len;
+  size_t cap; /* 0 if data is not ours to grow (literals) */
+  char* data;
+} x6_str;
+
+/*
+ * An integer that doesn't fit in int64_t: a sign and a magnitude of
+ * 32-bit limbs, least significant first, without leading zeros.
+ */
+typedef struct x6_big {
+  size_t refs;
+  int negative;
+  size_t len;
+  uint32_t limbs[];
+} x6_big;
+
+struct x6_list;
+
+typedef struct x6_val {
+  int tag;
+  union {
+    int64_t i;
+    x6_str* s;
+    struct x6_list* l;
+    x6_big* b;
+  } u;
+} x6_val;
+
+typedef struct x6_list {
+  size_t refs;
+  size_t len;
+  x6_val elems[];
+} x6_list;
+
+#define X6_UNDEF_VAL {X6_UNDEF, {0}}
+/* A string literal; it holds a reference to itself and is never freed. */
+#define X6_STR_LIT(s) {1, sizeof(s) - 1, 0, (char*) (s)}
+
+/* Position of the statement being run, for error messages */
+static int x6_line, x6_col;
+#define X6_AT(line, col) (x6_line = (line), x6_col = (col))
+
+static inline void x6_fail(int code) __attribute__((noreturn));
+static inline void x6_fail(int code) {
+  static const char* const messages[] = {
+    "&> without a matching block",
+    "Block is never closed with &>",
+    "?& or !! outside of a ?? block",
+    "Variable is used before it is assigned",
+    "Left side of <- must be a variable",
+    "Operand has the wrong type",
+    "Integer is too big to fit type",
+    "Division by zero",
+    "Index is out of range",
+    "@# needs a variable, a start and an end",
+  };
+  fflush(stdout);
+  printf("Runtime error at line %d column %d: %s\n",
+    x6_line, x6_col, messages[code]);
+  exit(1);
+}
+
+static inline x6_val x6_int(int64_t n) {
+  x6_val v;
+  v.tag = X6_INT;
+  v.u.i = n;
+  return v;
+}
+
+static inline void x6_ref(x6_val v) {
+  if (v.tag == X6_STR) ++v.u.s->refs;
+  else if (v.tag == X6_LIST) ++v.u.l->refs;
+  else if (v.tag == X6_BIG) ++v.u.b->refs;
+}
+
+/*
+ * Kept out of line: inlined into straight-line generated code, it only
+ * confuses the compiler's use-after-free analysis.
+ */
+static void x6_free(x6_val v) __attribute__((noinline, unused));
+
+static inline void x6_drop(x6_val v) {
+  if (v.tag == X6_STR) {
+    if (--v.u.s->refs == 0) x6_free(v);
+  } else if (v.tag == X6_LIST) {
+    if (--v.u.l->refs == 0) x6_free(v);
+  } else if (v.tag == X6_BIG) {
+    if (--v.u.b->refs == 0) free(v.u.b);
+  }
+}
+
+static void x6_free(x6_val v) {
+  if (v.tag == X6_STR) {
+    if (v.u.s->cap != 0) free(v.u.s->data);
+    free(v.u.s);
+  } else {
+    size_t i;
+    for (i = 0; i < v.u.l->len; ++i) x6_drop(v.u.l->elems[i]);
+    free(v.u.l);
+  }
+}
+
+static inline void x6_out_of_memory(void) __attribute__((noreturn));
+static inline void x6_out_of_memory(void) {
+  fflush(stdout);
+  fputs("Out of memory\n", stderr);
+  exit(1);
+}
+
+static inline void* x6_alloc(size_t n) {
+  void* p = malloc(n);
+  if (p == NULL) x6_out_of_memory();
+  return p;
+}
+
+/*
+ * Big integers. As in the interpreter, a result that fits in int64_t
+ * is always an X6_INT again, so an X6_BIG is never zero and never
+ * equal to an X6_INT.
+ */
+
+/* The magnitude of an integer value; an X6_INT's is kept in small. */
+typedef struct x6_digits {
+  int negative;
+  size_t len;
+  const uint32_t* limbs;
+  uint32_t small[2];
+} x6_digits;
+
+static inline void x6_digits_of(const x6_val* v, x6_digits* d) {
+  uint64_t m;
+  if (v->tag == X6_BIG) {
+    d->negative = v->u.b->negative;
+    d->len = v->u.b->len;
+    d->limbs = v->u.b->limbs;
+    return;
+  }
+  m = v->u.i < 0 ? 0 - (uint64_t) v->u.i : (uint64_t) v->u.i;
+  d->negative = v->u.i < 0;
+  d->small[0] = (uint32_t) m;
+  d->small[1] = (uint32_t) (m >> 32);
+  d->len = m == 0 ? 0 : m >> 32 == 0 ? 1 : 2;
+  d->limbs = d->small;
+}
+
+/* A magnitude of len limbs, all zero */
+static inline x6_big* x6_big_alloc(size_t len) {
+  x6_big* b = (x6_big*) x6_alloc(sizeof(x6_big) + len * sizeof(uint32_t));
+  b->refs = 1;
+  b->negative = 0;
+  b->len = len;
+  memset(b->limbs, 0, len * sizeof(uint32_t));
+  return b;
+}
+
+/* Trim b and make it a value with that sign, an X6_INT if it fits. */
+static inline x6_val x6_big_value(x6_big* b, int negative) {
+  x6_val v;
+  uint64_t m;
+  while (b->len > 0 && b->limbs[b->len - 1] == 0) --b->len;
+  if (b->len <= 2) {
+    m = b->len == 0 ? 0 : b->limbs[0];
+    if (b->len == 2) m |= (uint64_t) b->limbs[1] << 32;
+    if (m <= (uint64_t) INT64_MAX ||
+        (negative && m == (uint64_t) INT64_MAX + 1)) {
+      free(b);
+      return x6_int(negative ? (int64_t) (0 - m) : (int64_t) m);
+    }
+  }
+  b->negative = negative;
+  v.tag = X6_BIG;
+  v.u.b = b;
+  return v;
+}
+
+static inline int x6_limbs_compare(
+    const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+  while (an > 0 && a[an - 1] == 0) --an;
+  while (bn > 0 && b[bn - 1] == 0) --bn;
+  if (an != bn) return an < bn ? -1 : 1;
+  while (an-- > 0) {
+    if (a[an] != b[an]) return a[an] < b[an] ? -1 : 1;
+  }
+  return 0;
+}
+
+/* a -= b in place, where a >= b and has at least as many limbs */
+static inline void x6_limbs_sub(
+    uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+  uint64_t borrow = 0, d;
+  size_t i;
+  for (i = 0; i < an; ++i) {
+    d = (uint64_t) a[i] - (i < bn ? b[i] : 0) - borrow;
+    a[i] = (uint32_t) d;
+    borrow = d >> 63;
+  }
+}
+
+static inline x6_big* x6_mag_add(const x6_digits* a, const x6_digits* b) {
+  size_t n = a->len > b->len ? a->len : b->len, i;
+  x6_big* r = x6_big_alloc(n + 1);
+  uint64_t carry = 0;
+  for (i = 0; i < n; ++i) {
+    carry += (uint64_t) (i < a->len ? a->limbs[i] : 0) +
+      (i < b->len ? b->limbs[i] : 0);
+    r->limbs[i] = (uint32_t) carry;
+    carry >>= 32;
+  }
+  r->limbs[n] = (uint32_t) carry;
+  return r;
+}
+
+/* |a| - |b|, where |a| >= |b| */
+static inline x6_big* x6_mag_sub(const x6_digits* a, const x6_digits* b) {
+  x6_big* r = x6_big_alloc(a->len);
+  memcpy(r->limbs, a->limbs, a->len * sizeof(uint32_t));
+  x6_limbs_sub(r->limbs, a->len, b->limbs, b->len);
+  return r;
+}
+
+static inline x6_big* x6_mag_mul(const x6_digits* a, const x6_digits* b) {
+  x6_big* r = x6_big_alloc(a->len + b->len);
+  uint64_t t;
+  size_t i, j;
+  for (i = 0; i < a->len; ++i) {
+    t = 0;
+    for (j = 0; j < b->len; ++j) {
+      t += (uint64_t) a->limbs[i] * b->limbs[j] + r->limbs[i + j];
+      r->limbs[i + j] = (uint32_t) t;
+      t >>= 32;
+    }
+    r->limbs[i + b->len] = (uint32_t) t;
+  }
+  return r;
+}
+
+/*
+ * |a| / |b| and |a| % |b|, where b isn't zero: by one limb at a time
+ * if b has only one, else a bit at a time, which is slow but enough
+ * for the occasional big division.
+ */
+static inline void x6_mag_divmod(
+    const x6_digits* a, const x6_digits* b, x6_big** q, x6_big** m) {
+  size_t i, j, n = b->len + 1;
+  uint64_t rem = 0, cur;
+  *q = x6_big_alloc(a->len);
+  *m = x6_big_alloc(n);
+  if (b->len == 1) {
+    for (i = a->len; i-- > 0;) {
+      cur = rem << 32 | a->limbs[i];
+      (*q)->limbs[i] = (uint32_t) (cur / b->limbs[0]);
+      rem = cur % b->limbs[0];
+    }
+    (*m)->limbs[0] = (uint32_t) rem;
+    return;
+  }
+  for (i = a->len * 32; i-- > 0;) {
+    /* m = m << 1 | the next bit of a */
+    cur = (a->limbs[i / 32] >> (i % 32)) & 1;
+    for (j = 0; j < n; ++j) {
+      cur |= (uint64_t) (*m)->limbs[j] << 1;
+      (*m)->limbs[j] = (uint32_t) cur;
+      cur >>= 32;
+    }
+    if (x6_limbs_compare((*m)->limbs, n, b->limbs, b->len) >= 0) {
+      x6_limbs_sub((*m)->limbs, n, b->limbs, b->len);
+      (*q)->limbs[i / 32] |= (uint32_t) 1 << (i % 32);
+    }
+  }
+}
+
+/* a o b for integers, where either is big or the result overflows */
+static inline x6_val x6_big_arith(char o, x6_val a, x6_val b) {
+  x6_digits x, y;
+  x6_big* r;
+  x6_big* m;
+  x6_val v;
+  int negative;
+  if ((a.tag != X6_INT && a.tag != X6_BIG) ||
+      (b.tag != X6_INT && b.tag != X6_BIG))
+    x6_fail(X6_TYPE_MISMATCH);
+  x6_digits_of(&a, &x);
+  x6_digits_of(&b, &y);
+  if (o == '-') y.negative = !y.negative;
+  switch (o) {
+    case '+':
+    case '-':
+      if (x.negative == y.negative) {
+        r = x6_mag_add(&x, &y);
+        negative = x.negative;
+      } else if (x6_limbs_compare(x.limbs, x.len, y.limbs, y.len) >= 0) {
+        r = x6_mag_sub(&x, &y);
+        negative = x.negative;
+      } else {
+        r = x6_mag_sub(&y, &x);
+        negative = y.negative;
+      }
+      break;
+    case '*':
+      r = x6_mag_mul(&x, &y);
+      negative = x.negative != y.negative;
+      break;
+    default:
+      if (y.len == 0) x6_fail(X6_DIVISION_BY_ZERO);
+      x6_mag_divmod(&x, &y, &r, &m);
+      if (o == '/') {
+        free(m);
+        negative = x.negative != y.negative;
+      } else {
+        free(r);
+        r = m;
+        negative = x.negative;
+      }
+  }
+  v = x6_big_value(r, negative);
+  x6_drop(a);
+  x6_drop(b);
+  return v;
+}
+
+/* Signed comparison of two integer values, not consumed */
+static inline int x6_big_compare(const x6_val* a, const x6_val* b) {
+  x6_digits x, y;
+  int c;
+  x6_digits_of(a, &x);
+  x6_digits_of(b, &y);
+  if (x.negative != y.negative) return x.negative ? -1 : 1;
+  c = x6_limbs_compare(x.limbs, x.len, y.limbs, y.len);
+  return x.negative ? -c : c;
+}
+
+/* The decimal digits of b, after a - if it is negative, in a buffer to
+ * be freed; *n is set to their number. */
+static inline char* x6_big_string(const x6_big* b, size_t* n) {
+  size_t len = b->len, size = 10 * b->len + 2, i;
+  uint32_t* m = (uint32_t*) x6_alloc(len * sizeof(uint32_t));
+  char* buf = (char*) x6_alloc(size);
+  char* p = buf + size;
+  uint64_t rem, cur;
+  memcpy(m, b->limbs, len * sizeof(uint32_t));
+  while (len > 0) {
+    /* Nine digits at a time */
+    rem = 0;
+    for (i = len; i-- > 0;) {
+      cur = rem << 32 | m[i];
+      m[i] = (uint32_t) (cur / 1000000000);
+      rem = cur % 1000000000;
+    }
+    while (len > 0 && m[len - 1] == 0) --len;
+    for (i = 0; i < 9 && (len > 0 || rem != 0); ++i) {
+      *--p = (char) ('0' + rem % 10);
+      rem /= 10;
+    }
+  }
+  free(m);
+  if (b->negative) *--p = '-';
+  *n = (size_t) (buf + size - p);
+  memmove(buf, p, *n);
+  return buf;
+}
+
+/* A big integer literal, from its decimal digits */
+static inline x6_val x6_big_lit(const char* digits) {
+  int negative = *digits == '-';
+  size_t len = strlen(digits) / 9 + 2, i;
+  x6_big* b = x6_big_alloc(len);
+  uint64_t t;
+  for (digits += negative; *digits != '\0'; ++digits) {
+    t = (uint64_t) (*digits - '0');
+    for (i = 0; i < len; ++i) {
+      t += (uint64_t) b->limbs[i] * 10;
+      b->limbs[i] = (uint32_t) t;
+      t >>= 32;
+    }
+  }
+  return x6_big_value(b, negative);
+}
+
+/*
+ * Values. The generated code keeps each value in a variable of its
+ * own, and passes on x6_dup of it to all but its last use.
+ */
+
+static inline x6_val x6_dup(x6_val v) {
+  x6_ref(v);
+  return v;
+}
+
+/* v, read from a variable; an unassigned one is reported at line and col. */
+static inline x6_val x6_defined(x6_val v, int line, int col) {
+  if (v.tag == X6_UNDEF) {
+    X6_AT(line, col);
+    x6_fail(X6_UNDEFINED_VARIABLE);
+  }
+  return v;
+}
+
+static inline int x6_truthy(const x6_val* v) {
+  switch (v->tag) {
+    case X6_INT: return v->u.i != 0;
+    case X6_BIG: return 1;
+    case X6_STR: return v->u.s->len != 0;
+    case X6_LIST: return v->u.l->len != 0;
+  }
+  return 0;
+}
+
+static inline int x6_test(x6_val v) {
+  int t = x6_truthy(&v);
+  x6_drop(v);
+  return t;
+}
+
+/* Like evaluateInt in the interpreter */
+static inline int64_t x6_get_int(x6_val v) {
+  if (v.tag == X6_BIG) x6_fail(X6_INTEGER_OVERFLOW);
+  if (v.tag != X6_INT) x6_fail(X6_TYPE_MISMATCH);
+  return v.u.i;
+}
+
+/* Strings */
+
+static inline x6_val x6_new_str(const char* data, size_t len, size_t cap) {
+  x6_val v;
+  x6_str* s = (x6_str*) x6_alloc(sizeof(x6_str));
+  s->refs = 1;
+  s->len = len;
+  s->cap = cap < 16 ? 16 : cap;
+  s->data = (char*) x6_alloc(s->cap);
+  memcpy(s->data, data, len);
+  v.tag = X6_STR;
+  v.u.s = s;
+  return v;
+}
+
+static inline x6_val x6_lit(x6_str* s) {
+  x6_val v;
+  ++s->refs;
+  v.tag = X6_STR;
+  v.u.s = s;
+  return v;
+}
+
+static inline x6_val x6_to_str(x6_val v) {
+  char buf[24];
+  int n;
+  if (v.tag == X6_STR) return v;
+  if (v.tag == X6_BIG) {
+    size_t len;
+    char* digits = x6_big_string(v.u.b, &len);
+    x6_val s = x6_new_str(digits, len, len);
+    free(digits);
+    x6_drop(v);
+    return s;
+  }
+  if (v.tag != X6_INT) x6_fail(X6_TYPE_MISMATCH);
+  n = snprintf(buf, sizeof(buf), "%" PRId64, v.u.i);
+  return x6_new_str(buf, (size_t) n, (size_t) n);
+}
+
+/*
+ * a ~ b. A string held only by a is appended to in place, with its
+ * capacity doubling, so building a string in a loop is linear.
+ */
+static inline x6_val x6_concat(x6_val a, x6_val b) {
+  x6_str* s;
+  x6_str* t;
+  size_t need;
+  a = x6_to_str(a);
+  b = x6_to_str(b);
+  s = a.u.s;
+  t = b.u.s;
+  if (t->len == 0) {
+    x6_drop(b);
+    return a;
+  }
+  need = s->len + t->len;
+  if (s->refs == 1 && s->cap != 0) {
+    if (need > s->cap) {
+      size_t cap = 2 * s->cap > need ? 2 * s->cap : need;
+      char* data = (char*) realloc(s->data, cap);
+      if (data == NULL) x6_out_of_memory();
+      s->data = data;
+      s->cap = cap;
+    }
+    memcpy(s->data + s->len, t->data, t->len);
+    s->len = need;
+    x6_drop(b);
+    return a;
+  } else {
+    x6_val r = x6_new_str(s->data, s->len, need);
+    memcpy(r.u.s->data + s->len, t->data, t->len);
+    r.u.s->len = need;
+    x6_drop(a);
+    x6_drop(b);
+    return r;
+  }
+}
+
+/* Lists */
+
+static inline x6_val x6_make_list(size_t n, const x6_val* elems) {
+  x6_val v;
+  x6_list* l = (x6_list*) x6_alloc(sizeof(x6_list) + n * sizeof(x6_val));
+  l->refs = 1;
+  l->len = n;
+  if (n != 0) memcpy(l->elems, elems, n * sizeof(x6_val));
+  v.tag = X6_LIST;
+  v.u.l = l;
+  return v;
+}
+
+static inline x6_val x6_index(x6_val a, x6_val b) {
+  int64_t i = x6_get_int(b);
+  x6_val r;
+  if (a.tag == X6_STR) {
+    if (i < 0 || (uint64_t) i >= a.u.s->len) x6_fail(X6_INDEX_OUT_OF_RANGE);
+    r = x6_new_str(a.u.s->data + i, 1, 1);
+  } else if (a.tag == X6_LIST) {
+    if (i < 0 || (uint64_t) i >= a.u.l->len) x6_fail(X6_INDEX_OUT_OF_RANGE);
+    r = a.u.l->elems[i];
+    x6_ref(r);
+  } else {
+    x6_fail(X6_TYPE_MISMATCH);
+  }
+  x6_drop(a);
+  return r;
+}
+
+static inline x6_val x6_length(x6_val a) {
+  int64_t n;
+  if (a.tag == X6_STR) n = (int64_t) a.u.s->len;
+  else if (a.tag == X6_LIST) n = (int64_t) a.u.l->len;
+  else x6_fail(X6_TYPE_MISMATCH);
+  x6_drop(a);
+  return x6_int(n);
+}
+
+/* Comparisons */
+
+static inline int x6_equal_ref(const x6_val* a, const x6_val* b) {
+  size_t i;
+  if (a->tag != b->tag) return 0;
+  switch (a->tag) {
+    case X6_INT: return a->u.i == b->u.i;
+    case X6_BIG:
+      return a->u.b->negative == b->u.b->negative &&
+        a->u.b->len == b->u.b->len &&
+        memcmp(a->u.b->limbs, b->u.b->limbs,
+          a->u.b->len * sizeof(uint32_t)) == 0;
+    case X6_STR:
+      return a->u.s->len == b->u.s->len &&
+        memcmp(a->u.s->data, b->u.s->data, a->u.s->len) == 0;
+    case X6_LIST:
+      if (a->u.l->len != b->u.l->len) return 0;
+      for (i = 0; i < a->u.l->len; ++i) {
+        if (!x6_equal_ref(&a->u.l->elems[i], &b->u.l->elems[i])) return 0;
+      }
+      return 1;
+  }
+  return 0;
+}
+
+static inline int x6_equal(x6_val a, x6_val b) {
+  int r = x6_equal_ref(&a, &b);
+  x6_drop(a);
+  x6_drop(b);
+  return r;
+}
+
+/* Negative, zero or positive as a is less than, equal to or more than b */
+static inline int x6_order(x6_val a, x6_val b) {
+  int r;
+  if (a.tag == X6_INT && b.tag == X6_INT)
+    return (a.u.i > b.u.i) - (a.u.i < b.u.i);
+  if ((a.tag == X6_INT || a.tag == X6_BIG) &&
+      (b.tag == X6_INT || b.tag == X6_BIG)) {
+    r = x6_big_compare(&a, &b);
+    x6_drop(a);
+    x6_drop(b);
+    return r;
+  }
+  if (a.tag == X6_STR && b.tag == X6_STR) {
+    size_t n = a.u.s->len < b.u.s->len ? a.u.s->len : b.u.s->len;
+    r = memcmp(a.u.s->data, b.u.s->data, n);
+    if (r == 0) r = (a.u.s->len > b.u.s->len) - (a.u.s->len < b.u.s->len);
+    x6_drop(a);
+    x6_drop(b);
+    return r;
+  }
+  x6_fail(X6_TYPE_MISMATCH);
+}
+
+static inline x6_val x6_eq(x6_val a, x6_val b) {
+  return x6_int(x6_equal(a, b));
+}
+static inline x6_val x6_ne(x6_val a, x6_val b) {
+  return x6_int(!x6_equal(a, b));
+}
+static inline x6_val x6_lt(x6_val a, x6_val b) {
+  return x6_int(x6_order(a, b) < 0);
+}
+static inline x6_val x6_gt(x6_val a, x6_val b) {
+  return x6_int(x6_order(a, b) > 0);
+}
+static inline x6_val x6_le(x6_val a, x6_val b) {
+  return x6_int(x6_order(a, b) <= 0);
+}
+static inline x6_val x6_ge(x6_val a, x6_val b) {
+  return x6_int(x6_order(a, b) >= 0);
+}
+
+/* Logic; & and | short-circuit, so the generated code handles them. */
+
+static inline x6_val x6_not(x6_val a) {
+  return x6_int(!x6_test(a));
+}
+static inline x6_val x6_xor(x6_val a, x6_val b) {
+  int x = x6_test(a);
+  return x6_int(x != x6_test(b));
+}
+
+/* Arithmetic, checked in 64 bits and promoting when that overflows */
+
+static inline x6_val x6_add(x6_val a, x6_val b) {
+  int64_t r;
+  if (a.tag == X6_INT && b.tag == X6_INT &&
+      !__builtin_add_overflow(a.u.i, b.u.i, &r))
+    return x6_int(r);
+  return x6_big_arith('+', a, b);
+}
+
+static inline x6_val x6_sub(x6_val a, x6_val b) {
+  int64_t r;
+  if (a.tag == X6_INT && b.tag == X6_INT &&
+      !__builtin_sub_overflow(a.u.i, b.u.i, &r))
+    return x6_int(r);
+  return x6_big_arith('-', a, b);
+}
+
+static inline x6_val x6_mul(x6_val a, x6_val b) {
+  int64_t r;
+  if (a.tag == X6_INT && b.tag == X6_INT &&
+      !__builtin_mul_overflow(a.u.i, b.u.i, &r))
+    return x6_int(r);
+  return x6_big_arith('*', a, b);
+}
+
+static inline x6_val x6_div(x6_val a, x6_val b) {
+  if (a.tag == X6_INT && b.tag == X6_INT) {
+    if (b.u.i == 0) x6_fail(X6_DIVISION_BY_ZERO);
+    if (a.u.i != INT64_MIN || b.u.i != -1) return x6_int(a.u.i / b.u.i);
+  }
+  return x6_big_arith('/', a, b);
+}
+
+static inline x6_val x6_mod(x6_val a, x6_val b) {
+  if (a.tag == X6_INT && b.tag == X6_INT) {
+    if (b.u.i == 0) x6_fail(X6_DIVISION_BY_ZERO);
+    if (b.u.i == -1) return x6_int(0);
+    return x6_int(a.u.i % b.u.i);
+  }
+  return x6_big_arith('%', a, b);
+}
+
+static inline x6_val x6_neg(x6_val a) {
+  if (a.tag == X6_INT && a.u.i != INT64_MIN) return x6_int(-a.u.i);
+  return x6_big_arith('-', x6_int(0), a);
+}
+
+/* @# loops. x6_for_step steps the loop variable i. */
+
+static inline int x6_for_enter(int64_t start, int64_t limit, int64_t step) {
+  if (step == 0) x6_fail(X6_INVALID_FOR_LOOP);
+  return step > 0 ? start <= limit : start >= limit;
+}
+
+static inline x6_val x6_for_step(x6_val i, int64_t step) {
+  int64_t r;
+  if (i.tag != X6_INT) x6_fail(X6_TYPE_MISMATCH);
+  if (__builtin_add_overflow(i.u.i, step, &r)) x6_fail(X6_INTEGER_OVERFLOW);
+  return x6_int(r);
+}
+
+/* #> */
+
+static inline void x6_write(const x6_val* v) {
+  size_t i;
+  switch (v->tag) {
+    case X6_INT: printf("%" PRId64, v->u.i); break;
+    case X6_BIG: {
+      size_t n;
+      char* digits = x6_big_string(v->u.b, &n);
+      fwrite(digits, 1, n, stdout);
+      free(digits);
+      break;
+    }
+    case X6_STR: fwrite(v->u.s->data, 1, v->u.s->len, stdout); break;
+    case X6_LIST:
+      putchar('(');
+      for (i = 0; i < v->u.l->len; ++i) {
+        if (i != 0) fputs(", ", stdout);
+        x6_write(&v->u.l->elems[i]);
+      }
+      putchar(')');
+      break;
+  }
+}
+
+static inline void x6_print(x6_val v) {
+  x6_write(&v);
+  putchar('\n');
+  x6_drop(v);
+}
+
+#endif
@@ -0,0 +1,520 @@
+#include "Batch.h"
+
+#include <string.h>
+
+#include <charconv>
+#include <iostream>
+#include <string_view>
+
+namespace x666 {
+  // Registers with a fixed meaning
+  static constexpr uint32_t allRows = 0; // 1 for each row in the block
+  static constexpr uint32_t rerun = 1; // rows to rerun in the Interpreter
+  Batch::Batch(
+      const std::vector<Statement>& statements,
+      const std::vector<std::string>& slotNames,
+      const std::vector<size_t>& inputSlots) :
+    statements(statements), slotNames(slotNames), inputSlots(inputSlots),
+    registers(2) {
+    for (size_t i = 0; i < slotNames.size(); ++i) {
+      valueOf.push_back(registers++);
+      definedOf.push_back(registers++);
+    }
+  }
+  uint32_t Batch::newRegister() {
+    return registers++;
+  }
+  void Batch::emit(
+      Kernel k, uint32_t dst, uint32_t a, uint32_t b, uint32_t c,
+      Operator o) {
+    ops.push_back({k, o, dst, a, b, c, 0});
+  }
+  bool Batch::error(RuntimeErrorCode c) {
+    errorLog->emplace_back(c, statements[current].li);
+    return false;
+  }
+  uint32_t Batch::load(size_t slot, uint32_t mask) {
+    bool input = false;
+    for (size_t s : inputSlots) input |= s == slot;
+    if (!input) emit(Kernel::checkDefined, 0, definedOf[slot], mask);
+    return valueOf[slot];
+  }
+  void Batch::store(size_t slot, uint32_t value, uint32_t mask) {
+    emit(Kernel::blend, valueOf[slot], value, mask);
+    emit(Kernel::maskOr, definedOf[slot], definedOf[slot], mask);
+  }
+  // Lower ex, evaluated on the rows in mask, to kernels. Returns the
+  // register holding its value, or UINT32_MAX if it can't be batched.
+  uint32_t Batch::lower(const Expression* ex, uint32_t mask) {
+    constexpr uint32_t fail = UINT32_MAX;
+    switch (ex->id()) {
+      case 1: {
+        const Literal* l = static_cast<const Literal*>(ex);
+        if (!std::holds_alternative<IntLiteral>(l->val)) return fail;
+        uint32_t r = newRegister();
+        emit(Kernel::constant, r);
+        ops.back().imm = std::get<IntLiteral>(l->val).n;
+        return r;
+      }
+      case 2: {
+        const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+        Operator o = b->o;
+        switch (o) {
+          case Operator::andStmt:
+          case Operator::orStmt: {
+            // Only evaluate the right side where it would be.
+            uint32_t x = lower(b->lhs(), mask);
+            if (x == fail) return fail;
+            uint32_t tx = newRegister(), m = newRegister();
+            emit(Kernel::truthy, tx, x);
+            emit(o == Operator::andStmt ? Kernel::maskAnd : Kernel::maskAndNot,
+              m, mask, tx);
+            uint32_t y = lower(b->rhs(), m);
+            if (y == fail) return fail;
+            uint32_t ty = newRegister(), r = newRegister();
+            emit(Kernel::truthy, ty, y);
+            emit(o == Operator::andStmt ? Kernel::maskAnd : Kernel::maskOr,
+              r, tx, ty);
+            return r;
+          }
+          case Operator::questionMark: {
+            const Expression* t = b->rhs();
+            const Expression* e = nullptr;
+            if (t->id() == 2 &&
+                static_cast<const BinaryOp*>(t)->o == Operator::colon) {
+              e = static_cast<const BinaryOp*>(t)->rhs();
+              t = static_cast<const BinaryOp*>(t)->lhs();
+            }
+            uint32_t c = lower(b->lhs(), mask);
+            if (c == fail) return fail;
+            uint32_t tc = newRegister();
+            uint32_t mt = newRegister(), me = newRegister();
+            emit(Kernel::truthy, tc, c);
+            emit(Kernel::maskAnd, mt, mask, tc);
+            emit(Kernel::maskAndNot, me, mask, tc);
+            uint32_t x = lower(t, mt);
+            if (x == fail) return fail;
+            uint32_t y;
+            if (e != nullptr) {
+              y = lower(e, me);
+              if (y == fail) return fail;
+            } else {
+              y = newRegister();
+              emit(Kernel::constant, y);
+            }
+            uint32_t r = newRegister();
+            emit(Kernel::select, r, tc, x, y);
+            return r;
+          }
+          case Operator::plus:
+          case Operator::minus:
+          case Operator::times:
+          case Operator::divide:
+          case Operator::modulo:
+          case Operator::equal:
+          case Operator::notEqual:
+          case Operator::less:
+          case Operator::greater:
+          case Operator::lessEqual:
+          case Operator::greaterEqual:
+          case Operator::xorStmt: {
+            uint32_t x = lower(b->lhs(), mask);
+            if (x == fail) return fail;
+            uint32_t y = lower(b->rhs(), mask);
+            if (y == fail) return fail;
+            uint32_t r = newRegister();
+            emit(Kernel::binary, r, x, y, mask, o);
+            return r;
+          }
+          default: return fail;
+        }
+      }
+      case 3: {
+        const UnaryOp* u = static_cast<const UnaryOp*>(ex);
+        if (u->o != Operator::minus && u->o != Operator::notStmt)
+          return fail;
+        uint32_t x = lower(u->a.get(), mask);
+        if (x == fail) return fail;
+        uint32_t r = newRegister();
+        if (u->o == Operator::minus)
+          emit(Kernel::neg, r, x, 0, mask);
+        else
+          emit(Kernel::logicalNot, r, x);
+        return r;
+      }
+      case 4: {
+        const Bracket* b = static_cast<const Bracket*>(ex);
+        if (b->ex == nullptr || b->bracket != Operator::leftBracket)
+          return fail;
+        if (b->ex->id() == 2 &&
+            static_cast<const BinaryOp*>(b->ex.get())->o == Operator::comma)
+          return fail;
+        return lower(b->ex.get(), mask);
+      }
+      case 6:
+        return load(static_cast<const Variable*>(ex)->slot, mask);
+    }
+    return fail;
+  }
+  bool Batch::lowerStatement(const Statement& st, uint32_t mask) {
+    const Expression* ex = st.ex.get();
+    if (ex == nullptr) return true;
+    if (st.statementOp == Operator::print) {
+      uint32_t v = lower(ex, mask);
+      if (v == UINT32_MAX) return error(RuntimeErrorCode::notBatchable);
+      if (v < 2 + 2 * slotNames.size()) {
+        // Variables change later on; keep the value as it is now.
+        uint32_t copy = newRegister();
+        emit(Kernel::copy, copy, v);
+        v = copy;
+      }
+      prints.push_back({v, mask});
+      return true;
+    }
+    if (ex->id() == 2 &&
+        isAssignment(static_cast<const BinaryOp*>(ex)->o)) {
+      const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+      Operator op = assignedOperator(b->o);
+      if (b->lhs()->id() != 6 || op == Operator::concat)
+        return error(RuntimeErrorCode::notBatchable);
+      size_t slot = static_cast<const Variable*>(b->lhs())->slot;
+      uint32_t v = lower(b->rhs(), mask);
+      if (v == UINT32_MAX) return error(RuntimeErrorCode::notBatchable);
+      if (op != Operator::assign) {
+        uint32_t old = load(slot, mask);
+        uint32_t r = newRegister();
+        emit(Kernel::binary, r, old, v, mask, op);
+        v = r;
+      }
+      store(slot, v, mask);
+      return true;
+    }
+    if (lower(ex, mask) == UINT32_MAX)
+      return error(RuntimeErrorCode::notBatchable);
+    return true;
+  }
+  // Lower statements from pc until the end of the program or a
+  // statement that continues or closes the enclosing block,
+  // leaving pc at that statement.
+  bool Batch::lowerRange(size_t& pc, uint32_t mask) {
+    while (pc < statements.size()) {
+      current = pc;
+      const Statement& st = statements[pc];
+      switch (st.statementOp) {
+        case Operator::ifThenStmt:
+        case Operator::elseStmt:
+        case Operator::endStmt:
+          return true;
+        case Operator::ifStmt:
+          if (!lowerIf(pc, mask)) return false;
+          break;
+        case Operator::whileStmt:
+        case Operator::repeatStmt:
+        case Operator::forStmt:
+          return error(RuntimeErrorCode::notBatchable);
+        default:
+          if (!lowerStatement(st, mask)) return false;
+          ++pc;
+      }
+    }
+    return true;
+  }
+  // Each clause runs on the rows that none of the earlier ones took.
+  bool Batch::lowerIf(size_t& pc, uint32_t mask) {
+    size_t start = pc;
+    uint32_t remaining = mask;
+    bool sawElse = false;
+    while (true) {
+      current = pc;
+      const Statement& st = statements[pc];
+      uint32_t body = remaining;
+      if (st.statementOp == Operator::elseStmt) {
+        sawElse = true;
+      } else {
+        uint32_t c = lower(st.ex.get(), remaining);
+        if (c == UINT32_MAX) return error(RuntimeErrorCode::notBatchable);
+        uint32_t tc = newRegister();
+        emit(Kernel::truthy, tc, c);
+        body = newRegister();
+        emit(Kernel::maskAnd, body, remaining, tc);
+        uint32_t rest = newRegister();
+        emit(Kernel::maskAndNot, rest, remaining, tc);
+        remaining = rest;
+      }
+      ++pc;
+      if (!lowerRange(pc, body)) return false;
+      if (pc == statements.size()) {
+        current = start;
+        return error(RuntimeErrorCode::unterminatedBlock);
+      }
+      current = pc;
+      if (statements[pc].statementOp == Operator::endStmt) break;
+      if (sawElse) return error(RuntimeErrorCode::misplacedBranch);
+    }
+    ++pc;
+    return true;
+  }
+  bool Batch::compile(std::vector<RuntimeError>& log) {
+    errorLog = &log;
+    size_t pc = 0;
+    if (!lowerRange(pc, allRows)) return false;
+    if (pc < statements.size()) {
+      current = pc;
+      return error(
+        statements[pc].statementOp == Operator::endStmt ?
+          RuntimeErrorCode::unmatchedEnd :
+          RuntimeErrorCode::misplacedBranch);
+    }
+    regs.assign((size_t) registers * blockSize, 0);
+    return true;
+  }
+  // The kernels. Each is a branch-free loop over the block, so the
+  // compiler can turn it into SIMD code; a row that would trap instead
+  // gets a harmless operand and is marked for rerunning.
+  void Batch::execute(size_t n) {
+    int64_t* __restrict bad = reg(rerun);
+    for (const Op& op : ops) {
+      int64_t* __restrict r = reg(op.dst);
+      const int64_t* __restrict x = reg(op.a);
+      const int64_t* __restrict y = reg(op.b);
+      const int64_t* __restrict m = reg(op.c);
+      switch (op.kernel) {
+        case Kernel::constant:
+          for (size_t i = 0; i < n; ++i) r[i] = op.imm;
+          break;
+        case Kernel::copy:
+          memcpy(r, x, n * sizeof(int64_t));
+          break;
+        case Kernel::neg:
+          for (size_t i = 0; i < n; ++i) {
+            r[i] = (int64_t) (0 - (uint64_t) x[i]);
+            bad[i] |= m[i] & (x[i] == INT64_MIN);
+          }
+          break;
+        case Kernel::logicalNot:
+          for (size_t i = 0; i < n; ++i) r[i] = x[i] == 0;
+          break;
+        case Kernel::truthy:
+          for (size_t i = 0; i < n; ++i) r[i] = x[i] != 0;
+          break;
+        case Kernel::select:
+          for (size_t i = 0; i < n; ++i) r[i] = x[i] ? y[i] : m[i];
+          break;
+        case Kernel::maskAnd:
+          for (size_t i = 0; i < n; ++i) r[i] = x[i] & y[i];
+          break;
+        case Kernel::maskAndNot:
+          for (size_t i = 0; i < n; ++i) r[i] = x[i] & (y[i] == 0);
+          break;
+        case Kernel::maskOr:
+          for (size_t i = 0; i < n; ++i) r[i] = x[i] | y[i];
+          break;
+        case Kernel::blend:
+          for (size_t i = 0; i < n; ++i) r[i] = y[i] ? x[i] : r[i];
+          break;
+        case Kernel::checkDefined:
+          for (size_t i = 0; i < n; ++i) bad[i] |= y[i] & (x[i] == 0);
+          break;
+        case Kernel::binary:
+          switch (op.o) {
+            // Overflow iff the operands' signs make it possible and the
+            // result's sign is wrong.
+            case Operator::plus:
+              for (size_t i = 0; i < n; ++i) {
+                uint64_t a = x[i], b = y[i], s = a + b;
+                r[i] = (int64_t) s;
+                bad[i] |= m[i] & (int64_t) (((a ^ s) & (b ^ s)) >> 63);
+              }
+              break;
+            case Operator::minus:
+              for (size_t i = 0; i < n; ++i) {
+                uint64_t a = x[i], b = y[i], s = a - b;
+                r[i] = (int64_t) s;
+                bad[i] |= m[i] & (int64_t) (((a ^ b) & (a ^ s)) >> 63);
+              }
+              break;
+            case Operator::times:
+              for (size_t i = 0; i < n; ++i) {
+                int64_t p;
+                bad[i] |= m[i] & __builtin_mul_overflow(x[i], y[i], &p);
+                r[i] = p;
+              }
+              break;
+            case Operator::divide:
+            case Operator::modulo:
+              for (size_t i = 0; i < n; ++i) {
+                int64_t d = y[i];
+                int64_t z = (d == 0) | ((x[i] == INT64_MIN) & (d == -1));
+                bad[i] |= m[i] & z;
+                d = z ? 1 : d;
+                r[i] = op.o == Operator::divide ? x[i] / d : x[i] % d;
+              }
+              break;
+            case Operator::equal:
+              for (size_t i = 0; i < n; ++i) r[i] = x[i] == y[i];
+              break;
+            case Operator::notEqual:
+              for (size_t i = 0; i < n; ++i) r[i] = x[i] != y[i];
+              break;
+            case Operator::less:
+              for (size_t i = 0; i < n; ++i) r[i] = x[i] < y[i];
+              break;
+            case Operator::greater:
+              for (size_t i = 0; i < n; ++i) r[i] = x[i] > y[i];
+              break;
+            case Operator::lessEqual:
+              for (size_t i = 0; i < n; ++i) r[i] = x[i] <= y[i];
+              break;
+            case Operator::greaterEqual:
+              for (size_t i = 0; i < n; ++i) r[i] = x[i] >= y[i];
+              break;
+            case Operator::xorStmt:
+              for (size_t i = 0; i < n; ++i) r[i] = (x[i] != 0) != (y[i] != 0);
+              break;
+            default: break;
+          }
+          break;
+      }
+    }
+  }
+  static std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+      s.remove_prefix(1);
+    while (!s.empty() &&
+        (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+      s.remove_suffix(1);
+    return s;
+  }
+  static void splitRow(
+      std::string_view line, std::vector<std::string_view>& cells) {
+    cells.clear();
+    while (true) {
+      size_t comma = line.find(',');
+      cells.push_back(trim(line.substr(0, comma)));
+      if (comma == std::string_view::npos) break;
+      line.remove_prefix(comma + 1);
+    }
+  }
+  static bool parseInt(std::string_view s, int64_t& n) {
+    if (!s.empty() && s.front() == '+') return false;
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), n);
+    return ec == std::errc() && end == s.data() + s.size();
+  }
+  // Decimal digits, perhaps after a -, of any length
+  static bool parseBigInt(std::string_view s, BigInt& n) {
+    bool negative = !s.empty() && s.front() == '-';
+    if (negative) s.remove_prefix(1);
+    if (s.empty()) return false;
+    for (char c : s) {
+      if (c < '0' || c > '9') return false;
+      n.mulAdd(10, c - '0');
+    }
+    if (negative) n = -n;
+    return true;
+  }
+  bool Batch::runRow(
+      const std::string& line, size_t lineNumber,
+      const std::vector<size_t>& columnOf,
+      std::ostream& out, std::istream& source) {
+    std::vector<std::string_view> cells;
+    splitRow(line, cells);
+    Interpreter in(statements, slotNames.size(), out, false);
+    for (size_t i = 0; i < inputSlots.size(); ++i) {
+      if (columnOf[i] >= cells.size()) {
+        out << "Row error at input line " << lineNumber << ": no column "
+          << slotNames[inputSlots[i]] << "\n";
+        return false;
+      }
+      std::string_view cell = cells[columnOf[i]];
+      int64_t n;
+      BigInt big;
+      if (parseInt(cell, n))
+        in.bind(inputSlots[i], Value(n));
+      else if (parseBigInt(cell, big))
+        in.bind(inputSlots[i], Value(std::move(big)));
+      else
+        in.bind(inputSlots[i], Value(String(std::string(cell))));
+    }
+    if (!in.run()) {
+      out.flush();
+      for (const RuntimeError& re : in.errorLog) re.print(source);
+      return false;
+    }
+    return true;
+  }
+  void Batch::runBlock(
+      const std::vector<std::string>& lines,
+      const std::vector<size_t>& lineNumbers,
+      const std::vector<size_t>& columnOf,
+      std::ostream& out, std::istream& source) {
+    size_t n = lines.size();
+    for (size_t i = 0; i < n; ++i) reg(allRows)[i] = 1;
+    memset(reg(rerun), 0, n * sizeof(int64_t));
+    for (size_t s = 0; s < slotNames.size(); ++s) {
+      memset(reg(valueOf[s]), 0, n * sizeof(int64_t));
+      memset(reg(definedOf[s]), 0, n * sizeof(int64_t));
+    }
+    std::vector<std::string_view> cells;
+    for (size_t row = 0; row < n; ++row) {
+      splitRow(lines[row], cells);
+      for (size_t i = 0; i < inputSlots.size(); ++i) {
+        int64_t& v = reg(valueOf[inputSlots[i]])[row];
+        if (columnOf[i] >= cells.size() || !parseInt(cells[columnOf[i]], v))
+          reg(rerun)[row] = 1;
+      }
+    }
+    execute(n);
+    std::string text;
+    char buf[24];
+    for (size_t row = 0; row < n; ++row) {
+      if (reg(rerun)[row]) {
+        out << text;
+        text.clear();
+        if (!runRow(lines[row], lineNumbers[row], columnOf, out, source))
+          ++failedRows;
+        continue;
+      }
+      for (const Print& p : prints) {
+        if (!reg(p.mask)[row]) continue;
+        int64_t v = reg(p.value)[row];
+        text.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr);
+        text += '\n';
+      }
+    }
+    out << text;
+  }
+  bool Batch::run(std::istream& rows, std::ostream& out, std::istream& source) {
+    std::string header;
+    std::getline(rows, header);
+    std::vector<std::string_view> names;
+    splitRow(header, names);
+    std::vector<size_t> columnOf;
+    for (size_t slot : inputSlots) {
+      size_t c = 0;
+      while (c < names.size() && names[c] != slotNames[slot]) ++c;
+      if (c == names.size()) {
+        std::cerr << "No input column named " << slotNames[slot] << "\n";
+        return false;
+      }
+      columnOf.push_back(c);
+    }
+    std::vector<std::string> lines;
+    std::vector<size_t> lineNumbers;
+    std::string line;
+    size_t lineNumber = 1; // The header's
+    failedRows = 0;
+    while (std::getline(rows, line)) {
+      ++lineNumber;
+      if (trim(line).empty()) continue;
+      lines.push_back(std::move(line));
+      lineNumbers.push_back(lineNumber);
+      if (lines.size() == blockSize) {
+        runBlock(lines, lineNumbers, columnOf, out, source);
+        lines.clear();
+        lineNumbers.clear();
+      }
+    }
+    if (!lines.empty()) runBlock(lines, lineNumbers, columnOf, out, source);
+    return failedRows == 0;
+  }
+}
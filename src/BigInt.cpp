@@ -0,0 +1,171 @@
+#include "BigInt.h"
+
+#include <algorithm>
+
+namespace x666 {
+  BigInt::BigInt(int64_t n) : negative(n < 0) {
+    // Negate in unsigned arithmetic so that INT64_MIN works.
+    uint64_t m = negative ? -(uint64_t) n : (uint64_t) n;
+    while (m != 0) {
+      limbs.push_back((uint32_t) m);
+      m >>= 32;
+    }
+  }
+  bool BigInt::toInt64(int64_t& n) const {
+    if (limbs.size() > 2) return false;
+    uint64_t m = 0;
+    for (size_t i = limbs.size(); i-- > 0;) m = (m << 32) | limbs[i];
+    if (negative) {
+      if (m > (uint64_t) INT64_MAX + 1) return false;
+      n = (int64_t) -m;
+    } else {
+      if (m > (uint64_t) INT64_MAX) return false;
+      n = (int64_t) m;
+    }
+    return true;
+  }
+  void BigInt::mulAdd(uint32_t m, uint32_t a) {
+    uint64_t carry = a;
+    for (uint32_t& l : limbs) {
+      uint64_t t = (uint64_t) l * m + carry;
+      l = (uint32_t) t;
+      carry = t >> 32;
+    }
+    if (carry != 0) limbs.push_back((uint32_t) carry);
+    trim();
+  }
+  void BigInt::trim() {
+    while (!limbs.empty() && limbs.back() == 0) limbs.pop_back();
+    if (limbs.empty()) negative = false;
+  }
+  int BigInt::compareMagnitude(
+      const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0;) {
+      if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+  }
+  std::vector<uint32_t> BigInt::addMagnitude(
+      const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    const std::vector<uint32_t>& lo = a.size() < b.size() ? a : b;
+    const std::vector<uint32_t>& hi = a.size() < b.size() ? b : a;
+    std::vector<uint32_t> r;
+    r.reserve(hi.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < hi.size(); ++i) {
+      uint64_t t = (uint64_t) hi[i] + (i < lo.size() ? lo[i] : 0) + carry;
+      r.push_back((uint32_t) t);
+      carry = t >> 32;
+    }
+    if (carry != 0) r.push_back((uint32_t) carry);
+    return r;
+  }
+  std::vector<uint32_t> BigInt::subMagnitude(
+      const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    std::vector<uint32_t> r;
+    r.reserve(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+      int64_t t = (int64_t) a[i] - (i < b.size() ? b[i] : 0) - borrow;
+      borrow = t < 0;
+      r.push_back((uint32_t) (t + (borrow << 32)));
+    }
+    return r;
+  }
+  BigInt BigInt::operator-() const {
+    BigInt r = *this;
+    if (!r.isZero()) r.negative = !r.negative;
+    return r;
+  }
+  BigInt BigInt::operator+(const BigInt& b) const {
+    BigInt r;
+    if (negative == b.negative) {
+      r.limbs = addMagnitude(limbs, b.limbs);
+      r.negative = negative;
+    } else if (compareMagnitude(limbs, b.limbs) >= 0) {
+      r.limbs = subMagnitude(limbs, b.limbs);
+      r.negative = negative;
+    } else {
+      r.limbs = subMagnitude(b.limbs, limbs);
+      r.negative = b.negative;
+    }
+    r.trim();
+    return r;
+  }
+  BigInt BigInt::operator-(const BigInt& b) const {
+    return *this + -b;
+  }
+  BigInt BigInt::operator*(const BigInt& b) const {
+    BigInt r;
+    if (isZero() || b.isZero()) return r;
+    r.limbs.assign(limbs.size() + b.limbs.size(), 0);
+    for (size_t i = 0; i < limbs.size(); ++i) {
+      uint64_t carry = 0;
+      for (size_t j = 0; j < b.limbs.size(); ++j) {
+        uint64_t t = (uint64_t) limbs[i] * b.limbs[j] +
+          r.limbs[i + j] + carry;
+        r.limbs[i + j] = (uint32_t) t;
+        carry = t >> 32;
+      }
+      r.limbs[i + b.limbs.size()] = (uint32_t) carry;
+    }
+    r.negative = negative != b.negative;
+    r.trim();
+    return r;
+  }
+  uint32_t BigInt::divSmall(uint32_t d) {
+    uint64_t rem = 0;
+    for (size_t i = limbs.size(); i-- > 0;) {
+      uint64_t t = (rem << 32) | limbs[i];
+      limbs[i] = (uint32_t) (t / d);
+      rem = t % d;
+    }
+    trim();
+    return (uint32_t) rem;
+  }
+  void BigInt::divMod(const BigInt& b, BigInt& q, BigInt& r) const {
+    // Schoolbook binary long division on the magnitudes.
+    q = BigInt();
+    r = BigInt();
+    if (compareMagnitude(limbs, b.limbs) < 0) {
+      r = *this;
+      return;
+    }
+    q.limbs.assign(limbs.size(), 0);
+    for (size_t i = limbs.size() * 32; i-- > 0;) {
+      // r = r * 2 + bit i
+      r.mulAdd(2, (limbs[i / 32] >> (i % 32)) & 1);
+      if (compareMagnitude(r.limbs, b.limbs) >= 0) {
+        r.limbs = subMagnitude(r.limbs, b.limbs);
+        r.trim();
+        q.limbs[i / 32] |= (uint32_t) 1 << (i % 32);
+      }
+    }
+    q.negative = negative != b.negative;
+    q.trim();
+    r.negative = negative;
+    r.trim();
+  }
+  int BigInt::compare(const BigInt& b) const {
+    if (negative != b.negative) return negative ? -1 : 1;
+    int c = compareMagnitude(limbs, b.limbs);
+    return negative ? -c : c;
+  }
+  std::string BigInt::toString() const {
+    if (isZero()) return "0";
+    BigInt t = *this;
+    std::string s;
+    while (!t.isZero()) {
+      uint32_t chunk = t.divSmall(1000000000);
+      for (int i = 0; i < 9; ++i) {
+        s += (char) ('0' + chunk % 10);
+        chunk /= 10;
+        if (t.isZero() && chunk == 0) break;
+      }
+    }
+    if (negative) s += '-';
+    std::reverse(s.begin(), s.end());
+    return s;
+  }
+}
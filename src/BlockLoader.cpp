@@ -0,0 +1,58 @@
+#include "BlockLoader.h"
+
+#include <istream>
+#include <iterator>
+#include <streambuf>
+
+namespace x666 {
+  // Reads a range of a string in place.
+  class RangeBuffer : public std::streambuf {
+  public:
+    RangeBuffer(const char* begin, const char* end) {
+      char* b = const_cast<char*>(begin);
+      setg(b, b, b + (end - begin));
+    }
+  };
+  bool BlockLoader::load() {
+    RangeBuffer buffer(source.data(), source.data() + source.size());
+    std::istream fh(&buffer);
+    Parser p(&fh);
+    p.lazy = true;
+    p.includes = &includes;
+    p.parse();
+    errorLog = std::move(p.errorLog);
+    if (!errorLog.empty()) return false;
+    statements = std::move(p.statements);
+    ends = std::move(p.blockEnds);
+    blocksSkipped = ends.size();
+    // Reads of variables assigned only inside a body are fine.
+    resolver.assumeAssigned(p.skippedStores);
+    return resolver.resolve(errorLog);
+  }
+  bool BlockLoader::expand(size_t at, size_t& count) {
+    const LineInfo start = statements[at].li;
+    auto it = ends.find(start.byte);
+    RangeBuffer buffer(
+      source.data() + start.byte, source.data() + it->second);
+    std::istream fh(&buffer);
+    Parser p(&fh);
+    p.lazy = true;
+    p.includes = &includes;
+    p.li = start;
+    p.parse();
+    if (!p.errorLog.empty() || !resolver.resolve(p.statements, p.errorLog)) {
+      errorLog.insert(errorLog.end(), p.errorLog.begin(), p.errorLog.end());
+      return false;
+    }
+    ends.erase(it);
+    ends.insert(p.blockEnds.begin(), p.blockEnds.end());
+    ++blocksParsed;
+    count = p.statements.size();
+    statements.erase(statements.begin() + at);
+    statements.insert(
+      statements.begin() + at,
+      std::make_move_iterator(p.statements.begin()),
+      std::make_move_iterator(p.statements.end()));
+    return true;
+  }
+}
@@ -0,0 +1,426 @@
+#include "CBackend.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "IR.h"
+
+namespace x666 {
+  // A C string literal with the same bytes as s.
+  static std::string cString(const std::string& s) {
+    std::string res = "\"";
+    for (unsigned char c : s) {
+      if (c == '"' || c == '\\' || c == '?') {
+        res += '\\';
+        res += c;
+      } else if (c >= 0x20 && c < 0x7F) {
+        res += c;
+      } else {
+        // Always three digits, so a following digit isn't swallowed.
+        char buf[5];
+        snprintf(buf, sizeof(buf), "\\%03o", c);
+        res += buf;
+      }
+    }
+    return res + "\"";
+  }
+  // The runtime function implementing a binary or unary operator
+  static const char* runtimeFunction(Operator o, bool unary) {
+    if (unary) {
+      switch (o) {
+        case Operator::notStmt: return "x6_not";
+        case Operator::minus: return "x6_neg";
+        case Operator::length: return "x6_length";
+        default: return nullptr;
+      }
+    }
+    switch (o) {
+      case Operator::plus: return "x6_add";
+      case Operator::minus: return "x6_sub";
+      case Operator::times: return "x6_mul";
+      case Operator::divide: return "x6_div";
+      case Operator::modulo: return "x6_mod";
+      case Operator::concat: return "x6_concat";
+      case Operator::equal: return "x6_eq";
+      case Operator::notEqual: return "x6_ne";
+      case Operator::less: return "x6_lt";
+      case Operator::greater: return "x6_gt";
+      case Operator::lessEqual: return "x6_le";
+      case Operator::greaterEqual: return "x6_ge";
+      case Operator::xorStmt: return "x6_xor";
+      default: return nullptr;
+    }
+  }
+  using ir::Block;
+  using ir::Instr;
+  using ir::Opcode;
+  using ValueSet = std::unordered_set<const Instr*>;
+  /**
+   * Writes C for an optimized ir::Function. Each value gets a C
+   * variable, each block a label, and phis are assigned on the edges
+   * into their block. Values are reference counted, so a liveness
+   * analysis finds each value's last use, which takes over its
+   * reference (a string appended to in a loop is then held only once
+   * and grows in place); other uses get x6_dup of it, and values that
+   * die without a last use are dropped.
+   */
+  class CEmitter {
+  public:
+    CEmitter(const ir::Function& f, const std::string& sourceName) :
+      f(f), sourceName(cString(sourceName)) {}
+    void emit(std::ostream& out);
+  private:
+    void order();
+    void liveness();
+    std::ostream& line() { return body << std::string(2 * depth, ' '); }
+    std::string name(const Instr* in);
+    std::string use(const Instr* in, bool last);
+    void at(const Instr& in);
+    std::string expression(const Instr& in, const std::vector<char>& last);
+    void instr(const Instr& in, const std::vector<char>& last, bool used);
+    void drop(std::vector<const Instr*> values);
+    void edge(const Block* from, const Block* to);
+    void goTo(const Block* to, const Block* next);
+    void block(const Block* b, const Block* next);
+    const ir::Function& f;
+    std::string sourceName;
+    std::ostringstream body;
+    std::vector<std::string> strings;
+    std::vector<std::string> bigs; // Big integer literals, in decimal
+    // Reachable blocks, in reverse postorder
+    std::vector<const Block*> blocks;
+    std::unordered_map<const Block*, size_t> blockIds;
+    std::unordered_map<const Instr*, size_t> ids;
+    // Values that have a C variable
+    std::vector<const Instr*> declared;
+    std::unordered_map<const Block*, ValueSet> liveIn, liveOut;
+    std::unordered_set<const Block*> labelled;
+    size_t depth = 1;
+    uint32_t lastLine = UINT32_MAX;
+    const LineInfo* lastAt = nullptr; // In the current block
+  };
+  void CEmitter::order() {
+    std::unordered_set<const Block*> seen;
+    std::vector<std::pair<const Block*, size_t>> stack;
+    const Block* entry = f.blocks[0].get();
+    stack.push_back({entry, 0});
+    seen.insert(entry);
+    while (!stack.empty()) {
+      auto& [b, i] = stack.back();
+      if (i < b->succs.size()) {
+        const Block* s = b->succs[i++];
+        if (seen.insert(s).second) stack.push_back({s, 0});
+      } else {
+        blocks.push_back(b);
+        stack.pop_back();
+      }
+    }
+    std::reverse(blocks.begin(), blocks.end());
+    for (const Block* b : blocks) {
+      blockIds[b] = blockIds.size();
+      for (const ir::InstrPtr& in : b->phis) ids[in.get()] = ids.size();
+      for (const ir::InstrPtr& in : b->instrs) ids[in.get()] = ids.size();
+    }
+  }
+  // The index of from among the predecessors of to, which is the
+  // argument its phis take from it
+  static size_t predIndex(const Block* from, const Block* to) {
+    return std::find(to->preds.begin(), to->preds.end(), from) -
+      to->preds.begin();
+  }
+  // liveIn holds the values live at the start of a block other than
+  // its own phis; liveOut also holds the arguments of the successors'
+  // phis.
+  void CEmitter::liveness() {
+    std::unordered_map<const Block*, ValueSet> upward, defs;
+    for (const Block* b : blocks) {
+      ValueSet& u = upward[b];
+      if (b->cond != nullptr) u.insert(b->cond);
+      for (auto it = b->instrs.rbegin(); it != b->instrs.rend(); ++it) {
+        u.erase(it->get());
+        defs[b].insert(it->get());
+        for (const Instr* arg : (*it)->args) u.insert(arg);
+      }
+      for (const ir::InstrPtr& phi : b->phis) {
+        u.erase(phi.get());
+        defs[b].insert(phi.get());
+      }
+      liveIn[b] = u;
+    }
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+        const Block* b = *it;
+        ValueSet& out = liveOut[b];
+        for (const Block* s : b->succs) {
+          out.insert(liveIn[s].begin(), liveIn[s].end());
+          size_t k = predIndex(b, s);
+          for (const ir::InstrPtr& phi : s->phis) out.insert(phi->args[k]);
+        }
+        ValueSet& in = liveIn[b];
+        for (const Instr* v : out) {
+          if (defs[b].count(v) == 0 && in.insert(v).second) changed = true;
+        }
+      }
+    }
+  }
+  std::string CEmitter::name(const Instr* in) {
+    return "t" + std::to_string(ids.at(in));
+  }
+  std::string CEmitter::use(const Instr* in, bool last) {
+    return last ? name(in) : "x6_dup(" + name(in) + ")";
+  }
+  // Point #line and X6_AT at in's statement.
+  void CEmitter::at(const Instr& in) {
+    const LineInfo& li = in.li;
+    if (li.line != lastLine) {
+      body << "#line " << (li.line + 1) << " " << sourceName << "\n";
+      lastLine = li.line;
+    }
+    // x6_defined reports the variable's own position.
+    if (!in.mayTrap() || in.opcode == Opcode::check) return;
+    if (lastAt != nullptr && lastAt->line == li.line &&
+        lastAt->col == li.col)
+      return;
+    line() << "X6_AT(" << (li.line + 1) << ", " << (li.col + 1) << ");\n";
+    lastAt = &li;
+  }
+  // The C for the value of in, or an empty string if it only fails
+  std::string CEmitter::expression(
+      const Instr& in, const std::vector<char>& last) {
+    std::vector<std::string> a;
+    for (size_t i = 0; i < in.args.size(); ++i)
+      a.push_back(use(in.args[i], last[i]));
+    switch (in.opcode) {
+      case Opcode::constant: {
+        const Value& c = in.constant;
+        if (c.isString()) {
+          strings.push_back(std::get<String>(c.v).flat());
+          return "x6_lit(&s" + std::to_string(strings.size() - 1) + ")";
+        }
+        if (c.isBigInt()) {
+          bigs.push_back(std::get<BigIntPtr>(c.v)->toString());
+          return "x6_dup(b" + std::to_string(bigs.size() - 1) + ")";
+        }
+        int64_t n = std::get<int64_t>(c.v);
+        return n == INT64_MIN ?
+          "x6_int(INT64_MIN)" : "x6_int(" + std::to_string(n) + ")";
+      }
+      case Opcode::copy: return a[0];
+      case Opcode::check:
+        return "x6_defined(" + a[0] + ", " + std::to_string(in.li.line + 1) +
+          ", " + std::to_string(in.li.col + 1) + ")";
+      case Opcode::checkInt: return "x6_int(x6_get_int(" + a[0] + "))";
+      case Opcode::binary:
+      case Opcode::unary: {
+        const char* fn =
+          runtimeFunction(in.op, in.opcode == Opcode::unary);
+        if (fn == nullptr) return "";
+        std::string e = std::string(fn) + "(" + a[0];
+        if (in.opcode == Opcode::binary) e += ", " + a[1];
+        return e + ")";
+      }
+      case Opcode::truthy: return "x6_int(x6_test(" + a[0] + "))";
+      case Opcode::index: return "x6_index(" + a[0] + ", " + a[1] + ")";
+      case Opcode::makeList: {
+        if (a.empty()) return "x6_make_list(0, NULL)";
+        std::string e = "x6_make_list(" + std::to_string(a.size()) +
+          ", (x6_val[]) {";
+        for (size_t i = 0; i < a.size(); ++i)
+          e += (i == 0 ? "" : ", ") + a[i];
+        return e + "})";
+      }
+      case Opcode::forCheck:
+        return "x6_int(x6_for_enter(x6_get_int(" + a[0] + "), x6_get_int(" +
+          a[1] + "), x6_get_int(" + a[2] + ")))";
+      case Opcode::forStep:
+        return "x6_for_step(" + a[0] + ", x6_get_int(" + a[1] + "))";
+      default: return "";
+    }
+  }
+  // Emit in, whose value is used later if used is set. last says which
+  // of its arguments it takes over.
+  void CEmitter::instr(
+      const Instr& in, const std::vector<char>& last, bool used) {
+    switch (in.opcode) {
+      case Opcode::undef: break; // Its variable is never assigned
+      case Opcode::print:
+        at(in);
+        line() << "x6_print(" << use(in.args[0], last[0]) << ");\n";
+        return;
+      case Opcode::fail:
+        at(in);
+        line() << "x6_fail(" << (int) in.error << ");\n";
+        break;
+      default: {
+        at(in);
+        std::string e = expression(in, last);
+        if (e.empty()) {
+          line() << "x6_fail(" << (int) RuntimeErrorCode::typeMismatch
+            << ");\n";
+        } else if (used) {
+          line() << name(&in) << " = " << e << ";\n";
+        } else {
+          line() << "x6_drop(" << e << ");\n";
+        }
+      }
+    }
+    if (used) declared.push_back(&in);
+  }
+  void CEmitter::drop(std::vector<const Instr*> values) {
+    std::sort(values.begin(), values.end(),
+      [&](const Instr* a, const Instr* b) { return ids[a] < ids[b]; });
+    for (const Instr* v : values) line() << "x6_drop(" << name(v) << ");\n";
+  }
+  // Emit what happens on the way from one block to another: assign the
+  // phis of to, and drop the values that die on the way.
+  void CEmitter::edge(const Block* from, const Block* to) {
+    size_t k = predIndex(from, to);
+    const ValueSet& keep = liveIn[to];
+    // Each argument is read before any phi is assigned.
+    ValueSet taken;
+    std::vector<std::pair<const Instr*, std::string>> assign;
+    for (auto it = to->phis.rbegin(); it != to->phis.rend(); ++it) {
+      const Instr* phi = it->get();
+      const Instr* arg = phi->args[k];
+      bool last = keep.count(arg) == 0 && taken.insert(arg).second;
+      if (arg == phi && last) continue;
+      assign.push_back({phi, use(arg, last)});
+    }
+    std::vector<const Instr*> dead;
+    for (const Instr* v : liveOut[from]) {
+      if (keep.count(v) == 0 && taken.count(v) == 0) dead.push_back(v);
+    }
+    std::reverse(assign.begin(), assign.end());
+    // The phis can be assigned one by one unless one is an argument
+    // of another.
+    bool parallel = std::any_of(
+      to->phis.begin(), to->phis.end(), [&](const ir::InstrPtr& phi) {
+        const Instr* arg = phi->args[k];
+        return arg != phi.get() && arg->opcode == Opcode::phi &&
+          arg->block == to;
+      });
+    if (!parallel) {
+      drop(std::move(dead));
+      for (const auto& [phi, value] : assign)
+        line() << name(phi) << " = " << value << ";\n";
+      return;
+    }
+    line() << "{\n";
+    ++depth;
+    for (size_t i = 0; i < assign.size(); ++i) {
+      line() << "x6_val p" << i << " = " << assign[i].second << ";\n";
+    }
+    drop(std::move(dead));
+    for (size_t i = 0; i < assign.size(); ++i)
+      line() << name(assign[i].first) << " = p" << i << ";\n";
+    --depth;
+    line() << "}\n";
+  }
+  void CEmitter::goTo(const Block* to, const Block* next) {
+    if (to != next) line() << "goto bb" << blockIds[to] << ";\n";
+  }
+  void CEmitter::block(const Block* b, const Block* next) {
+    lastAt = nullptr;
+    if (labelled.count(b) != 0) body << "bb" << blockIds[b] << ":;\n";
+    // Which uses are last uses, found by walking the block backwards
+    ValueSet live = liveOut[b];
+    bool condLast = b->cond != nullptr && live.insert(b->cond).second;
+    std::vector<std::vector<char>> last(b->instrs.size());
+    std::vector<char> used(b->instrs.size());
+    for (size_t i = b->instrs.size(); i-- > 0;) {
+      const Instr* in = b->instrs[i].get();
+      used[i] = live.erase(in) != 0;
+      last[i].resize(in->args.size());
+      for (size_t j = in->args.size(); j-- > 0;)
+        last[i][j] = live.insert(in->args[j]).second;
+    }
+    std::vector<const Instr*> unused;
+    for (const ir::InstrPtr& phi : b->phis) {
+      declared.push_back(phi.get());
+      if (live.count(phi.get()) == 0) unused.push_back(phi.get());
+    }
+    drop(std::move(unused));
+    for (size_t i = 0; i < b->instrs.size(); ++i)
+      instr(*b->instrs[i], last[i], used[i]);
+    switch (b->term) {
+      case ir::Terminator::exit:
+        line() << "return 0;\n";
+        break;
+      case ir::Terminator::jump:
+        edge(b, b->succs[0]);
+        goTo(b->succs[0], next);
+        break;
+      case ir::Terminator::branch: {
+        // Fall through to the next block where possible.
+        bool invert = b->succs[0] == next;
+        const Block* taken = b->succs[invert ? 1 : 0];
+        const Block* other = b->succs[invert ? 0 : 1];
+        line() << "if (" << (invert ? "!" : "") << "x6_test("
+          << use(b->cond, condLast) << ")) {\n";
+        ++depth;
+        edge(b, taken);
+        goTo(taken, nullptr);
+        --depth;
+        line() << "}\n";
+        edge(b, other);
+        goTo(other, next);
+        break;
+      }
+    }
+  }
+  void CEmitter::emit(std::ostream& out) {
+    order();
+    liveness();
+    // The blocks that are jumped to rather than fallen into (see
+    // block())
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      const Block* next = i + 1 < blocks.size() ? blocks[i + 1] : nullptr;
+      const std::vector<Block*>& succs = blocks[i]->succs;
+      if (succs.size() == 2 && succs[0] != next) labelled.insert(succs[0]);
+      for (const Block* s : succs) {
+        if (s != next) labelled.insert(s);
+      }
+    }
+    for (size_t i = 0; i < blocks.size(); ++i)
+      block(blocks[i], i + 1 < blocks.size() ? blocks[i + 1] : nullptr);
+    out << "/* Generated by x666 --emit-c from " << sourceName << " */\n";
+    out << "#include \"x666rt.h\"\n\n";
+    for (size_t i = 0; i < strings.size(); ++i) {
+      out << "static x6_str s" << i << " = X6_STR_LIT("
+        << cString(strings[i]) << ");\n";
+    }
+    for (size_t i = 0; i < bigs.size(); ++i)
+      out << "static x6_val b" << i << ";\n";
+    out << "\nint main(void) {\n";
+    std::sort(declared.begin(), declared.end(),
+      [&](const Instr* a, const Instr* b) { return ids[a] < ids[b]; });
+    for (const Instr* v : declared) {
+      out << "  x6_val " << name(v) << " = X6_UNDEF_VAL;";
+      if (v->slot < f.slotNames.size())
+        out << " /* " << f.slotNames[v->slot] << " */";
+      out << "\n";
+    }
+    for (size_t i = 0; i < bigs.size(); ++i)
+      out << "  b" << i << " = x6_big_lit(" << cString(bigs[i]) << ");\n";
+    out << body.str();
+    out << "}\n";
+  }
+  bool emitC(
+      const std::vector<Statement>& statements,
+      const std::vector<std::string>& slotNames,
+      const std::string& sourceName, std::ostream& out,
+      std::vector<RuntimeError>& errorLog) {
+    ir::Function f;
+    if (!ir::build(statements, slotNames, f, errorLog)) return false;
+    ir::optimize(f);
+    CEmitter(f, sourceName).emit(out);
+    return true;
+  }
+}
@@ -0,0 +1,115 @@
+#include "Farm.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace x666 {
+  Farm::Instance::Instance(std::shared_ptr<const Program> program) :
+    program(std::move(program)),
+    interpreter(this->program->statements, this->program->slotNames.size(),
+      out, false) {}
+  size_t Farm::add(std::shared_ptr<const Program> program) {
+    all.push_back(std::make_unique<Instance>(std::move(program)));
+    return all.size() - 1;
+  }
+  static uint64_t threadCpuNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+  void Farm::slice(Instance& in) {
+    uint64_t begin = threadCpuNanos();
+    if (in.slices++ == 0 && !in.interpreter.start()) {
+      in.status = Interpreter::Status::failed;
+    } else {
+      size_t budget = fuel;
+      if (limit != 0)
+        budget = std::min(budget, limit - in.interpreter.executed());
+      in.status = in.interpreter.resume(budget);
+      if (in.status == Interpreter::Status::suspended && limit != 0 &&
+          in.interpreter.executed() >= limit) {
+        in.interpreter.stop(RuntimeErrorCode::limitExceeded);
+        in.status = Interpreter::Status::failed;
+      }
+    }
+    in.cpuNanos += threadCpuNanos() - begin;
+  }
+  // Our own queue first, oldest instance first so that everything in it
+  // gets a turn; then the newest instance of someone else's.
+  Farm::Instance* Farm::take(size_t self) {
+    for (size_t i = 0; i < queues.size(); ++i) {
+      Queue& q = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(q.lock);
+      if (q.instances.empty()) continue;
+      Instance* in;
+      --queued;
+      if (i == 0) {
+        in = q.instances.front();
+        q.instances.pop_front();
+      } else {
+        in = q.instances.back();
+        q.instances.pop_back();
+      }
+      return in;
+    }
+    return nullptr;
+  }
+  // Wake a thread that is waiting for work, if there is one. A thread
+  // counts itself in waiting before it checks for work, under idleLock,
+  // so either it sees the work or this sees it.
+  void Farm::signal() {
+    if (waiting.load() == 0) return;
+    std::lock_guard<std::mutex> guard(idleLock);
+    wake.notify_one();
+  }
+  void Farm::work(size_t self) {
+    while (remaining.load() != 0) {
+      Instance* in = take(self);
+      if (in == nullptr) {
+        // Everything left is being run by other threads.
+        std::unique_lock<std::mutex> guard(idleLock);
+        ++waiting;
+        wake.wait(guard, [this] {
+          return queued.load() != 0 || remaining.load() == 0;
+        });
+        --waiting;
+        continue;
+      }
+      // Pass a wakeup on to another thread if there is more to take.
+      if (queued.load() != 0) signal();
+      slice(*in);
+      if (in->status == Interpreter::Status::suspended) {
+        {
+          Queue& q = *queues[self];
+          std::lock_guard<std::mutex> guard(q.lock);
+          q.instances.push_back(in);
+          ++queued;
+        }
+        signal();
+      } else if (--remaining == 0) {
+        std::lock_guard<std::mutex> guard(idleLock);
+        wake.notify_all();
+      }
+    }
+  }
+  void Farm::run() {
+    if (threads == 0) threads = 1;
+    queues.clear();
+    for (size_t i = 0; i < threads; ++i)
+      queues.push_back(std::make_unique<Queue>());
+    remaining = queued = waiting = 0;
+    for (size_t i = 0; i < all.size(); ++i) {
+      if (all[i]->status != Interpreter::Status::suspended) continue;
+      queues[i % threads]->instances.push_back(all[i].get());
+      ++remaining;
+      ++queued;
+    }
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; ++i)
+      pool.emplace_back(&Farm::work, this, i);
+    work(0);
+    for (std::thread& t : pool) t.join();
+  }
+}
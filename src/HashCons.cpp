@@ -0,0 +1,117 @@
+#include "HashCons.h"
+
+#include <functional>
+#include <ostream>
+
+namespace x666 {
+  static size_t heapBytes(const std::string& s) {
+    // Short strings live inside the std::string itself.
+    return s.capacity() > 15 ? s.capacity() + 1 : 0;
+  }
+  static std::string literalText(const Literal* l) {
+    std::string text(1, (char) ('0' + l->val.index()));
+    switch (l->val.index()) {
+      case 0: return text + std::get<0>(l->val).name;
+      case 1: return text + std::to_string(std::get<1>(l->val).n);
+      case 2: return text + std::get<2>(l->val).str;
+      default: return text + std::get<3>(l->val).n.toString();
+    }
+  }
+  static size_t literalBytes(const Literal* l) {
+    size_t bytes = sizeof(Literal);
+    if (l->val.index() == 0) bytes += heapBytes(std::get<0>(l->val).name);
+    if (l->val.index() == 2) bytes += heapBytes(std::get<2>(l->val).str);
+    return bytes;
+  }
+  size_t HashConser::KeyHash::operator()(const Key& k) const {
+    size_t h = std::hash<std::string>()(k.text);
+    h = h * 31 + k.id;
+    h = h * 31 + (size_t) k.op;
+    h = h * 31 + std::hash<const Expression*>()(k.a);
+    h = h * 31 + std::hash<const Expression*>()(k.b);
+    return h;
+  }
+  // Merge the subexpressions of ex, then ex itself. Returns false if
+  // it isn't pure.
+  bool HashConser::visit(ExpressionPtr& ex) {
+    if (ex == nullptr) return true;
+    Key k{ex->id(), -1, nullptr, nullptr, std::string()};
+    size_t bytes = 0;
+    bool pure = true;
+    switch (ex->id()) {
+      case 1: {
+        const Literal* l = static_cast<const Literal*>(ex.get());
+        k.text = literalText(l);
+        bytes = literalBytes(l);
+        break;
+      }
+      case 2: {
+        BinaryOp* b = static_cast<BinaryOp*>(ex.get());
+        bool pureA = visit(b->a), pureB = visit(b->b);
+        pure = pureA && pureB && !isAssignment(b->o);
+        k.op = (int) b->o;
+        k.a = b->a.get();
+        k.b = b->b.get();
+        bytes = sizeof(BinaryOp);
+        break;
+      }
+      case 3: {
+        UnaryOp* u = static_cast<UnaryOp*>(ex.get());
+        pure = visit(u->a);
+        k.op = (int) u->o;
+        k.a = u->a.get();
+        bytes = sizeof(UnaryOp);
+        break;
+      }
+      case 4: {
+        Bracket* b = static_cast<Bracket*>(ex.get());
+        pure = visit(b->ex);
+        k.op = (int) b->bracket;
+        k.a = b->ex.get();
+        bytes = sizeof(Bracket);
+        break;
+      }
+      case 5: {
+        Indexing* ix = static_cast<Indexing*>(ex.get());
+        bool pureA = visit(ix->a), pureB = visit(ix->b);
+        pure = pureA && pureB;
+        k.a = ix->a.get();
+        k.b = ix->b.get();
+        bytes = sizeof(Indexing);
+        break;
+      }
+      case 6: {
+        const Variable* v = static_cast<const Variable*>(ex.get());
+        k.text = std::to_string(v->slot) + v->name;
+        bytes = sizeof(Variable) + heapBytes(v->name);
+        break;
+      }
+    }
+    ++nodesBefore;
+    bytesBefore += bytes;
+    if (pure) {
+      auto it = nodes.emplace(std::move(k), ex.get());
+      if (!it.second) {
+        // Frees this copy; its children were already merged, so only
+        // this node goes.
+        ex = ExpressionPtr::share(it.first->second);
+        return true;
+      }
+    }
+    ++nodesAfter;
+    bytesAfter += bytes;
+    return pure;
+  }
+  void HashConser::run() {
+    for (Statement& st : statements) visit(st.ex);
+    nodes.clear();
+  }
+  void HashConser::report(std::ostream& out) const {
+    out << "Hash-consing: " << nodesBefore << " expression nodes, "
+      << nodesAfter << " after merging; about " << bytesBefore
+      << " bytes, " << bytesAfter << " after (";
+    if (bytesBefore == 0) out << "0";
+    else out << 100 * (bytesBefore - bytesAfter) / bytesBefore;
+    out << "% saved)\n";
+  }
+}
@@ -0,0 +1,615 @@
+#include "IR.h"
+
+#include <assert.h>
+
+#include <iostream>
+#include <map>
+
+namespace x666 {
+  namespace ir {
+    const char* opcodeNames[] = {
+      "const", "undef", "phi", "copy", "check", "int", "", "", "truthy",
+      "index", "list", "forcheck", "forstep", "print", "fail",
+    };
+    bool Instr::hasSideEffects() const {
+      return opcode == Opcode::print || opcode == Opcode::fail;
+    }
+    enum class Kind { unknown, integer, string, list };
+    // What kind of value an instruction produces when it doesn't trap.
+    static Kind kindOf(const Instr* in) {
+      switch (in->opcode) {
+        case Opcode::constant:
+          return in->constant.isString() ? Kind::string :
+            in->constant.isList() ? Kind::list : Kind::integer;
+        case Opcode::copy:
+        case Opcode::check:
+          return kindOf(in->args[0]);
+        case Opcode::binary:
+          return in->op == Operator::concat ? Kind::string : Kind::integer;
+        case Opcode::checkInt:
+        case Opcode::unary:
+        case Opcode::truthy:
+        case Opcode::forCheck:
+        case Opcode::forStep:
+          return Kind::integer;
+        case Opcode::makeList: return Kind::list;
+        default: return Kind::unknown;
+      }
+    }
+    bool Instr::mayTrap() const {
+      switch (opcode) {
+        case Opcode::binary: {
+          Kind a = kindOf(args[0]), b = kindOf(args[1]);
+          bool ints = a == Kind::integer && b == Kind::integer;
+          switch (op) {
+            // Equality works on any two values, logic only on truthiness.
+            case Operator::equal:
+            case Operator::notEqual:
+            case Operator::xorStmt:
+              return false;
+            case Operator::concat:
+              return a == Kind::unknown || a == Kind::list ||
+                b == Kind::unknown || b == Kind::list;
+            case Operator::plus:
+            case Operator::minus:
+            case Operator::times:
+              return !ints; // overflow promotes instead of trapping
+            case Operator::divide:
+            case Operator::modulo:
+              return !ints || args[1]->opcode != Opcode::constant ||
+                !args[1]->constant.truthy();
+            case Operator::less:
+            case Operator::greater:
+            case Operator::lessEqual:
+            case Operator::greaterEqual:
+              return !ints && !(a == Kind::string && b == Kind::string);
+            default: return true;
+          }
+        }
+        case Opcode::unary: {
+          Kind a = kindOf(args[0]);
+          switch (op) {
+            case Operator::notStmt: return false;
+            case Operator::minus: return a != Kind::integer;
+            case Operator::length:
+              return a != Kind::string && a != Kind::list;
+            default: return true;
+          }
+        }
+        case Opcode::check:
+        case Opcode::checkInt:
+        case Opcode::index:
+        case Opcode::forCheck:
+        case Opcode::forStep:
+        case Opcode::fail:
+          return true;
+        default: return false;
+      }
+    }
+    static void printInstr(std::ostream& out, const Instr& in) {
+      out << "  ";
+      if (!in.hasSideEffects()) out << "%" << in.id << " = ";
+      switch (in.opcode) {
+        case Opcode::binary:
+        case Opcode::unary:
+          out << opsAsStrings[(size_t) in.op];
+          break;
+        default:
+          out << opcodeNames[(size_t) in.opcode];
+      }
+      if (in.opcode == Opcode::constant) {
+        out << " ";
+        if (in.constant.isString()) {
+          out << "\"" << unescape(std::get<String>(in.constant.v).flat())
+            << "\"";
+        } else {
+          in.constant.print(out);
+        }
+      } else if (in.opcode == Opcode::fail) {
+        out << " \"" << runtimeErrorMessages[(size_t) in.error] << "\"";
+      }
+      for (size_t i = 0; i < in.args.size(); ++i) {
+        out << (i == 0 ? " " : ", ");
+        if (in.opcode == Opcode::phi) {
+          out << "[%" << in.args[i]->id << ", bb" << in.block->preds[i]->id
+            << "]";
+        } else {
+          out << "%" << in.args[i]->id;
+        }
+      }
+      out << "\n";
+    }
+    void Function::dump(std::ostream& out) {
+      size_t nextId = 0;
+      for (size_t i = 0; i < blocks.size(); ++i) {
+        Block& b = *blocks[i];
+        b.id = i;
+        for (InstrPtr& in : b.phis) in->id = nextId++;
+        for (InstrPtr& in : b.instrs) {
+          if (!in->hasSideEffects()) in->id = nextId++;
+        }
+      }
+      for (const BlockPtr& b : blocks) {
+        out << "bb" << b->id << ":";
+        if (!b->preds.empty()) {
+          out << " ; preds";
+          for (const Block* p : b->preds) out << " bb" << p->id;
+        }
+        out << "\n";
+        for (const InstrPtr& in : b->phis) printInstr(out, *in);
+        for (const InstrPtr& in : b->instrs) printInstr(out, *in);
+        switch (b->term) {
+          case Terminator::jump:
+            out << "  jump bb" << b->succs[0]->id << "\n";
+            break;
+          case Terminator::branch:
+            out << "  branch %" << b->cond->id << ", bb" << b->succs[0]->id
+              << ", bb" << b->succs[1]->id << "\n";
+            break;
+          case Terminator::exit:
+            out << "  exit\n";
+            break;
+        }
+      }
+    }
+    /**
+     * Builds SSA form directly from the statements, following
+     * Braun et al., "Simple and Efficient Construction of Static Single
+     * Assignment Form": each block maps slots to their current values,
+     * and phis are only created on demand when a variable is read.
+     */
+    class Builder {
+    public:
+      Builder(
+        const std::vector<Statement>& statements, Function& f,
+        std::vector<RuntimeError>& errorLog) :
+        statements(statements), f(f), errorLog(errorLog) {}
+      bool build();
+    private:
+      Block* newBlock();
+      Instr* emit(Opcode opcode, std::vector<Instr*> args = {});
+      Instr* constant(Value&& v);
+      void jump(Block* to);
+      void branch(Instr* cond, Block* t, Block* e);
+      void seal(Block* b);
+      void writeVariable(size_t slot, Block* b, Instr* v);
+      Instr* readVariable(size_t slot, Block* b);
+      Instr* read(const Variable* v);
+      Instr* checkInt(const Expression* ex);
+      Instr* lower(const Expression* ex);
+      Instr* lowerBinary(const BinaryOp* ex);
+      Instr* lowerList(const Expression* ex);
+      Instr* select(Instr* cond, const Expression* t, const Expression* e);
+      bool lowerRange(size_t& pc);
+      bool lowerIf(size_t& pc);
+      bool lowerLoop(size_t& pc);
+      bool error(RuntimeErrorCode c, size_t at);
+      const std::vector<Statement>& statements;
+      Function& f;
+      std::vector<RuntimeError>& errorLog;
+      Block* cur = nullptr;
+      LineInfo li;
+      std::unordered_map<Block*, std::map<size_t, Instr*>> defs;
+      std::unordered_map<Block*, std::vector<Instr*>> incompletePhis;
+      std::unordered_map<Block*, bool> sealed;
+    };
+    Block* Builder::newBlock() {
+      f.blocks.push_back(std::make_unique<Block>());
+      return f.blocks.back().get();
+    }
+    Instr* Builder::emit(Opcode opcode, std::vector<Instr*> args) {
+      auto in = std::make_unique<Instr>();
+      in->opcode = opcode;
+      in->args = std::move(args);
+      in->block = cur;
+      in->li = li;
+      cur->instrs.push_back(std::move(in));
+      return cur->instrs.back().get();
+    }
+    Instr* Builder::constant(Value&& v) {
+      Instr* in = emit(Opcode::constant);
+      in->constant = std::move(v);
+      return in;
+    }
+    void Builder::jump(Block* to) {
+      cur->term = Terminator::jump;
+      cur->succs = {to};
+      to->preds.push_back(cur);
+    }
+    void Builder::branch(Instr* cond, Block* t, Block* e) {
+      cur->term = Terminator::branch;
+      cur->cond = cond;
+      cur->succs = {t, e};
+      t->preds.push_back(cur);
+      e->preds.push_back(cur);
+    }
+    void Builder::seal(Block* b) {
+      for (Instr* phi : incompletePhis[b]) {
+        for (Block* p : b->preds)
+          phi->args.push_back(readVariable(phi->slot, p));
+      }
+      incompletePhis.erase(b);
+      sealed[b] = true;
+    }
+    void Builder::writeVariable(size_t slot, Block* b, Instr* v) {
+      defs[b][slot] = v;
+    }
+    Instr* Builder::readVariable(size_t slot, Block* b) {
+      auto it = defs[b].find(slot);
+      if (it != defs[b].end()) return it->second;
+      Instr* v;
+      if (!sealed[b] || b->preds.size() > 1) {
+        auto phi = std::make_unique<Instr>();
+        phi->opcode = Opcode::phi;
+        phi->block = b;
+        phi->slot = slot;
+        v = phi.get();
+        b->phis.push_back(std::move(phi));
+        // Break cycles before reading the predecessors.
+        writeVariable(slot, b, v);
+        if (!sealed[b]) {
+          incompletePhis[b].push_back(v);
+        } else {
+          for (Block* p : b->preds)
+            v->args.push_back(readVariable(slot, p));
+        }
+      } else if (b->preds.size() == 1) {
+        v = readVariable(slot, b->preds[0]);
+      } else {
+        auto in = std::make_unique<Instr>();
+        in->opcode = Opcode::undef;
+        in->block = b;
+        in->slot = slot;
+        v = in.get();
+        b->instrs.insert(b->instrs.begin(), std::move(in));
+      }
+      writeVariable(slot, b, v);
+      return v;
+    }
+    // A read of v, checked for being assigned. As in Interpreter::load,
+    // the error is at v unless --dedup merged it with one on another
+    // line.
+    Instr* Builder::read(const Variable* v) {
+      Instr* in = emit(Opcode::check, {readVariable(v->slot, cur)});
+      if (v->li.file == li.file && v->li.line == li.line) in->li = v->li;
+      return in;
+    }
+    // ex as a 64-bit integer, like Interpreter::evaluateInt
+    Instr* Builder::checkInt(const Expression* ex) {
+      return emit(Opcode::checkInt, {lower(ex)});
+    }
+    Instr* Builder::lowerList(const Expression* ex) {
+      std::vector<Instr*> elems;
+      if (ex != nullptr) {
+        std::vector<const Expression*> parts;
+        while (ex->id() == 2) {
+          const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+          if (b->o != Operator::comma) break;
+          parts.push_back(b->rhs());
+          ex = b->lhs();
+        }
+        parts.push_back(ex);
+        for (size_t i = parts.size(); i-- > 0;)
+          elems.push_back(lower(parts[i]));
+      }
+      return emit(Opcode::makeList, std::move(elems));
+    }
+    Instr* Builder::select(
+        Instr* cond, const Expression* t, const Expression* e) {
+      // Both arms may assign variables, so they get their own blocks.
+      Block* tb = newBlock();
+      Block* eb = newBlock();
+      Block* join = newBlock();
+      branch(cond, tb, eb);
+      seal(tb);
+      seal(eb);
+      cur = tb;
+      Instr* tv = lower(t);
+      jump(join);
+      cur = eb;
+      Instr* ev = e != nullptr ? lower(e) : constant(Value((int64_t) 0));
+      jump(join);
+      seal(join);
+      cur = join;
+      Instr* phi = emit(Opcode::phi, {tv, ev});
+      // Move the phi to where phis belong.
+      join->phis.push_back(std::move(join->instrs.back()));
+      join->instrs.pop_back();
+      return phi;
+    }
+    Instr* Builder::lowerBinary(const BinaryOp* ex) {
+      if (isAssignment(ex->o)) {
+        const Expression* target = ex->lhs();
+        if (target->id() != 6) {
+          Instr* in = emit(Opcode::fail);
+          in->error = RuntimeErrorCode::invalidAssignment;
+          return in;
+        }
+        const Variable* var = static_cast<const Variable*>(target);
+        size_t slot = var->slot;
+        Instr* v = lower(ex->rhs());
+        Operator op = assignedOperator(ex->o);
+        if (op != Operator::assign) {
+          v = emit(Opcode::binary, {read(var), v});
+          v->op = op;
+        }
+        Instr* c = emit(Opcode::copy, {v});
+        c->slot = slot;
+        writeVariable(slot, cur, c);
+        return c;
+      }
+      switch (ex->o) {
+        case Operator::comma: return lowerList(ex);
+        case Operator::andStmt:
+        case Operator::orStmt: {
+          // a & b => a ? truthy(b) : 0, a | b => a ? 1 : truthy(b)
+          Instr* a = lower(ex->lhs());
+          Block* rb = newBlock();
+          Block* sb = newBlock();
+          Block* join = newBlock();
+          bool isAnd = ex->o == Operator::andStmt;
+          branch(a, isAnd ? rb : sb, isAnd ? sb : rb);
+          seal(rb);
+          seal(sb);
+          cur = rb;
+          Instr* rv = emit(Opcode::truthy, {lower(ex->rhs())});
+          jump(join);
+          cur = sb;
+          Instr* sv = constant(Value((int64_t) !isAnd));
+          jump(join);
+          seal(join);
+          cur = join;
+          // The order of phi arguments follows join->preds.
+          Instr* phi = emit(Opcode::phi);
+          for (Block* p : join->preds) phi->args.push_back(p == sb ? sv : rv);
+          join->phis.push_back(std::move(join->instrs.back()));
+          join->instrs.pop_back();
+          return phi;
+        }
+        case Operator::questionMark: {
+          Instr* cond = lower(ex->lhs());
+          const Expression* r = ex->rhs();
+          if (r->id() == 2) {
+            const BinaryOp* sel = static_cast<const BinaryOp*>(r);
+            if (sel->o == Operator::colon)
+              return select(cond, sel->lhs(), sel->rhs());
+          }
+          return select(cond, r, nullptr);
+        }
+        case Operator::colon: {
+          Instr* in = emit(Opcode::fail);
+          in->error = RuntimeErrorCode::typeMismatch;
+          return in;
+        }
+        default: break;
+      }
+      Instr* a = lower(ex->lhs());
+      Instr* b = lower(ex->rhs());
+      Instr* in = emit(Opcode::binary, {a, b});
+      in->op = ex->o;
+      return in;
+    }
+    Instr* Builder::lower(const Expression* ex) {
+      switch (ex->id()) {
+        case 1: {
+          const Literal* l = static_cast<const Literal*>(ex);
+          switch (l->val.index()) {
+            case 1: return constant(Value(std::get<IntLiteral>(l->val).n));
+            case 2:
+              return constant(
+                Value(String(std::get<StringLiteral>(l->val).str)));
+            case 3:
+              return constant(
+                Value(BigInt(std::get<BigIntLiteral>(l->val).n)));
+          }
+          break;
+        }
+        case 2: return lowerBinary(static_cast<const BinaryOp*>(ex));
+        case 3: {
+          const UnaryOp* u = static_cast<const UnaryOp*>(ex);
+          Instr* in = emit(Opcode::unary, {lower(u->a.get())});
+          in->op = u->o;
+          return in;
+        }
+        case 4: {
+          const Bracket* b = static_cast<const Bracket*>(ex);
+          if (b->ex == nullptr || b->bracket == Operator::leftSBracket)
+            return lowerList(b->ex.get());
+          return lower(b->ex.get());
+        }
+        case 5: {
+          const Indexing* ix = static_cast<const Indexing*>(ex);
+          Instr* a = lower(ix->a.get());
+          if (ix->b == nullptr) {
+            Instr* in = emit(Opcode::fail);
+            in->error = RuntimeErrorCode::typeMismatch;
+            return in;
+          }
+          return emit(Opcode::index, {a, lower(ix->b.get())});
+        }
+        case 6: return read(static_cast<const Variable*>(ex));
+      }
+      assert(false);
+      return nullptr;
+    }
+    bool Builder::error(RuntimeErrorCode c, size_t at) {
+      errorLog.emplace_back(c, statements[at].li);
+      return false;
+    }
+    // Lower statements from pc until the end of the program or a
+    // statement that continues or closes the enclosing block,
+    // leaving pc at that statement.
+    bool Builder::lowerRange(size_t& pc) {
+      while (pc < statements.size()) {
+        const Statement& st = statements[pc];
+        li = st.li;
+        switch (st.statementOp) {
+          case Operator::ifThenStmt:
+          case Operator::elseStmt:
+          case Operator::endStmt:
+            return true;
+          case Operator::ifStmt:
+            if (!lowerIf(pc)) return false;
+            break;
+          case Operator::whileStmt:
+          case Operator::repeatStmt:
+          case Operator::forStmt:
+            if (!lowerLoop(pc)) return false;
+            break;
+          case Operator::print:
+            emit(Opcode::print, {lower(st.ex.get())});
+            ++pc;
+            break;
+          default:
+            lower(st.ex.get());
+            ++pc;
+        }
+      }
+      return true;
+    }
+    bool Builder::lowerIf(size_t& pc) {
+      size_t start = pc;
+      Block* join = newBlock();
+      bool sawElse = false;
+      while (true) {
+        const Statement& st = statements[pc];
+        li = st.li;
+        Block* body = newBlock();
+        Block* next = nullptr;
+        if (st.statementOp == Operator::elseStmt) {
+          sawElse = true;
+          jump(body);
+        } else {
+          next = newBlock();
+          branch(lower(st.ex.get()), body, next);
+          seal(next);
+        }
+        seal(body);
+        cur = body;
+        ++pc;
+        if (!lowerRange(pc)) return false;
+        if (pc == statements.size())
+          return error(RuntimeErrorCode::unterminatedBlock, start);
+        jump(join);
+        Operator op = statements[pc].statementOp;
+        if (op == Operator::endStmt) {
+          if (next != nullptr) {
+            cur = next;
+            jump(join);
+          }
+          break;
+        }
+        if (sawElse) return error(RuntimeErrorCode::misplacedBranch, pc);
+        cur = next;
+      }
+      seal(join);
+      cur = join;
+      ++pc;
+      return true;
+    }
+    // Loops are lowered in rotated form: a guard tests the condition
+    // once before entering, and the latch tests it again to decide
+    // whether to go round. The first block of the body then dominates
+    // every exit, which lets hoistLoopInvariants move code out of it.
+    bool Builder::lowerLoop(size_t& pc) {
+      size_t start = pc;
+      const Statement& st = statements[pc];
+      Operator kind = st.statementOp;
+      Block* exit = newBlock();
+      Instr* limit = nullptr;
+      Instr* step = nullptr;
+      size_t forSlot = 0;
+      bool forValid = false;
+      if (kind == Operator::forStmt) {
+        // Evaluate the bounds once, before entering the loop.
+        std::vector<const Expression*> parts;
+        const Expression* ex = st.ex.get();
+        while (ex->id() == 2 &&
+            static_cast<const BinaryOp*>(ex)->o == Operator::comma) {
+          parts.push_back(static_cast<const BinaryOp*>(ex)->rhs());
+          ex = static_cast<const BinaryOp*>(ex)->lhs();
+        }
+        parts.push_back(ex);
+        if (parts.size() < 3 || parts.size() > 4 || ex->id() != 6) {
+          Instr* in = emit(Opcode::fail);
+          in->error = RuntimeErrorCode::invalidForLoop;
+        } else {
+          forValid = true;
+          forSlot = static_cast<const Variable*>(ex)->slot;
+          Instr* first = checkInt(parts[parts.size() - 2]);
+          limit = checkInt(parts[parts.size() - 3]);
+          step = parts.size() == 4 ?
+            checkInt(parts[0]) : constant(Value((int64_t) 1));
+          Instr* c = emit(Opcode::copy, {first});
+          c->slot = forSlot;
+          writeVariable(forSlot, cur, c);
+        }
+      }
+      auto test = [&]() {
+        if (kind == Operator::forStmt) {
+          if (!forValid) return constant(Value((int64_t) 0));
+          return emit(
+            Opcode::forCheck, {readVariable(forSlot, cur), limit, step});
+        }
+        return lower(st.ex.get());
+      };
+      if (kind != Operator::repeatStmt) {
+        Block* pre = newBlock();
+        branch(test(), pre, exit);
+        seal(pre);
+        cur = pre;
+      }
+      Block* header = newBlock();
+      jump(header);
+      cur = header;
+      ++pc;
+      if (!lowerRange(pc)) return false;
+      if (pc == statements.size() ||
+          statements[pc].statementOp != Operator::endStmt)
+        return error(RuntimeErrorCode::unterminatedBlock, start);
+      // The interpreter tests a while loop's condition at the @ again.
+      li = statements[kind == Operator::whileStmt ? start : pc].li;
+      if (kind == Operator::repeatStmt) {
+        // Repeat until the condition holds.
+        branch(test(), exit, header);
+      } else {
+        if (forValid) {
+          Instr* next = emit(
+            Opcode::forStep, {readVariable(forSlot, cur), step});
+          Instr* c = emit(Opcode::copy, {next});
+          c->slot = forSlot;
+          writeVariable(forSlot, cur, c);
+        }
+        branch(test(), header, exit);
+      }
+      seal(header);
+      seal(exit);
+      cur = exit;
+      ++pc;
+      return true;
+    }
+    bool Builder::build() {
+      cur = newBlock();
+      seal(cur);
+      size_t pc = 0;
+      if (!lowerRange(pc)) return false;
+      if (pc < statements.size()) {
+        Operator op = statements[pc].statementOp;
+        return error(
+          op == Operator::endStmt ?
+            RuntimeErrorCode::unmatchedEnd :
+            RuntimeErrorCode::misplacedBranch,
+          pc);
+      }
+      cur->term = Terminator::exit;
+      return true;
+    }
+    bool build(
+        const std::vector<Statement>& statements,
+        const std::vector<std::string>& slotNames,
+        Function& f, std::vector<RuntimeError>& errorLog) {
+      f.slotNames = slotNames;
+      return Builder(statements, f, errorLog).build();
+    }
+  }
+}
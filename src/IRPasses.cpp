@@ -0,0 +1,340 @@
+#include "IR.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+
+namespace x666 {
+  namespace ir {
+    using Replacements = std::unordered_map<Instr*, Instr*>;
+    static Instr* resolve(const Replacements& repl, Instr* in) {
+      auto it = repl.find(in);
+      while (it != repl.end()) {
+        in = it->second;
+        it = repl.find(in);
+      }
+      return in;
+    }
+    // Rewrite every use of a replaced instruction, then delete the
+    // replaced instructions themselves.
+    static void applyReplacements(Function& f, const Replacements& repl) {
+      if (repl.empty()) return;
+      auto isReplaced = [&](const InstrPtr& in) {
+        return repl.count(in.get()) != 0;
+      };
+      for (BlockPtr& b : f.blocks) {
+        for (std::vector<InstrPtr>* list : {&b->phis, &b->instrs}) {
+          for (InstrPtr& in : *list) {
+            for (Instr*& arg : in->args) arg = resolve(repl, arg);
+          }
+        }
+        if (b->cond != nullptr) b->cond = resolve(repl, b->cond);
+      }
+      for (BlockPtr& b : f.blocks) {
+        for (std::vector<InstrPtr>* list : {&b->phis, &b->instrs}) {
+          list->erase(
+            std::remove_if(list->begin(), list->end(), isReplaced),
+            list->end());
+        }
+      }
+    }
+    bool propagateCopies(Function& f) {
+      Replacements repl;
+      for (BlockPtr& b : f.blocks) {
+        for (InstrPtr& in : b->instrs) {
+          if (in->opcode == Opcode::copy) repl[in.get()] = in->args[0];
+        }
+      }
+      // A phi whose arguments are all the same value (or the phi
+      // itself) is a copy too.
+      bool changed = true;
+      while (changed) {
+        changed = false;
+        for (BlockPtr& b : f.blocks) {
+          for (InstrPtr& phi : b->phis) {
+            if (repl.count(phi.get()) != 0) continue;
+            Instr* same = nullptr;
+            bool trivial = true;
+            for (Instr* arg : phi->args) {
+              arg = resolve(repl, arg);
+              if (arg == phi.get() || arg == same) continue;
+              if (same != nullptr) {
+                trivial = false;
+                break;
+              }
+              same = arg;
+            }
+            if (trivial && same != nullptr) {
+              repl[phi.get()] = same;
+              changed = true;
+            }
+          }
+        }
+      }
+      // So is a check of a value that is never undef: one that isn't
+      // undef itself or a phi with such an argument.
+      std::unordered_set<const Instr*> undefined;
+      auto mayBeUndef = [&](Instr* in) {
+        in = resolve(repl, in);
+        return in->opcode == Opcode::undef || undefined.count(in) != 0;
+      };
+      changed = true;
+      while (changed) {
+        changed = false;
+        for (BlockPtr& b : f.blocks) {
+          for (InstrPtr& phi : b->phis) {
+            if (repl.count(phi.get()) != 0 || undefined.count(phi.get()) != 0)
+              continue;
+            if (std::any_of(phi->args.begin(), phi->args.end(), mayBeUndef)) {
+              undefined.insert(phi.get());
+              changed = true;
+            }
+          }
+        }
+      }
+      for (BlockPtr& b : f.blocks) {
+        for (InstrPtr& in : b->instrs) {
+          if (in->opcode == Opcode::check && !mayBeUndef(in->args[0]))
+            repl[in.get()] = in->args[0];
+        }
+      }
+      applyReplacements(f, repl);
+      return !repl.empty();
+    }
+    /** Dominator information, from Cooper, Harvey and Kennedy. */
+    struct Dominators {
+      Dominators(Function& f);
+      bool dominates(const Block* a, const Block* b) const;
+      std::vector<Block*> rpo;
+      std::unordered_map<const Block*, size_t> order;
+      std::unordered_map<const Block*, Block*> idom;
+    };
+    Dominators::Dominators(Function& f) {
+      // Reverse postorder, iteratively
+      std::unordered_set<Block*> seen;
+      std::vector<std::pair<Block*, size_t>> stack;
+      Block* entry = f.blocks[0].get();
+      stack.push_back({entry, 0});
+      seen.insert(entry);
+      while (!stack.empty()) {
+        auto& [b, i] = stack.back();
+        if (i < b->succs.size()) {
+          Block* s = b->succs[i++];
+          if (seen.insert(s).second) stack.push_back({s, 0});
+        } else {
+          rpo.push_back(b);
+          stack.pop_back();
+        }
+      }
+      std::reverse(rpo.begin(), rpo.end());
+      for (size_t i = 0; i < rpo.size(); ++i) order[rpo[i]] = i;
+      idom[entry] = entry;
+      bool changed = true;
+      while (changed) {
+        changed = false;
+        for (size_t i = 1; i < rpo.size(); ++i) {
+          Block* b = rpo[i];
+          Block* d = nullptr;
+          for (Block* p : b->preds) {
+            if (idom.count(p) == 0) continue;
+            if (d == nullptr) {
+              d = p;
+              continue;
+            }
+            Block* x = p;
+            while (x != d) {
+              while (order[x] > order[d]) x = idom[x];
+              while (order[d] > order[x]) d = idom[d];
+            }
+          }
+          if (idom[b] != d) {
+            idom[b] = d;
+            changed = true;
+          }
+        }
+      }
+    }
+    bool Dominators::dominates(const Block* a, const Block* b) const {
+      while (true) {
+        if (a == b) return true;
+        auto it = idom.find(b);
+        if (it == idom.end() || it->second == b) return false;
+        b = it->second;
+      }
+    }
+    // A key identifying the computation done by an instruction,
+    // or an empty string if it shouldn't be shared.
+    static std::string valueKey(const Instr& in) {
+      switch (in.opcode) {
+        case Opcode::constant:
+        case Opcode::binary:
+        case Opcode::unary:
+        case Opcode::truthy:
+        case Opcode::index:
+        case Opcode::makeList:
+        case Opcode::check:
+        case Opcode::checkInt:
+        case Opcode::forCheck:
+        case Opcode::forStep:
+          break;
+        default: return "";
+      }
+      std::string key = std::to_string((int) in.opcode);
+      key += ' ';
+      key += std::to_string((int) in.op);
+      for (const Instr* arg : in.args) {
+        key += ' ';
+        key += std::to_string((uintptr_t) arg);
+      }
+      if (in.opcode == Opcode::constant) {
+        key += ' ';
+        key += std::to_string(in.constant.v.index());
+        key += ':';
+        String s;
+        if (in.constant.toString(s)) key += s.flat();
+      }
+      return key;
+    }
+    bool eliminateCommonSubexpressions(Function& f) {
+      Dominators dom(f);
+      std::unordered_map<const Block*, std::vector<Block*>> children;
+      for (Block* b : dom.rpo) {
+        if (dom.idom[b] != b) children[dom.idom[b]].push_back(b);
+      }
+      // Walk the dominator tree; values computed in a block are
+      // available to every block it dominates.
+      Replacements repl;
+      std::unordered_map<std::string, Instr*> available;
+      std::vector<std::vector<std::string>> scopes;
+      std::vector<std::pair<Block*, size_t>> stack;
+      stack.push_back({dom.rpo[0], 0});
+      scopes.emplace_back();
+      while (!stack.empty()) {
+        auto& [b, i] = stack.back();
+        if (i == 0) {
+          for (InstrPtr& in : b->instrs) {
+            for (Instr*& arg : in->args) arg = resolve(repl, arg);
+            std::string key = valueKey(*in);
+            if (key.empty()) continue;
+            auto it = available.find(key);
+            if (it != available.end()) {
+              repl[in.get()] = it->second;
+            } else {
+              available.emplace(key, in.get());
+              scopes.back().push_back(std::move(key));
+            }
+          }
+        }
+        std::vector<Block*>& kids = children[b];
+        if (i < kids.size()) {
+          Block* k = kids[i++];
+          stack.push_back({k, 0});
+          scopes.emplace_back();
+        } else {
+          for (const std::string& key : scopes.back()) available.erase(key);
+          scopes.pop_back();
+          stack.pop_back();
+        }
+      }
+      applyReplacements(f, repl);
+      return !repl.empty();
+    }
+    bool hoistLoopInvariants(Function& f) {
+      Dominators dom(f);
+      // Natural loops, by header
+      std::unordered_map<Block*, std::unordered_set<Block*>> loops;
+      for (Block* b : dom.rpo) {
+        for (Block* h : b->succs) {
+          if (!dom.dominates(h, b)) continue;
+          std::unordered_set<Block*>& body = loops[h];
+          body.insert(h);
+          std::vector<Block*> work{b};
+          while (!work.empty()) {
+            Block* x = work.back();
+            work.pop_back();
+            if (!body.insert(x).second) continue;
+            for (Block* p : x->preds) work.push_back(p);
+          }
+        }
+      }
+      bool changed = false;
+      for (auto& [header, body] : loops) {
+        Block* pre = nullptr;
+        for (Block* p : header->preds) {
+          if (body.count(p) != 0) continue;
+          if (pre != nullptr) {
+            pre = nullptr;
+            break;
+          }
+          pre = p;
+        }
+        if (pre == nullptr || pre->succs.size() != 1) continue;
+        std::vector<Block*> blocks;
+        for (Block* b : dom.rpo) {
+          if (body.count(b) != 0) blocks.push_back(b);
+        }
+        for (Block* b : blocks) {
+          // Instructions that can trap are only hoisted from the
+          // header, and only if nothing observable happens before them,
+          // so the error (if any) is raised the same way.
+          bool blocked = b != header;
+          std::vector<InstrPtr> kept;
+          for (InstrPtr& in : b->instrs) {
+            bool invariant = !in->hasSideEffects() &&
+              in->opcode != Opcode::undef &&
+              std::all_of(in->args.begin(), in->args.end(),
+                [&](const Instr* a) { return body.count(a->block) == 0; });
+            if (invariant && in->mayTrap() && blocked) invariant = false;
+            if (invariant) {
+              in->block = pre;
+              pre->instrs.push_back(std::move(in));
+              changed = true;
+            } else {
+              if (in->hasSideEffects() || in->mayTrap()) blocked = true;
+              kept.push_back(std::move(in));
+            }
+          }
+          b->instrs = std::move(kept);
+        }
+      }
+      return changed;
+    }
+    bool eliminateDeadCode(Function& f) {
+      std::unordered_set<Instr*> live;
+      std::vector<Instr*> work;
+      for (BlockPtr& b : f.blocks) {
+        for (InstrPtr& in : b->instrs) {
+          if (in->hasSideEffects() || in->mayTrap()) work.push_back(in.get());
+        }
+        if (b->cond != nullptr) work.push_back(b->cond);
+      }
+      while (!work.empty()) {
+        Instr* in = work.back();
+        work.pop_back();
+        if (!live.insert(in).second) continue;
+        for (Instr* arg : in->args) work.push_back(arg);
+      }
+      bool changed = false;
+      auto isDead = [&](const InstrPtr& in) {
+        return live.count(in.get()) == 0;
+      };
+      for (BlockPtr& b : f.blocks) {
+        for (std::vector<InstrPtr>* list : {&b->phis, &b->instrs}) {
+          auto it = std::remove_if(list->begin(), list->end(), isDead);
+          changed |= it != list->end();
+          list->erase(it, list->end());
+        }
+      }
+      return changed;
+    }
+    void optimize(Function& f) {
+      bool changed = true;
+      while (changed) {
+        changed = propagateCopies(f);
+        changed |= eliminateCommonSubexpressions(f);
+        changed |= hoistLoopInvariants(f);
+        changed |= eliminateDeadCode(f);
+      }
+    }
+  }
+}
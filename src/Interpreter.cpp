@@ -0,0 +1,661 @@
+#include "Interpreter.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "BlockLoader.h"
+
+namespace x666 {
+  const char* runtimeErrorMessages[] = {
+    "&> without a matching block",
+    "Block is never closed with &>",
+    "?& or !! outside of a ?? block",
+    "Variable is used before it is assigned",
+    "Left side of <- must be a variable",
+    "Operand has the wrong type",
+    "Integer is too big to fit type",
+    "Division by zero",
+    "Index is out of range",
+    "@# needs a variable, a start and an end",
+    "Batch mode only supports integer expressions and ?? blocks",
+    "Program ran past its statement limit",
+    "Block doesn't parse",
+  };
+  void RuntimeError::print(std::istream& fh) const {
+    print(fh, std::cout);
+  }
+  void RuntimeError::print(std::istream& fh, std::ostream& out) const {
+    out << "Runtime error";
+    printFileOf(li, out);
+    out << " at line " << (li.line + 1);
+    out << " column " << (li.col + 1) << ": ";
+    out << runtimeErrorMessages[(int) c] << "\n";
+    printSnippet(fh, li, out);
+  }
+  Interpreter::Interpreter(
+      const std::vector<Statement>& statements, size_t slotCount,
+      std::ostream& out, bool jit) :
+    statements(statements), out(out),
+    slots(slotCount), assigned(slotCount, false), pc(0), jit(jit) {}
+  bool Interpreter::run() {
+    return start() && resume(SIZE_MAX) == Status::finished;
+  }
+  bool Interpreter::start() {
+    pc = 0;
+    forBounds.assign(statements.size(), {0, 0});
+    if (jit) hotLoops.resize(statements.size());
+    return link();
+  }
+  Interpreter::Status Interpreter::resume(size_t budget) {
+    X666_PROBE1(run_start, pc);
+    fuel = budget;
+    Status status = Status::suspended;
+    try {
+      if (profile != nullptr) execute<true>();
+      else execute<false>();
+      if (pc == statements.size()) status = Status::finished;
+    } catch (const RuntimeError& e) {
+      errorLog.push_back(e);
+      status = Status::failed;
+    }
+    steps += budget - fuel;
+    X666_PROBE2(run_done, pc, budget - fuel);
+    return status;
+  }
+  void Interpreter::stop(RuntimeErrorCode c) {
+    errorLog.emplace_back(c, statements[pc].li);
+  }
+  void Interpreter::bind(size_t slot, Value&& v) {
+    slots[slot] = std::move(v);
+    assigned[slot] = true;
+  }
+  bool Interpreter::link() {
+    size_t n = statements.size();
+    jumps.assign(n, n);
+    std::vector<size_t> open;
+    for (size_t i = 0; i < n; ++i) {
+      Operator op = statements[i].statementOp;
+      switch (op) {
+        case Operator::ifStmt:
+        case Operator::whileStmt:
+        case Operator::repeatStmt:
+        case Operator::forStmt:
+          open.push_back(i);
+          break;
+        case Operator::ifThenStmt:
+        case Operator::elseStmt: {
+          Operator top = open.empty() ?
+            Operator::plus : statements[open.back()].statementOp;
+          if (top != Operator::ifStmt && top != Operator::ifThenStmt) {
+            errorLog.emplace_back(
+              RuntimeErrorCode::misplacedBranch, statements[i].li);
+            return false;
+          }
+          jumps[open.back()] = i;
+          open.back() = i;
+          break;
+        }
+        case Operator::endStmt:
+          if (open.empty()) {
+            errorLog.emplace_back(
+              RuntimeErrorCode::unmatchedEnd, statements[i].li);
+            return false;
+          }
+          jumps[open.back()] = i;
+          jumps[i] = open.back();
+          open.pop_back();
+          break;
+        default: break;
+      }
+    }
+    if (!open.empty()) {
+      errorLog.emplace_back(
+        RuntimeErrorCode::unterminatedBlock, statements[open.back()].li);
+      return false;
+    }
+    return true;
+  }
+  void Interpreter::fail(RuntimeErrorCode c) {
+    throw RuntimeError(c, statements[pc].li);
+  }
+  // Collect the operands of a chain of commas, in order.
+  static std::vector<const Expression*> commaOperands(const Expression* ex) {
+    std::vector<const Expression*> parts;
+    while (ex->id() == 2) {
+      const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+      if (b->o != Operator::comma) break;
+      parts.push_back(b->rhs());
+      ex = b->lhs();
+    }
+    parts.push_back(ex);
+    std::reverse(parts.begin(), parts.end());
+    return parts;
+  }
+  template<bool profiled> void Interpreter::execute() {
+    size_t n = statements.size();
+    while (pc < n && fuel != 0) {
+      --fuel;
+      if (profiled) profile->enter(pc);
+      const Statement& st = statements[pc];
+      switch (st.statementOp) {
+        case Operator::print:
+          evaluate(st.ex.get()).print(out);
+          out << "\n";
+          ++pc;
+          break;
+        case Operator::ifStmt: {
+          // Try each clause in turn until one is taken.
+          size_t k = pc;
+          while (true) {
+            const Statement& c = statements[k];
+            if (c.statementOp != Operator::ifStmt &&
+                c.statementOp != Operator::ifThenStmt)
+              break;
+            pc = k;
+            if (evaluate(c.ex.get()).truthy()) break;
+            k = jumps[k];
+          }
+          pc = k + 1;
+          break;
+        }
+        case Operator::ifThenStmt:
+        case Operator::elseStmt:
+          // Reached by finishing the body of a taken clause.
+          while (statements[pc].statementOp != Operator::endStmt)
+            pc = jumps[pc];
+          ++pc;
+          break;
+        case Operator::whileStmt:
+          pc = evaluate(st.ex.get()).truthy() ? pc + 1 : jumps[pc] + 1;
+          break;
+        case Operator::repeatStmt:
+          ++pc;
+          break;
+        case Operator::forStmt: {
+          std::vector<const Expression*> parts = commaOperands(st.ex.get());
+          if (parts.size() < 3 || parts.size() > 4 || parts[0]->id() != 6)
+            fail(RuntimeErrorCode::invalidForLoop);
+          int64_t start = evaluateInt(parts[1]);
+          int64_t limit = evaluateInt(parts[2]);
+          int64_t step = parts.size() == 4 ? evaluateInt(parts[3]) : 1;
+          if (step == 0) fail(RuntimeErrorCode::invalidForLoop);
+          store(static_cast<const Variable*>(parts[0])) = Value(start);
+          forBounds[pc] = {limit, step};
+          bool enter = step > 0 ? start <= limit : start >= limit;
+          pc = enter ? pc + 1 : jumps[pc] + 1;
+          break;
+        }
+        case Operator::block:
+          expandBlock();
+          n = statements.size();
+          break;
+        case Operator::endStmt: {
+          if (jit && enterNative()) break;
+          size_t h = jumps[pc];
+          const Statement& head = statements[h];
+          if (head.statementOp == Operator::whileStmt) {
+            pc = h;
+          } else if (head.statementOp == Operator::repeatStmt) {
+            pc = evaluate(head.ex.get()).truthy() ? pc + 1 : h + 1;
+          } else if (head.statementOp == Operator::forStmt) {
+            Value& v = load(static_cast<const Variable*>(
+              commaOperands(head.ex.get())[0]));
+            if (!v.isInt()) fail(RuntimeErrorCode::typeMismatch);
+            auto [limit, step] = forBounds[h];
+            int64_t i;
+            if (__builtin_add_overflow(std::get<int64_t>(v.v), step, &i))
+              fail(RuntimeErrorCode::integerOverflow);
+            v = Value(i);
+            bool again = step > 0 ? i <= limit : i >= limit;
+            pc = again ? h + 1 : pc + 1;
+          } else {
+            ++pc;
+          }
+          break;
+        }
+        default:
+          evaluate(st.ex.get());
+          ++pc;
+      }
+    }
+  }
+  // Iterations of a loop before it is compiled, and deopts after
+  // which it is given up on
+  static constexpr size_t jitThreshold = 8;
+  static constexpr size_t maxDeopts = 10;
+  bool Interpreter::enterNative() {
+    size_t end = pc, h = jumps[pc];
+    Operator kind = statements[h].statementOp;
+    if (kind != Operator::whileStmt && kind != Operator::repeatStmt &&
+        kind != Operator::forStmt)
+      return false;
+    HotLoop& loop = hotLoops[h];
+    if (loop.failed) return false;
+    if (loop.code == nullptr) {
+      if (++loop.hits < jitThreshold) return false;
+      loop.code = compileLoop(statements, jumps, h, end,
+        profile != nullptr ? profile->counters() : nullptr);
+      if (loop.code == nullptr) {
+        loop.failed = true;
+        return false;
+      }
+    }
+    const std::vector<size_t>& used = loop.code->slots;
+    nativeVars.resize(2 + used.size());
+    nativeVars[0] = forBounds[h].first;
+    nativeVars[1] = forBounds[h].second;
+    for (size_t i = 0; i < used.size(); ++i) {
+      const Value& v = slots[used[i]];
+      if (!assigned[used[i]] || !v.isInt()) return false;
+      nativeVars[2 + i] = std::get<int64_t>(v.v);
+    }
+    if (profile != nullptr) {
+      // The native code counts this &> again as it runs it, unless it
+      // deopts there.
+      --profile->counters()[end];
+      profile->runningNative(loop.code.get());
+    }
+    pc = loop.code->run(nativeVars.data());
+    if (profile != nullptr) {
+      profile->runningNative(nullptr);
+      if (pc == end) ++profile->counters()[end];
+    }
+    for (size_t i = 0; i < used.size(); ++i)
+      slots[used[i]] = Value(nativeVars[2 + i]);
+    if (pc != end + 1 && ++loop.deopts >= maxDeopts) loop.failed = true;
+    // A deopt at the &> itself is left to the interpreter.
+    return pc != end;
+  }
+  void Interpreter::expandBlock() {
+    assert(loader != nullptr);
+    size_t count;
+    if (!loader->expand(pc, count)) fail(RuntimeErrorCode::blockParseFailed);
+    forBounds.erase(forBounds.begin() + pc);
+    forBounds.insert(forBounds.begin() + pc, count, {0, 0});
+    // Compiled loops know the indices of their statements, which have
+    // moved, so they are compiled again.
+    if (jit) {
+      hotLoops.clear();
+      hotLoops.resize(statements.size());
+    }
+    slots.resize(loader->slotCount());
+    assigned.resize(loader->slotCount(), false);
+    if (!link()) {
+      RuntimeError e = errorLog.back();
+      errorLog.pop_back();
+      throw e;
+    }
+  }
+  Value& Interpreter::load(const Variable* v) {
+    if (!assigned[v->slot]) {
+      // At the read, unless --dedup merged it with one on another line
+      const LineInfo& at = statements[pc].li;
+      if (v->li.file != at.file || v->li.line != at.line)
+        fail(RuntimeErrorCode::undefinedVariable);
+      throw RuntimeError(RuntimeErrorCode::undefinedVariable, v->li);
+    }
+    return slots[v->slot];
+  }
+  Value& Interpreter::store(const Variable* v) {
+    assigned[v->slot] = true;
+    return slots[v->slot];
+  }
+  int64_t Interpreter::evaluateInt(const Expression* ex) {
+    Value v = evaluate(ex);
+    if (v.isBigInt()) fail(RuntimeErrorCode::integerOverflow);
+    if (!v.isInt()) fail(RuntimeErrorCode::typeMismatch);
+    return std::get<int64_t>(v.v);
+  }
+  // If every part is an integer literal, write their values to ns.
+  static bool integerLiterals(
+      const std::vector<const Expression*>& parts,
+      std::vector<int64_t>& ns) {
+    ns.resize(parts.size());
+    for (size_t i = 0; i < parts.size(); ++i) {
+      if (parts[i]->id() != 1) return false;
+      const Literal* l = static_cast<const Literal*>(parts[i]);
+      if (!std::holds_alternative<IntLiteral>(l->val)) return false;
+      ns[i] = std::get<IntLiteral>(l->val).n;
+    }
+    return true;
+  }
+  Value Interpreter::evaluateList(const Expression* ex) {
+    if (ex == nullptr) return Value(ListPtr(std::make_shared<List>()));
+    auto cached = constantLists.find(ex);
+    if (cached != constantLists.end() && cached->second != nullptr)
+      return Value(ListPtr(cached->second));
+    std::vector<const Expression*> parts = commaOperands(ex);
+    auto l = std::make_shared<List>();
+    if (cached == constantLists.end()) {
+      std::vector<int64_t> ns;
+      if (integerLiterals(parts, ns)) {
+        l->append(ns.data(), ns.size());
+        ListPtr shared = std::move(l);
+        constantLists.emplace(ex, shared);
+        return Value(std::move(shared));
+      }
+      constantLists.emplace(ex, nullptr);
+    }
+    l->reserve(parts.size());
+    for (const Expression* e : parts) l->push(evaluate(e));
+    return Value(ListPtr(std::move(l)));
+  }
+  Value Interpreter::evaluate(const Expression* ex) {
+    switch (ex->id()) {
+      case 1: {
+        const Literal* l = static_cast<const Literal*>(ex);
+        switch (l->val.index()) {
+          case 1: return Value(std::get<IntLiteral>(l->val).n);
+          case 2: return Value(String(std::get<StringLiteral>(l->val).str));
+          case 3: return Value(BigInt(std::get<BigIntLiteral>(l->val).n));
+        }
+        break;
+      }
+      case 6: return load(static_cast<const Variable*>(ex));
+      case 2:
+      case 3: {
+        int64_t r;
+        if (ex->unboxed && evaluateUnboxed(ex, r)) return Value(r);
+        if (ex->id() == 3)
+          return evaluateUnary(static_cast<const UnaryOp*>(ex));
+        return evaluateBinary(static_cast<const BinaryOp*>(ex));
+      }
+      case 4: {
+        const Bracket* b = static_cast<const Bracket*>(ex);
+        if (b->ex == nullptr || b->bracket == Operator::leftSBracket)
+          return evaluateList(b->ex.get());
+        return evaluate(b->ex.get());
+      }
+      case 5: {
+        const Indexing* ix = static_cast<const Indexing*>(ex);
+        Value a = evaluate(ix->a.get());
+        if (ix->b == nullptr) fail(RuntimeErrorCode::typeMismatch);
+        int64_t i = evaluateInt(ix->b.get());
+        if (a.isString()) {
+          const String& s = std::get<String>(a.v);
+          if (i < 0 || (size_t) i >= s.size())
+            fail(RuntimeErrorCode::indexOutOfRange);
+          return Value(String(std::string(1, s.at(i))));
+        } else if (a.isList()) {
+          const List& l = *std::get<ListPtr>(a.v);
+          if (i < 0 || (size_t) i >= l.size())
+            fail(RuntimeErrorCode::indexOutOfRange);
+          return l.at(i);
+        }
+        fail(RuntimeErrorCode::typeMismatch);
+      }
+    }
+    assert(false);
+    return Value();
+  }
+  bool Interpreter::evaluateUnboxed(const Expression* ex, int64_t& r) {
+    switch (ex->id()) {
+      case 1: {
+        const Literal* l = static_cast<const Literal*>(ex);
+        if (l->val.index() != 1) return false;
+        r = std::get<IntLiteral>(l->val).n;
+        return true;
+      }
+      case 6: {
+        const Value& v = load(static_cast<const Variable*>(ex));
+        if (!v.isInt()) return false;
+        r = std::get<int64_t>(v.v);
+        return true;
+      }
+      case 4:
+        return evaluateUnboxed(static_cast<const Bracket*>(ex)->ex.get(), r);
+      case 3: {
+        const UnaryOp* u = static_cast<const UnaryOp*>(ex);
+        int64_t a;
+        if (!evaluateUnboxed(u->a.get(), a)) return false;
+        if (u->o == Operator::notStmt) {
+          r = a == 0;
+          return true;
+        }
+        return !__builtin_sub_overflow((int64_t) 0, a, &r);
+      }
+      case 2: break;
+      default: return false;
+    }
+    const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+    int64_t x, y;
+    if (!evaluateUnboxed(b->lhs(), x)) return false;
+    switch (b->o) {
+      case Operator::andStmt:
+      case Operator::orStmt:
+        if ((x != 0) == (b->o == Operator::orStmt)) {
+          r = x != 0;
+          return true;
+        }
+        if (!evaluateUnboxed(b->rhs(), y)) return false;
+        r = y != 0;
+        return true;
+      case Operator::questionMark: {
+        const Expression* sel = b->rhs();
+        if (sel->id() == 2 &&
+            static_cast<const BinaryOp*>(sel)->o == Operator::colon) {
+          const BinaryOp* c = static_cast<const BinaryOp*>(sel);
+          return evaluateUnboxed(x != 0 ? c->lhs() : c->rhs(), r);
+        }
+        if (x != 0) return evaluateUnboxed(sel, r);
+        r = 0;
+        return true;
+      }
+      case Operator::colon: return false;
+      default: break;
+    }
+    if (!evaluateUnboxed(b->rhs(), y)) return false;
+    switch (b->o) {
+      case Operator::plus: return !__builtin_add_overflow(x, y, &r);
+      case Operator::minus: return !__builtin_sub_overflow(x, y, &r);
+      case Operator::times: return !__builtin_mul_overflow(x, y, &r);
+      case Operator::divide:
+      case Operator::modulo:
+        if (y == 0) fail(RuntimeErrorCode::divisionByZero);
+        if (x == INT64_MIN && y == -1) {
+          r = 0;
+          return b->o == Operator::modulo;
+        }
+        r = b->o == Operator::divide ? x / y : x % y;
+        return true;
+      case Operator::equal: r = x == y; return true;
+      case Operator::notEqual: r = x != y; return true;
+      case Operator::less: r = x < y; return true;
+      case Operator::greater: r = x > y; return true;
+      case Operator::lessEqual: r = x <= y; return true;
+      case Operator::greaterEqual: r = x >= y; return true;
+      case Operator::xorStmt: r = (x != 0) != (y != 0); return true;
+      default: return false;
+    }
+  }
+  static bool valuesEqual(const Value& a, const Value& b) {
+    if (a.v.index() != b.v.index()) return false;
+    switch (a.v.index()) {
+      case 0: return std::get<0>(a.v) == std::get<0>(b.v);
+      case 1: return std::get<1>(a.v).compare(std::get<1>(b.v)) == 0;
+      case 3: return std::get<3>(a.v)->compare(*std::get<3>(b.v)) == 0;
+      case 2: {
+        const List& la = *std::get<2>(a.v);
+        const List& lb = *std::get<2>(b.v);
+        if (la.size() != lb.size()) return false;
+        if (la.isPacked() && lb.isPacked())
+          return la.integers() == lb.integers();
+        for (size_t i = 0; i < la.size(); ++i) {
+          if (!valuesEqual(la.at(i), lb.at(i))) return false;
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+  Value Interpreter::evaluateAssign(const BinaryOp* ex) {
+    const Expression* target = ex->lhs();
+    if (target->id() != 6)
+      fail(RuntimeErrorCode::invalidAssignment);
+    const Variable* var = static_cast<const Variable*>(target);
+    Operator op = assignedOperator(ex->o);
+    const Expression* rhs = ex->rhs();
+    if (op == Operator::assign && rhs->id() == 2) {
+      const BinaryOp* r = static_cast<const BinaryOp*>(rhs);
+      const Expression* first = r->lhs();
+      if (r->o == Operator::concat && first->id() == 6 &&
+          static_cast<const Variable*>(first)->slot == var->slot) {
+        // s <- s ~ x
+        Value a = evaluate(first);
+        return append(var, std::move(a), evaluate(r->rhs()));
+      }
+    }
+    Value b = evaluate(rhs);
+    if (op == Operator::concat) return append(var, load(var), b);
+    if (op != Operator::assign) b = apply(op, load(var), b);
+    store(var) = b;
+    return b;
+  }
+  Value Interpreter::append(const Variable* var, Value a, const Value& b) {
+    String sa, sb;
+    if (!a.toString(sa) || !b.toString(sb))
+      fail(RuntimeErrorCode::typeMismatch);
+    a = Value();
+    // Drop the variable's own reference so that it can grow in place.
+    Value& slot = store(var);
+    if (slot.isString() && std::get<String>(slot.v).sameRep(sa))
+      slot = Value();
+    slot = Value(String::concat(std::move(sa), sb));
+    return slot;
+  }
+  Value Interpreter::evaluateBinary(const BinaryOp* ex) {
+    Operator o = ex->o;
+    switch (o) {
+      case Operator::comma: return evaluateList(ex);
+      case Operator::andStmt:
+        return Value((int64_t) (evaluate(ex->lhs()).truthy() &&
+          evaluate(ex->rhs()).truthy()));
+      case Operator::orStmt:
+        return Value((int64_t) (evaluate(ex->lhs()).truthy() ||
+          evaluate(ex->rhs()).truthy()));
+      case Operator::questionMark: {
+        bool cond = evaluate(ex->lhs()).truthy();
+        const Expression* r = ex->rhs();
+        if (r->id() == 2) {
+          const BinaryOp* sel = static_cast<const BinaryOp*>(r);
+          if (sel->o == Operator::colon)
+            return evaluate(cond ? sel->lhs() : sel->rhs());
+        }
+        return cond ? evaluate(r) : Value();
+      }
+      case Operator::colon: fail(RuntimeErrorCode::typeMismatch);
+      default: break;
+    }
+    if (isAssignment(o)) return evaluateAssign(ex);
+    Value a = evaluate(ex->lhs());
+    return apply(o, std::move(a), evaluate(ex->rhs()));
+  }
+  Value Interpreter::apply(Operator o, Value a, const Value& b) {
+    switch (o) {
+      case Operator::xorStmt:
+        return Value((int64_t) (a.truthy() != b.truthy()));
+      case Operator::concat: {
+        String sa, sb;
+        if (!a.toString(sa) || !b.toString(sb))
+          fail(RuntimeErrorCode::typeMismatch);
+        a = Value();
+        return Value(String::concat(std::move(sa), sb));
+      }
+      case Operator::equal:
+        return Value((int64_t) valuesEqual(a, b));
+      case Operator::notEqual:
+        return Value((int64_t) !valuesEqual(a, b));
+      case Operator::less:
+      case Operator::greater:
+      case Operator::lessEqual:
+      case Operator::greaterEqual: {
+        int cmp;
+        if (a.isInt() && b.isInt()) {
+          int64_t x = std::get<int64_t>(a.v), y = std::get<int64_t>(b.v);
+          cmp = (x > y) - (x < y);
+        } else if (a.isInteger() && b.isInteger()) {
+          cmp = a.toBigInt().compare(b.toBigInt());
+        } else if (a.isString() && b.isString()) {
+          cmp = std::get<String>(a.v).compare(std::get<String>(b.v));
+        } else {
+          fail(RuntimeErrorCode::typeMismatch);
+        }
+        bool res =
+          o == Operator::less ? cmp < 0 :
+          o == Operator::greater ? cmp > 0 :
+          o == Operator::lessEqual ? cmp <= 0 : cmp >= 0;
+        return Value((int64_t) res);
+      }
+      default: break;
+    }
+    if (a.isInt() && b.isInt()) {
+      // Fast path: checked 64-bit arithmetic, promoting on overflow.
+      int64_t x = std::get<int64_t>(a.v), y = std::get<int64_t>(b.v);
+      int64_t r = 0;
+      bool overflow = false;
+      switch (o) {
+        case Operator::plus:
+          overflow = __builtin_add_overflow(x, y, &r);
+          break;
+        case Operator::minus:
+          overflow = __builtin_sub_overflow(x, y, &r);
+          break;
+        case Operator::times:
+          overflow = __builtin_mul_overflow(x, y, &r);
+          break;
+        case Operator::divide:
+        case Operator::modulo:
+          if (y == 0) fail(RuntimeErrorCode::divisionByZero);
+          if (x == INT64_MIN && y == -1) {
+            overflow = o == Operator::divide;
+          } else {
+            r = o == Operator::divide ? x / y : x % y;
+          }
+          break;
+        default: fail(RuntimeErrorCode::typeMismatch);
+      }
+      if (!overflow) return Value(r);
+    }
+    if (!a.isInteger() || !b.isInteger())
+      fail(RuntimeErrorCode::typeMismatch);
+    return applyBig(o, a.toBigInt(), b.toBigInt());
+  }
+  Value Interpreter::applyBig(Operator o, const BigInt& x, const BigInt& y) {
+    switch (o) {
+      case Operator::plus: return Value(x + y);
+      case Operator::minus: return Value(x - y);
+      case Operator::times: return Value(x * y);
+      case Operator::divide:
+      case Operator::modulo: {
+        if (y.isZero()) fail(RuntimeErrorCode::divisionByZero);
+        BigInt q, r;
+        x.divMod(y, q, r);
+        return Value(std::move(o == Operator::divide ? q : r));
+      }
+      default: fail(RuntimeErrorCode::typeMismatch);
+    }
+  }
+  Value Interpreter::evaluateUnary(const UnaryOp* ex) {
+    Value a = evaluate(ex->a.get());
+    switch (ex->o) {
+      case Operator::notStmt: return Value((int64_t) !a.truthy());
+      case Operator::minus: {
+        int64_t r;
+        if (a.isInt() &&
+            !__builtin_sub_overflow((int64_t) 0, std::get<int64_t>(a.v), &r))
+          return Value(r);
+        if (!a.isInteger()) fail(RuntimeErrorCode::typeMismatch);
+        return Value(-a.toBigInt());
+      }
+      case Operator::length:
+        if (a.isString())
+          return Value((int64_t) std::get<String>(a.v).size());
+        if (a.isList())
+          return Value((int64_t) std::get<ListPtr>(a.v)->size());
+        fail(RuntimeErrorCode::typeMismatch);
+      default: fail(RuntimeErrorCode::typeMismatch);
+    }
+  }
+}
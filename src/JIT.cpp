@@ -0,0 +1,455 @@
+#include "JIT.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define X666_JIT_SUPPORTED
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <unordered_map>
+#endif
+
+namespace x666 {
+#ifdef X666_JIT_SUPPORTED
+  namespace {
+    // Condition codes, as used by jcc and setcc
+    enum Cond : uint8_t {
+      overflow = 0x0, equal = 0x4, notEqual = 0x5, sign = 0x8,
+      less = 0xC, greaterEqual = 0xD, lessEqual = 0xE, greater = 0xF,
+    };
+    /**
+     * Just enough of an x86-64 assembler for LoopCompiler.
+     * Values are computed in rax, with rcx and rdx as scratch;
+     * rbx holds the address of the variable array.
+     */
+    class Assembler {
+    public:
+      std::vector<uint8_t> code;
+      size_t here() const { return code.size(); }
+      void emit(std::initializer_list<uint8_t> bytes) {
+        code.insert(code.end(), bytes);
+      }
+      void imm32(int32_t n) {
+        uint8_t b[4];
+        memcpy(b, &n, 4);
+        code.insert(code.end(), b, b + 4);
+      }
+      void imm64(int64_t n) {
+        uint8_t b[8];
+        memcpy(b, &n, 8);
+        code.insert(code.end(), b, b + 8);
+      }
+      // Emit a jump with a placeholder target; returns the fixup.
+      size_t jcc(Cond c) {
+        emit({0x0F, (uint8_t) (0x80 | c)});
+        imm32(0);
+        return here() - 4;
+      }
+      size_t jmp() {
+        emit({0xE9});
+        imm32(0);
+        return here() - 4;
+      }
+      void bind(size_t fixup, size_t target) {
+        int32_t rel = (int32_t) (target - (fixup + 4));
+        memcpy(&code[fixup], &rel, 4);
+      }
+      void movRaxImm(int64_t n) { emit({0x48, 0xB8}); imm64(n); }
+      // mov rcx, p; inc qword [rcx]
+      void increment(uint64_t* p) {
+        emit({0x48, 0xB9});
+        imm64((int64_t) (uintptr_t) p);
+        emit({0x48, 0xFF, 0x01});
+      }
+      void movEaxImm(uint32_t n) { emit({0xB8}); imm32((int32_t) n); }
+      // mov reg, [rbx + disp] / mov [rbx + disp], rax
+      void loadRax(int32_t disp) { emit({0x48, 0x8B, 0x83}); imm32(disp); }
+      void loadRcx(int32_t disp) { emit({0x48, 0x8B, 0x8B}); imm32(disp); }
+      void loadRdx(int32_t disp) { emit({0x48, 0x8B, 0x93}); imm32(disp); }
+      void storeRax(int32_t disp) { emit({0x48, 0x89, 0x83}); imm32(disp); }
+      void pushRax() { emit({0x50}); }
+      void popRcx() { emit({0x59}); }
+      void testRax() { emit({0x48, 0x85, 0xC0}); }
+      void testRcx() { emit({0x48, 0x85, 0xC9}); }
+      void testRdx() { emit({0x48, 0x85, 0xD2}); }
+      void cmpRaxRcx() { emit({0x48, 0x39, 0xC8}); }
+      // setcc al; movzx eax, al
+      void setRax(Cond c) {
+        emit({0x0F, (uint8_t) (0x90 | c), 0xC0, 0x0F, 0xB6, 0xC0});
+      }
+      // setne cl; movzx ecx, cl
+      void truthyRcx() { emit({0x0F, 0x95, 0xC1, 0x0F, 0xB6, 0xC9}); }
+    };
+    class LoopCompiler {
+    public:
+      LoopCompiler(
+        const std::vector<Statement>& statements,
+        const std::vector<size_t>& jumps, size_t header, size_t end,
+        uint64_t* counts) :
+        statements(statements), jumps(jumps), header(header), end(end),
+        counts(counts) {}
+      std::unique_ptr<NativeLoop> compile();
+    private:
+      int32_t disp(size_t slot);
+      void deopt(Cond c) { deopts.push_back({a.jcc(c), deoptPc}); }
+      // The code from here on is statement i's
+      void mark(size_t i) {
+        marks.push_back({(uint32_t) a.here(), (uint32_t) i});
+      }
+      // Count a run of statement i, once nothing can deopt back to it.
+      // Clobbers rcx and the flags.
+      void count(size_t i) {
+        if (counts != nullptr) a.increment(&counts[i]);
+      }
+      bool binary(Operator o);
+      bool expr(const Expression* ex);
+      bool statement(const Expression* ex);
+      bool range(size_t i, size_t stop);
+      bool ifChain(size_t& i);
+      bool latch(size_t bodyTop);
+      const std::vector<Statement>& statements;
+      const std::vector<size_t>& jumps;
+      size_t header, end;
+      uint64_t* counts;
+      Assembler a;
+      std::vector<size_t> slots;
+      std::unordered_map<size_t, size_t> slotIndex;
+      std::vector<std::pair<size_t, size_t>> deopts;
+      std::vector<std::pair<uint32_t, uint32_t>> marks;
+      size_t deoptPc = 0;
+    };
+    // Array layout: limit, step, then each slot used by the loop.
+    int32_t LoopCompiler::disp(size_t slot) {
+      auto it = slotIndex.find(slot);
+      if (it == slotIndex.end()) {
+        it = slotIndex.emplace(slot, slots.size()).first;
+        slots.push_back(slot);
+      }
+      return (int32_t) (8 * (2 + it->second));
+    }
+    // rax <- rax o rcx
+    bool LoopCompiler::binary(Operator o) {
+      switch (o) {
+        case Operator::plus:
+          a.emit({0x48, 0x01, 0xC8});
+          deopt(Cond::overflow);
+          return true;
+        case Operator::minus:
+          a.emit({0x48, 0x29, 0xC8});
+          deopt(Cond::overflow);
+          return true;
+        case Operator::times:
+          a.emit({0x48, 0x0F, 0xAF, 0xC1});
+          deopt(Cond::overflow);
+          return true;
+        case Operator::divide:
+        case Operator::modulo: {
+          a.testRcx();
+          deopt(Cond::equal);
+          // INT64_MIN / -1 overflows; leave it to the interpreter.
+          a.emit({0x48, 0x83, 0xF9, 0xFF});
+          size_t ok = a.jcc(Cond::notEqual);
+          a.emit({0x48, 0xBA});
+          a.imm64(INT64_MIN);
+          a.emit({0x48, 0x39, 0xD0});
+          deopt(Cond::equal);
+          a.bind(ok, a.here());
+          a.emit({0x48, 0x99, 0x48, 0xF7, 0xF9}); // cqo; idiv rcx
+          if (o == Operator::modulo) a.emit({0x48, 0x89, 0xD0});
+          return true;
+        }
+        case Operator::equal: a.cmpRaxRcx(); a.setRax(Cond::equal); return true;
+        case Operator::notEqual:
+          a.cmpRaxRcx();
+          a.setRax(Cond::notEqual);
+          return true;
+        case Operator::less: a.cmpRaxRcx(); a.setRax(Cond::less); return true;
+        case Operator::greater:
+          a.cmpRaxRcx();
+          a.setRax(Cond::greater);
+          return true;
+        case Operator::lessEqual:
+          a.cmpRaxRcx();
+          a.setRax(Cond::lessEqual);
+          return true;
+        case Operator::greaterEqual:
+          a.cmpRaxRcx();
+          a.setRax(Cond::greaterEqual);
+          return true;
+        case Operator::andStmt:
+        case Operator::orStmt:
+        case Operator::xorStmt:
+          // Both sides are pure, so evaluating them eagerly is fine.
+          a.testRax();
+          a.setRax(Cond::notEqual);
+          a.testRcx();
+          a.truthyRcx();
+          a.emit({0x48,
+            (uint8_t) (o == Operator::andStmt ? 0x21 :
+              o == Operator::orStmt ? 0x09 : 0x31),
+            0xC8});
+          return true;
+        default: return false;
+      }
+    }
+    // Compile a pure integer expression into rax.
+    bool LoopCompiler::expr(const Expression* ex) {
+      switch (ex->id()) {
+        case 1: {
+          const Literal* l = static_cast<const Literal*>(ex);
+          if (!std::holds_alternative<IntLiteral>(l->val)) return false;
+          a.movRaxImm(std::get<IntLiteral>(l->val).n);
+          return true;
+        }
+        case 2: {
+          const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+          if (b->o == Operator::questionMark) {
+            const Expression* t = b->rhs();
+            const Expression* e = nullptr;
+            if (t->id() == 2 &&
+                static_cast<const BinaryOp*>(t)->o == Operator::colon) {
+              e = static_cast<const BinaryOp*>(t)->rhs();
+              t = static_cast<const BinaryOp*>(t)->lhs();
+            }
+            if (!expr(b->lhs())) return false;
+            a.testRax();
+            size_t skip = a.jcc(Cond::equal);
+            if (!expr(t)) return false;
+            size_t done = a.jmp();
+            a.bind(skip, a.here());
+            if (e != nullptr) {
+              if (!expr(e)) return false;
+            } else {
+              a.movRaxImm(0);
+            }
+            a.bind(done, a.here());
+            return true;
+          }
+          if (!expr(b->rhs())) return false;
+          a.pushRax();
+          if (!expr(b->lhs())) return false;
+          a.popRcx();
+          return binary(b->o);
+        }
+        case 3: {
+          const UnaryOp* u = static_cast<const UnaryOp*>(ex);
+          if (!expr(u->a.get())) return false;
+          if (u->o == Operator::minus) {
+            a.emit({0x48, 0xF7, 0xD8}); // neg rax
+            deopt(Cond::overflow);
+            return true;
+          } else if (u->o == Operator::notStmt) {
+            a.testRax();
+            a.setRax(Cond::equal);
+            return true;
+          }
+          return false;
+        }
+        case 4: {
+          const Bracket* b = static_cast<const Bracket*>(ex);
+          if (b->bracket != Operator::leftBracket || b->ex == nullptr)
+            return false;
+          return expr(b->ex.get());
+        }
+        case 6:
+          a.loadRax(disp(static_cast<const Variable*>(ex)->slot));
+          return true;
+      }
+      return false;
+    }
+    // An expression statement: at most one assignment, at the top.
+    bool LoopCompiler::statement(const Expression* ex) {
+      if (ex->id() == 2) {
+        const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+        if (isAssignment(b->o)) {
+          if (b->lhs()->id() != 6) return false;
+          int32_t target = disp(static_cast<const Variable*>(b->lhs())->slot);
+          if (!expr(b->rhs())) return false;
+          Operator op = assignedOperator(b->o);
+          if (op != Operator::assign) {
+            a.pushRax();
+            a.loadRax(target);
+            a.popRcx();
+            if (!binary(op)) return false;
+          }
+          a.storeRax(target);
+          return true;
+        }
+      }
+      return expr(ex);
+    }
+    bool LoopCompiler::ifChain(size_t& i) {
+      std::vector<size_t> toEnd;
+      size_t k = i, next = std::string::npos;
+      while (statements[k].statementOp != Operator::endStmt) {
+        const Statement& st = statements[k];
+        next = std::string::npos;
+        if (st.statementOp != Operator::elseStmt) {
+          // Conditions are pure, so the whole chain can be retried.
+          mark(k);
+          deoptPc = i;
+          if (!expr(st.ex.get())) return false;
+          a.testRax();
+          next = a.jcc(Cond::equal);
+        }
+        // The interpreter counts the ?? as the chain is decided, then
+        // the ?&, !! or &> that the body runs into.
+        count(i);
+        if (!range(k + 1, jumps[k])) return false;
+        count(jumps[k]);
+        toEnd.push_back(a.jmp());
+        if (next != std::string::npos) a.bind(next, a.here());
+        k = jumps[k];
+      }
+      // No clause was taken
+      if (next != std::string::npos) count(i);
+      for (size_t f : toEnd) a.bind(f, a.here());
+      i = k + 1;
+      return true;
+    }
+    bool LoopCompiler::range(size_t i, size_t stop) {
+      while (i < stop) {
+        const Statement& st = statements[i];
+        switch (st.statementOp) {
+          case Operator::plus:
+            mark(i);
+            deoptPc = i;
+            if (st.ex != nullptr && !statement(st.ex.get())) return false;
+            count(i);
+            ++i;
+            break;
+          case Operator::ifStmt:
+            if (!ifChain(i)) return false;
+            break;
+          default: return false;
+        }
+      }
+      return true;
+    }
+    bool LoopCompiler::latch(size_t bodyTop) {
+      const Statement& head = statements[header];
+      auto backTo = [&](Cond c) { a.bind(a.jcc(c), bodyTop); };
+      switch (head.statementOp) {
+        case Operator::whileStmt:
+          mark(end);
+          count(end);
+          mark(header);
+          deoptPc = header;
+          if (!expr(head.ex.get())) return false;
+          count(header);
+          a.testRax();
+          backTo(Cond::notEqual);
+          return true;
+        case Operator::repeatStmt:
+          mark(end);
+          deoptPc = end;
+          if (!expr(head.ex.get())) return false;
+          count(end);
+          a.testRax();
+          backTo(Cond::equal);
+          return true;
+        case Operator::forStmt: {
+          const Expression* v = head.ex.get();
+          while (v->id() == 2 &&
+              static_cast<const BinaryOp*>(v)->o == Operator::comma)
+            v = static_cast<const BinaryOp*>(v)->lhs();
+          if (v->id() != 6) return false;
+          int32_t var = disp(static_cast<const Variable*>(v)->slot);
+          mark(end);
+          deoptPc = end;
+          a.loadRax(var);
+          a.loadRcx(8);
+          a.emit({0x48, 0x01, 0xC8});
+          deopt(Cond::overflow);
+          a.storeRax(var);
+          count(end);
+          a.loadRcx(0);
+          a.loadRdx(8);
+          a.testRdx();
+          size_t down = a.jcc(Cond::sign);
+          a.cmpRaxRcx();
+          backTo(Cond::lessEqual);
+          size_t out = a.jmp();
+          a.bind(down, a.here());
+          a.cmpRaxRcx();
+          backTo(Cond::greaterEqual);
+          a.bind(out, a.here());
+          return true;
+        }
+        default: return false;
+      }
+    }
+    std::unique_ptr<NativeLoop> LoopCompiler::compile() {
+      if (end >= UINT32_MAX) return nullptr;
+      mark(end);
+      // push rbx; push rbp; mov rbp, rsp; mov rbx, rdi
+      a.emit({0x53, 0x55, 0x48, 0x89, 0xE5, 0x48, 0x89, 0xFB});
+      size_t toLatch = a.jmp();
+      size_t bodyTop = a.here();
+      if (!range(header + 1, end)) return nullptr;
+      a.bind(toLatch, a.here());
+      if (!latch(bodyTop)) return nullptr;
+      a.movEaxImm(end + 1);
+      std::vector<size_t> toEpilogue{a.jmp()};
+      std::unordered_map<size_t, size_t> stubs;
+      for (auto [fixup, pc] : deopts) {
+        auto it = stubs.find(pc);
+        if (it == stubs.end()) {
+          mark(pc);
+          it = stubs.emplace(pc, a.here()).first;
+          a.movEaxImm(pc);
+          toEpilogue.push_back(a.jmp());
+        }
+        a.bind(fixup, it->second);
+      }
+      for (size_t f : toEpilogue) a.bind(f, a.here());
+      mark(end);
+      // A deopt can leave temporaries on the stack.
+      // mov rsp, rbp; pop rbp; pop rbx; ret
+      a.emit({0x48, 0x89, 0xEC, 0x5D, 0x5B, 0xC3});
+      size_t page = sysconf(_SC_PAGESIZE);
+      size_t size = (a.code.size() + page - 1) / page * page;
+      void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED) return nullptr;
+      memcpy(mem, a.code.data(), a.code.size());
+      if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return nullptr;
+      }
+      return std::make_unique<NativeLoop>(
+        mem, size, std::move(slots), std::move(marks));
+    }
+  }
+  NativeLoop::~NativeLoop() {
+    munmap(code, size);
+  }
+  size_t NativeLoop::run(int64_t* vars) const {
+    return ((uint64_t (*)(int64_t*)) code)(vars);
+  }
+  size_t NativeLoop::statementAt(const void* address) const {
+    uintptr_t at = (uintptr_t) address, base = (uintptr_t) code;
+    if (at < base || at - base >= size) return SIZE_MAX;
+    std::pair<uint32_t, uint32_t> key((uint32_t) (at - base), UINT32_MAX);
+    auto it = std::upper_bound(marks.begin(), marks.end(), key);
+    return it == marks.begin() ? SIZE_MAX : (it - 1)->second;
+  }
+  std::unique_ptr<NativeLoop> compileLoop(
+      const std::vector<Statement>& statements,
+      const std::vector<size_t>& jumps, size_t header, size_t end,
+      uint64_t* counts) {
+    return LoopCompiler(statements, jumps, header, end, counts).compile();
+  }
+#else
+  NativeLoop::~NativeLoop() {}
+  size_t NativeLoop::run(int64_t*) const { return 0; }
+  size_t NativeLoop::statementAt(const void*) const { return SIZE_MAX; }
+  std::unique_ptr<NativeLoop> compileLoop(
+      const std::vector<Statement>&, const std::vector<size_t>&,
+      size_t, size_t, uint64_t*) {
+    return nullptr;
+  }
+#endif
+}
@@ -4,6 +4,10 @@
 
 #include <iostream>
 #include <limits>
+#include <sstream>
+
+#include "Module.h"
+#include "Unicode.h"
 
 namespace x666 {
   const char* lexErrorMessages[] = {
@@ -16,6 +20,12 @@ namespace x666 {
     "Mismatched brackets",
     "This statement needs an expression after it",
     "This statement doesn't take an expression but got one",
+    "Variable is read but never assigned",
+    "Invalid UTF-8",
+    "#< needs the name of a file in quotes",
+    "Can't read the included file",
+    "File includes itself",
+    "Nested too deeply",
   };
   const char* opsAsStrings[] = {
     "(", ")", "[", "]",
@@ -24,19 +34,49 @@ namespace x666 {
     "/=", "<=", ">=", "??", "?&",
     "!!", "&>", "?", ":", "@", "@@",
     "@#", "!", "&", "|", "|*", "#", ",",
-    "#>"
+    "#>", "+<-", "-<-", "*<-", "/<-", "%<-", "~<-", "#<",
+    "{...}",
   };
+  bool isAssignment(Operator o) {
+    return o == Operator::assign ||
+      (o >= Operator::plusAssign && o <= Operator::concatAssign);
+  }
+  Operator assignedOperator(Operator o) {
+    switch (o) {
+      case Operator::plusAssign: return Operator::plus;
+      case Operator::minusAssign: return Operator::minus;
+      case Operator::timesAssign: return Operator::times;
+      case Operator::divideAssign: return Operator::divide;
+      case Operator::moduloAssign: return Operator::modulo;
+      case Operator::concatAssign: return Operator::concat;
+      default: return Operator::assign;
+    }
+  }
   static int getChar(std::istream& fh, LineInfo& li) {
     int c = fh.get();
     if (c == '\n') {
       ++li.line;
       li.col = 0;
-    } else {
+    } else if ((c & 0xC0) != 0x80) { // Not a UTF-8 continuation byte
       ++li.col;
     }
     ++li.byte;
     return c;
   }
+  // After a binary operator, check for a following <- that makes it
+  // a compound assignment, and consume it if so.
+  static bool acceptAssignSuffix(std::istream& fh, LineInfo& li) {
+    if (fh.peek() != '<') return false;
+    getChar(fh, li);
+    if (fh.peek() == '-') {
+      getChar(fh, li);
+      return true;
+    }
+    fh.unget();
+    --li.col;
+    --li.byte;
+    return false;
+  }
   int getDigit(char c) {
     char cap = toupper(c);
     return isdigit(c) ? (c - '0') :
@@ -60,6 +100,21 @@ namespace x666 {
     return false;
 #endif
   }
+  // Continue lexing an integer literal that no longer fits in 64 bits.
+  // n holds the digits read so far; the next digit has only been peeked.
+  BigInt parseBigInt(std::istream& fh, LineInfo& li, int64_t n, size_t base) {
+    bool negative = n < 0;
+    BigInt big = negative ? -BigInt(n) : BigInt(n);
+    while (true) {
+      int c = fh.peek();
+      if (c == std::char_traits<char>::eof()) break;
+      int digit = getDigit(c);
+      if (digit < 0 || (size_t) digit >= base) break;
+      big.mulAdd(base, digit);
+      getChar(fh, li);
+    }
+    return negative ? -big : big;
+  }
   std::string parseStringLiteral(std::istream& fh, LineInfo& li) {
     std::string s;
     while (true) {
@@ -73,6 +128,7 @@ namespace x666 {
           case 'n': s += '\n'; break;
           case '\\': s += '\\'; break;
           case '\x22': s += '\x22'; break;
+          case std::char_traits<char>::eof(): break;
           default: s += c;
         }
       } else {
@@ -91,7 +147,46 @@ namespace x666 {
     }
     return res;
   }
-  Token getNextToken(std::istream& fh, LineInfo& li) {
+  // Read the rest of the UTF-8 sequence that starts with lead, adding
+  // its bytes to out and decoding it into cp. Returns false if it isn't
+  // well-formed.
+  static bool readCodePoint(
+      std::istream& fh, LineInfo& li, int lead, std::string& out,
+      uint32_t& cp) {
+    char bytes[4] = {(char) lead};
+    size_t length = sequenceLength(lead);
+    // A stray continuation byte takes those after it with it.
+    size_t n = 1;
+    while (n < (length == 0 ? 4 : length) && (fh.peek() & 0xC0) == 0x80)
+      bytes[n++] = (char) getChar(fh, li);
+    out.append(bytes, n);
+    return decodeUtf8(bytes, n, cp) == n;
+  }
+  // Lex an identifier that starts with the byte c: ASCII letters, and
+  // other letters and combining marks in UTF-8.
+  static Token lexIdentifier(std::istream& fh, LineInfo& li, int c) {
+    const int eof = std::char_traits<char>::eof();
+    std::string name;
+    while (true) {
+      if (c < 0x80) {
+        name += (char) c;
+      } else {
+        size_t start = li.byte - 1;
+        uint32_t cp;
+        if (!readCodePoint(fh, li, c, name, cp))
+          return LexError(LexErrorCode::invalidUtf8, li);
+        if (!isLetter(cp)) {
+          li.sot = start;
+          return LexError(LexErrorCode::unknownOperator, li);
+        }
+      }
+      c = fh.peek();
+      if (c == eof || (c < 0x80 && !isalpha(c))) break;
+      getChar(fh, li);
+    }
+    return Identifier(std::move(name));
+  }
+  static Token lexToken(std::istream& fh, LineInfo& li) {
     int c;
     do {
       c = getChar(fh, li);
@@ -99,10 +194,13 @@ namespace x666 {
       if (c == '#') {
         if (fh.peek() == '#') {
           // Comment syntax (tentative)
+          // Count the bytes skipped rather than asking tellg(), which
+          // fails on pipes. ignore() looks for the newline a buffer at
+          // a time.
           fh.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+          li.byte += fh.gcount();
           li.col = 0;
           ++li.line;
-          li.byte = fh.tellg();
           li.sot = li.byte;
           return Newline();
         }
@@ -117,7 +215,8 @@ namespace x666 {
         getChar(fh, li);
         negative = true;
       } else {
-        return Operator::minus;
+        return acceptAssignSuffix(fh, li) ?
+          Operator::minusAssign : Operator::minus;
       }
     }
     if (isdigit(c)) {
@@ -151,29 +250,29 @@ namespace x666 {
         }
         if (negative) digit = -digit;
         if (wouldMAddOverflow(base, n, digit)) {
-          return LexError(LexErrorCode::integerOverflow, li);
+          return BigIntLiteral(parseBigInt(fh, li, n, base));
         }
         n = base * n + digit;
         getChar(fh, li);
       }
       return IntLiteral(n);
-    } else if (isalpha(c)) {
-      // This starts an identifier.
-      Identifier id((char) c);
-      while (true) {
-        c = fh.peek();
-        if (c == std::char_traits<char>::eof()) break;
-        if (!isalpha(c)) break;
-        id.name += (char) c;
-        getChar(fh, li);
-      }
-      return id;
+    } else if (isalpha(c) || c >= 0x80) {
+      // This starts an identifier, or is a character that can't.
+      return lexIdentifier(fh, li, c);
     } else {
       switch (c) {
-        case '+': return Operator::plus;
-        case '*': return Operator::times;
-        case '%': return Operator::modulo;
-        case '~': return Operator::concat;
+        case '+':
+          return acceptAssignSuffix(fh, li) ?
+            Operator::plusAssign : Operator::plus;
+        case '*':
+          return acceptAssignSuffix(fh, li) ?
+            Operator::timesAssign : Operator::times;
+        case '%':
+          return acceptAssignSuffix(fh, li) ?
+            Operator::moduloAssign : Operator::modulo;
+        case '~':
+          return acceptAssignSuffix(fh, li) ?
+            Operator::concatAssign : Operator::concat;
         case '(': return Operator::leftBracket;
         case ')': return Operator::rightBracket;
         case '[': return Operator::leftSBracket;
@@ -186,6 +285,9 @@ namespace x666 {
           if (c == '>') {
             getChar(fh, li);
             return Operator::print;
+          } else if (c == '<') {
+            getChar(fh, li);
+            return Operator::include;
           }
           return Operator::length;
         }
@@ -194,7 +296,8 @@ namespace x666 {
             getChar(fh, li);
             return Operator::notEqual;
           }
-          return Operator::divide;
+          return acceptAssignSuffix(fh, li) ?
+            Operator::divideAssign : Operator::divide;
         }
         case '<': {
           int c = fh.peek();
@@ -261,15 +364,125 @@ namespace x666 {
           }
           return Operator::notStmt;
         }
-        case '\x22': return StringLiteral(parseStringLiteral(fh, li));
+        case '\x22': {
+          std::string s = parseStringLiteral(fh, li);
+          if (!isValidUtf8(s.data(), s.size()))
+            return LexError(LexErrorCode::invalidUtf8, li);
+          return StringLiteral(std::move(s));
+        }
       }
     }
     return LexError(LexErrorCode::unknownOperator, li);
   }
+  Token getNextToken(std::istream& fh, LineInfo& li) {
+    Token t = lexToken(fh, li);
+    X666_PROBE2(token, t.index(), li.sot);
+    return t;
+  }
+  bool skipBlockBody(
+      std::istream& fh, LineInfo& li, std::unordered_set<std::string>& stores) {
+    const int eof = std::char_traits<char>::eof();
+    size_t depth = 0;
+    bool any = false;
+    bool start = true; // Nothing but spaces since the last statement
+    bool forVariable = false; // The next identifier follows an @#
+    // The last identifier, if only spaces have come after it
+    std::string name;
+    bool inName = false;
+    while (fh.peek() != eof) {
+      int c = getChar(fh, li);
+      // Non-ASCII bytes are taken as letters here.
+      if (inName && !isalpha(c) && c < 0x80) {
+        inName = false;
+        if (forVariable) stores.insert(name);
+        forVariable = false;
+      }
+      if (c == '#' && fh.peek() == '#') {
+        while (fh.peek() != eof && getChar(fh, li) != '\n') {}
+        c = '\n';
+      }
+      if (c == '\n' || c == ';') {
+        start = true;
+        name.clear();
+        continue;
+      }
+      if (iswspace(c)) continue;
+      int next = fh.peek();
+      if (start) {
+        start = false;
+        any = true;
+        if ((c == '&' && next == '>') || (c == '?' && next == '&') ||
+            (c == '!' && next == '!')) {
+          if (depth == 0) {
+            fh.unget();
+            --li.col;
+            --li.byte;
+            return true;
+          }
+          if (c == '&') --depth;
+          getChar(fh, li);
+          continue;
+        }
+        if ((c == '?' && next == '?') || c == '@') {
+          ++depth;
+          if (c == '?' || next == '@') getChar(fh, li);
+          if (c == '@' && next == '#') {
+            getChar(fh, li);
+            forVariable = true;
+          }
+          continue;
+        }
+      }
+      if (isalpha(c) || c >= 0x80) {
+        if (!inName) name.clear();
+        name += (char) c;
+        inName = true;
+        continue;
+      }
+      forVariable = false;
+      if (c == '<' && next == '-' && !name.empty()) stores.insert(name);
+      name.clear();
+      if (c == '\x22') {
+        // A string runs to a closing quote or the end of the line, and
+        // a backslash escapes the character after it.
+        while (fh.peek() != eof) {
+          c = getChar(fh, li);
+          if (c == '\n' || c == '\x22') break;
+          if (c == '\\' && fh.peek() != eof) getChar(fh, li);
+        }
+      }
+    }
+    return any;
+  }
   void LexError::print(std::istream& fh) const {
-    std::cout << "Error at line " << (li.line + 1);
-    std::cout << " column " << (li.col + 1) << ": ";
-    std::cout << lexErrorMessages[(int) c] << "\n";
+    print(fh, std::cout);
+  }
+  void printFileOf(const LineInfo& li, std::ostream& out) {
+    const Module* m = includedFile(li.file);
+    if (m != nullptr) out << " in " << m->path;
+  }
+  void LexError::print(std::istream& fh, std::ostream& out) const {
+    out << "Error";
+    printFileOf(li, out);
+    out << " at line " << (li.line + 1);
+    out << " column " << (li.col + 1) << ": ";
+    out << lexErrorMessages[(int) c] << "\n";
+    if (!snippet.empty()) out << snippet;
+    else printSnippet(fh, li, out);
+  }
+  void printSnippet(std::istream& fh, const LineInfo& li) {
+    printSnippet(fh, li, std::cout);
+  }
+  void printSnippet(std::istream& fh, const LineInfo& li, std::ostream& out) {
+    const Module* m = includedFile(li.file);
+    if (m != nullptr) {
+      // From the included file rather than fh
+      std::istringstream included(m->source);
+      LineInfo at = li;
+      at.file = 0;
+      printSnippet(included, at, out);
+      return;
+    }
     fh.clear();
     size_t off = fh.tellg();
     size_t lineend = li.byte;
@@ -294,26 +507,34 @@ namespace x666 {
     }
     // We should now be at the start of the first line.
     ssize_t lengthOfSnakeSigned = li.byte - li.sot + 1;
+    if (lengthOfSnakeSigned > 0) {
+      // Columns count code points, so the underline does too.
+      std::string token(li.byte - li.sot, '\0');
+      fh.seekg(li.sot);
+      fh.read(&token[0], token.size());
+      fh.clear();
+      lengthOfSnakeSigned = countCodePoints(token.data(), fh.gcount()) + 1;
+    }
     fh.seekg(linestart);
     while (true) {
       std::string s;
       std::getline(fh, s);
-      std::cout << s << "\n";
+      out << s << "\n";
       if ((size_t) fh.tellg() >= lineend) break;
     }
     size_t lengthOfSnake = abs(lengthOfSnakeSigned);
     if (lengthOfSnakeSigned <= 0) {
       if (lengthOfSnake > li.col) lengthOfSnake = li.col;
-      std::cout << std::string(li.col - lengthOfSnake, ' ');
-      std::cout << std::string(lengthOfSnake, '~');
-      std::cout << "^\n";
+      out << std::string(li.col - lengthOfSnake, ' ');
+      out << std::string(lengthOfSnake, '~');
+      out << "^\n";
     } else {
       if (lengthOfSnake > li.col) lengthOfSnake = li.col;
-      std::cout << std::string(li.col - lengthOfSnake, ' ');
-      std::cout << "^";
+      out << std::string(li.col - lengthOfSnake, ' ');
+      out << "^";
       if (lengthOfSnake > 0)
-        std::cout << std::string(lengthOfSnake - 1, '~');
-      std::cout << "\n";
+        out << std::string(lengthOfSnake - 1, '~');
+      out << "\n";
     }
     fh.seekg(off);
   }
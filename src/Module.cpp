@@ -0,0 +1,592 @@
+#include "Module.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace x666 {
+  namespace {
+    struct Loaded {
+      ModuleHandle module;
+      // To notice the file changing under a long-running process
+      off_t size;
+      timespec mtime;
+      bool current(const struct stat& info) const {
+        return size == info.st_size &&
+          mtime.tv_sec == info.st_mtim.tv_sec &&
+          mtime.tv_nsec == info.st_mtim.tv_nsec;
+      }
+    };
+    // The modules of this process. The latest version of each file
+    // under each name is kept; older ones go once no program holds
+    // them, and their LineInfo::file numbers are used again.
+    struct Registry {
+      std::mutex mutex;
+      std::vector<std::weak_ptr<const Module>> modules; // By file - 1
+      std::vector<uint32_t> freeFiles;
+      // By real path, then the name it was included as
+      std::unordered_map<std::string, Loaded> byName;
+      // The latest module of each real path, under any name
+      std::unordered_map<std::string, Loaded> byPath;
+    };
+    std::string nameKey(
+        const std::string& canonical, const std::string& path) {
+      return canonical + '\0' + path;
+    }
+  }
+  static Registry& registry() {
+    // Never destroyed, since programs may outlive it at exit
+    static Registry* r = new Registry;
+    return *r;
+  }
+  const Module* includedFile(uint32_t file) {
+    if (file == 0) return nullptr;
+    Registry& r = registry();
+    ModuleHandle m; // Released after the lock, in case it's the last
+    {
+      std::lock_guard<std::mutex> lock(r.mutex);
+      if (file > r.modules.size()) return nullptr;
+      m = r.modules[file - 1].lock();
+    }
+    // Whoever has a LineInfo in the file holds the module.
+    return m.get();
+  }
+  // A new module with a file number of its own, which it gives back
+  // when it is freed. Call with r.mutex held.
+  static std::shared_ptr<Module> newModule(Registry& r) {
+    uint32_t file;
+    if (r.freeFiles.empty()) {
+      r.modules.emplace_back();
+      file = (uint32_t) r.modules.size();
+    } else {
+      file = r.freeFiles.back();
+      r.freeFiles.pop_back();
+    }
+    std::shared_ptr<Module> m(new Module, [](Module* m) {
+      Registry& r = registry();
+      {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.freeFiles.push_back(m->file);
+      }
+      delete m;
+    });
+    m->file = file;
+    r.modules[file - 1] = m;
+    return m;
+  }
+  // 64-bit FNV-1a
+  static uint64_t hashBytes(const char* begin, const char* end) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (const char* c = begin; c != end; ++c) {
+      h ^= (unsigned char) *c;
+      h *= 0x100000001b3;
+    }
+    return h;
+  }
+  static uint64_t hashBytes(const std::string& s) {
+    return hashBytes(s.data(), s.data() + s.size());
+  }
+  /*
+   * Module::encoded holds the number of statements, then each as its
+   * operator, LineInfo (without the file) and tree. A tree is written
+   * in preorder: each node as its id (0 for none), what it holds (an
+   * identifier's LineInfo too) and then its operands. Integers are varints (seven bits a byte, low
+   * first; IntLiterals zigzagged so that small negative ones stay
+   * short), strings their length and bytes.
+   *
+   * A file in the cache directory is a header of "x666mod2", the real
+   * path, the size and hash of the source and the hash of the rest,
+   * followed by that.
+   */
+  static const char cacheMagic[] = "x666mod2";
+  class Encoder {
+  public:
+    void u8(uint8_t n) { out += (char) n; }
+    void u64(uint64_t n) {
+      for (; n >= 0x80; n >>= 7) out += (char) (n | 0x80);
+      out += (char) n;
+    }
+    void str(const std::string& s) {
+      u64(s.size());
+      out += s;
+    }
+    void expression(const Expression* ex) {
+      if (ex == nullptr) {
+        u8(0);
+        return;
+      }
+      u8((uint8_t) ex->id());
+      switch (ex->id()) {
+        case 1: {
+          const Literal::LiteralValue& val =
+            static_cast<const Literal*>(ex)->val;
+          u8((uint8_t) val.index());
+          switch (val.index()) {
+            case 0: {
+              const Identifier& id = std::get<Identifier>(val);
+              str(id.name);
+              lineInfo(id.li);
+              break;
+            }
+            case 1: {
+              int64_t n = std::get<IntLiteral>(val).n;
+              u64(((uint64_t) n << 1) ^ (uint64_t) (n >> 63));
+              break;
+            }
+            case 2: str(std::get<StringLiteral>(val).str); break;
+            case 3: str(std::get<BigIntLiteral>(val).n.toString()); break;
+          }
+          break;
+        }
+        case 2: {
+          const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+          u8((uint8_t) b->o);
+          expression(b->a.get());
+          expression(b->b.get());
+          break;
+        }
+        case 3: {
+          const UnaryOp* u = static_cast<const UnaryOp*>(ex);
+          u8((uint8_t) u->o);
+          expression(u->a.get());
+          break;
+        }
+        case 4: {
+          const Bracket* b = static_cast<const Bracket*>(ex);
+          u8((uint8_t) b->bracket);
+          expression(b->ex.get());
+          break;
+        }
+        case 5: {
+          const Indexing* ix = static_cast<const Indexing*>(ex);
+          expression(ix->a.get());
+          expression(ix->b.get());
+          break;
+        }
+      }
+    }
+    void statements(const std::vector<Statement>& list) {
+      u64(list.size());
+      for (const Statement& st : list) {
+        u8((uint8_t) st.statementOp);
+        lineInfo(st.li);
+        expression(st.ex.get());
+      }
+    }
+    // Without the file, which the includer knows
+    void lineInfo(const LineInfo& li) {
+      u64(li.line);
+      u64(li.col);
+      u64(li.byte);
+      u64(li.sot);
+    }
+    std::string out;
+  };
+  // Reads what Encoder wrote, clearing ok at anything malformed.
+  class Decoder {
+  public:
+    Decoder(const char* begin, const char* end) : p(begin), end(end) {}
+    uint8_t u8() {
+      if (p == end) {
+        ok = false;
+        return 0;
+      }
+      return (uint8_t) *p++;
+    }
+    uint64_t u64() {
+      if (p != end && (*p & 0x80) == 0) return (uint8_t) *p++;
+      uint64_t n = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = u8();
+        n |= (uint64_t) (b & 0x7F) << shift;
+        if ((b & 0x80) == 0) return n;
+      }
+      ok = false;
+      return 0;
+    }
+    std::string str() {
+      uint64_t n = u64();
+      if (!ok || n > (uint64_t) (end - p)) {
+        ok = false;
+        return std::string();
+      }
+      std::string s(p, n);
+      p += n;
+      return s;
+    }
+    Operator op() {
+      uint8_t o = u8();
+      if (o > (uint8_t) Operator::block) ok = false;
+      return (Operator) o;
+    }
+    ExpressionPtr expression() {
+      if (!ok) return nullptr;
+      switch (u8()) {
+        case 0: return nullptr;
+        case 1: {
+          switch (u8()) {
+            case 0: {
+              Identifier id(str());
+              id.li = lineInfo();
+              return std::make_unique<Literal>(std::move(id));
+            }
+            case 1: {
+              uint64_t n = u64();
+              return std::make_unique<Literal>(
+                IntLiteral((int64_t) (n >> 1) ^ -(int64_t) (n & 1)));
+            }
+            case 2: return std::make_unique<Literal>(StringLiteral(str()));
+            case 3: return std::make_unique<Literal>(bigInt(str()));
+          }
+          break;
+        }
+        case 2: {
+          Operator o = op();
+          ExpressionPtr a = expression();
+          ExpressionPtr b = expression();
+          return std::make_unique<BinaryOp>(std::move(a), std::move(b), o);
+        }
+        case 3: {
+          Operator o = op();
+          return std::make_unique<UnaryOp>(expression(), o);
+        }
+        case 4: {
+          Operator o = op();
+          return std::make_unique<Bracket>(expression(), o);
+        }
+        case 5: {
+          ExpressionPtr a = expression();
+          ExpressionPtr b = expression();
+          return std::make_unique<Indexing>(std::move(a), std::move(b));
+        }
+      }
+      ok = false;
+      return nullptr;
+    }
+    // Statements of file, up to the end of the input
+    bool statements(uint32_t file, std::vector<Statement>& list) {
+      this->file = file;
+      uint64_t count = u64();
+      if (!ok || count > (uint64_t) (end - p)) return false;
+      list.reserve(count);
+      while (ok && list.size() < count) {
+        Statement st;
+        st.statementOp = op();
+        st.li = lineInfo();
+        st.ex = expression();
+        list.push_back(std::move(st));
+      }
+      return ok && p == end;
+    }
+    const char* position() const { return p; }
+    bool ok = true;
+  private:
+    LineInfo lineInfo() {
+      LineInfo li;
+      li.line = u64();
+      li.col = u64();
+      li.byte = u64();
+      li.sot = u64();
+      li.file = file;
+      return li;
+    }
+    BigIntLiteral bigInt(const std::string& s) {
+      BigInt n;
+      bool negative = !s.empty() && s[0] == '-';
+      for (size_t i = negative; i < s.size(); ++i) {
+        if (s[i] < '0' || s[i] > '9') ok = false;
+        n.mulAdd(10, s[i] - '0');
+      }
+      return BigIntLiteral(negative ? -n : n);
+    }
+    const char* p;
+    const char* end;
+    uint32_t file = 0;
+  };
+  // Read all of the file at path into data.
+  static bool readWhole(const std::string& path, std::string& data) {
+    std::ifstream fh(path, std::ios::binary);
+    if (!fh.is_open()) return false;
+    fh.seekg(0, std::ios::end);
+    std::streamoff size = fh.tellg();
+    if (size < 0) return false;
+    data.resize(size);
+    fh.seekg(0);
+    fh.read(&data[0], size);
+    return fh.gcount() == size;
+  }
+  static std::string cacheFile(
+      const std::string& directory, const std::string& canonical) {
+    char name[32];
+    snprintf(
+      name, sizeof(name), "/%016llx.x666m",
+      (unsigned long long) hashBytes(canonical));
+    return directory + name;
+  }
+  // Fill in m.encoded and statements from the cache, if it has this
+  // version of the source.
+  static bool readCache(
+      const std::string& directory, Module& m,
+      std::vector<Statement>& statements) {
+    std::string data;
+    if (!readWhole(cacheFile(directory, m.canonical), data)) return false;
+    const char* end = data.data() + data.size();
+    Decoder in(data.data(), end);
+    std::string magic(sizeof(cacheMagic) - 1, '\0');
+    for (char& c : magic) c = in.u8();
+    if (magic != cacheMagic || in.str() != m.canonical ||
+        in.u64() != m.source.size() || in.u64() != m.hash)
+      return false;
+    uint64_t hash = in.u64();
+    const char* body = in.position();
+    if (!in.ok || hash != hashBytes(body, end)) return false;
+    if (!in.statements(m.file, statements)) {
+      statements.clear();
+      return false;
+    }
+    m.encoded.assign(body, end);
+    return true;
+  }
+  // Write m to the cache. Another process may be reading or writing
+  // the same file, so it is replaced in one rename().
+  static void writeCache(const std::string& directory, const Module& m) {
+    Encoder header;
+    header.out = cacheMagic;
+    header.str(m.canonical);
+    header.u64(m.source.size());
+    header.u64(m.hash);
+    header.u64(hashBytes(m.encoded));
+    std::string path = cacheFile(directory, m.canonical);
+    std::string temporary = path + "." + std::to_string(getpid());
+    {
+      std::ofstream fh(temporary, std::ios::binary);
+      fh.write(header.out.data(), header.out.size());
+      fh.write(m.encoded.data(), m.encoded.size());
+      if (!fh.good()) {
+        fh.close();
+        unlink(temporary.c_str());
+        return;
+      }
+    }
+    if (rename(temporary.c_str(), path.c_str()) != 0)
+      unlink(temporary.c_str());
+  }
+  static void parse(Module& m, std::vector<Statement>& statements) {
+    std::istringstream fh(m.source);
+    Parser p(&fh);
+    p.li.file = m.file;
+    p.parse();
+    for (LexError& e : p.errorLog) {
+      // The module isn't registered yet, so render from here.
+      LineInfo at = e.li;
+      at.file = 0;
+      std::ostringstream snippet;
+      printSnippet(fh, at, snippet);
+      e.snippet = snippet.str();
+    }
+    m.errorLog = std::move(p.errorLog);
+    if (!m.errorLog.empty()) return;
+    Encoder out;
+    out.statements(p.statements);
+    m.encoded = std::move(out.out);
+    statements = std::move(p.statements);
+  }
+  // The module for the file named path, found at file, or nullptr if
+  // it can't be read. If this parses it, its statements are left in
+  // fresh.
+  static ModuleHandle loadModule(
+      const std::string& file, const std::string& path,
+      const std::string& cacheDirectory, std::vector<Statement>& fresh) {
+    char* real = realpath(file.c_str(), nullptr);
+    if (real == nullptr) return nullptr;
+    std::string canonical(real);
+    free(real);
+    struct stat info;
+    if (stat(canonical.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+      return nullptr;
+    Registry& r = registry();
+    std::string key = nameKey(canonical, path);
+    // Modules can only be freed with r.mutex released, so everything
+    // that may drop the last reference to one is declared first.
+    std::shared_ptr<Module> m;
+    std::vector<ModuleHandle> superseded;
+    bool copied = false;
+    {
+      std::lock_guard<std::mutex> lock(r.mutex);
+      auto it = r.byName.find(key);
+      if (it != r.byName.end() && it->second.current(info))
+        return it->second.module;
+      m = newModule(r);
+      // The same file under another name needs only its own LineInfos,
+      // which its includers decode, unless it has errors to attribute.
+      auto same = r.byPath.find(canonical);
+      if (same != r.byPath.end() && same->second.current(info) &&
+          same->second.module->errorLog.empty()) {
+        const Module& other = *same->second.module;
+        m->source = other.source;
+        m->hash = other.hash;
+        m->encoded = other.encoded;
+        copied = true;
+      }
+    }
+    m->path = path;
+    m->canonical = canonical;
+    if (!copied) {
+      // Other threads can include other files meanwhile.
+      if (!readWhole(canonical, m->source)) return nullptr;
+      m->hash = hashBytes(m->source);
+      if (cacheDirectory.empty() || !readCache(cacheDirectory, *m, fresh)) {
+        parse(*m, fresh);
+        if (!cacheDirectory.empty() && m->errorLog.empty())
+          writeCache(cacheDirectory, *m);
+      }
+    }
+    std::lock_guard<std::mutex> lock(r.mutex);
+    // Another thread may have loaded it first; then use theirs.
+    auto it = r.byName.find(key);
+    if (it != r.byName.end() && it->second.current(info)) {
+      fresh.clear();
+      return it->second.module;
+    }
+    if (it != r.byName.end()) superseded.push_back(it->second.module);
+    auto same = r.byPath.find(canonical);
+    if (same != r.byPath.end() && !same->second.current(info)) {
+      // The file changed, so drop the older version under every name.
+      for (auto n = r.byName.begin(); n != r.byName.end();) {
+        if (n->second.module->canonical == canonical) {
+          superseded.push_back(std::move(n->second.module));
+          n = r.byName.erase(n);
+        } else {
+          ++n;
+        }
+      }
+    }
+    if (same != r.byPath.end()) superseded.push_back(same->second.module);
+    Loaded loaded = {m, info.st_size, info.st_mtim};
+    r.byName[key] = loaded;
+    r.byPath[canonical] = loaded;
+    return m;
+  }
+  bool unchanged(const Module& m) {
+    struct stat info;
+    if (stat(m.canonical.c_str(), &info) != 0) return false;
+    {
+      Registry& r = registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      auto it = r.byName.find(nameKey(m.canonical, m.path));
+      if (it != r.byName.end() && it->second.module.get() == &m &&
+          it->second.current(info))
+        return true;
+    }
+    // Touched, or included again since: compare what it holds now.
+    std::string source;
+    return readWhole(m.canonical, source) && hashBytes(source) == m.hash;
+  }
+  static std::string directoryOf(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) return std::string();
+    return slash == 0 ? "/" : path.substr(0, slash);
+  }
+  Includes::Includes(
+      const std::string& includer, const std::string& cacheDirectory,
+      const std::string& workingDirectory) :
+      workingDirectory(workingDirectory), cacheDirectory(cacheDirectory) {
+    if (includer == "-") return;
+    directory = directoryOf(includer);
+    char* real = realpath(located(includer).c_str(), nullptr);
+    if (real != nullptr) {
+      canonical = real;
+      free(real);
+    }
+  }
+  std::string Includes::located(const std::string& path) const {
+    if (workingDirectory.empty() || (!path.empty() && path[0] == '/'))
+      return path;
+    return workingDirectory + "/" + path;
+  }
+  bool Includes::expand(
+      std::vector<Statement>& statements, std::vector<LexError>& errorLog) {
+    bool any = std::any_of(
+      statements.begin(), statements.end(),
+      [](const Statement& st) {
+        return st.statementOp == Operator::include;
+      });
+    if (!any) return true;
+    size_t oldErrors = errorLog.size();
+    std::vector<Statement> out;
+    out.reserve(statements.size());
+    for (Statement& st : statements) {
+      if (st.statementOp != Operator::include) {
+        out.push_back(std::move(st));
+        continue;
+      }
+      const std::vector<Statement>* body = include(st, errorLog);
+      if (body == nullptr) continue;
+      for (const Statement& s : *body) {
+        out.push_back(
+          {ExpressionPtr::share(s.ex.get()), s.statementOp, s.li});
+      }
+    }
+    statements = std::move(out);
+    return errorLog.size() == oldErrors;
+  }
+  const std::vector<Statement>* Includes::include(
+      const Statement& st, std::vector<LexError>& errorLog) {
+    const Expression* ex = st.ex.get();
+    const Literal* l = ex != nullptr && ex->id() == 1 ?
+      static_cast<const Literal*>(ex) : nullptr;
+    if (l == nullptr || !std::holds_alternative<StringLiteral>(l->val)) {
+      errorLog.emplace_back(LexErrorCode::includeNeedsPath, st.li);
+      return nullptr;
+    }
+    const std::string& name = std::get<StringLiteral>(l->val).str;
+    const Module* from = includedFile(st.li.file);
+    std::string base = from != nullptr ? directoryOf(from->path) : directory;
+    std::string path =
+      base.empty() || (!name.empty() && name[0] == '/') ?
+      name : base + "/" + name;
+    std::vector<Statement> copy;
+    ModuleHandle handle =
+      loadModule(located(path), path, cacheDirectory, copy);
+    const Module* m = handle.get();
+    if (m == nullptr) {
+      missing = true;
+      errorLog.emplace_back(LexErrorCode::includeNotFound, st.li);
+      return nullptr;
+    }
+    read.insert(std::move(handle));
+    bool cycle = m->canonical == canonical || std::any_of(
+      active.begin(), active.end(),
+      [m](const Module* a) { return a->canonical == m->canonical; });
+    if (cycle) {
+      errorLog.emplace_back(LexErrorCode::includeCycle, st.li);
+      return nullptr;
+    }
+    auto it = copies.find(m);
+    if (it != copies.end()) return &it->second;
+    if (!m->errorLog.empty()) {
+      if (reported.insert(m).second) {
+        errorLog.insert(
+          errorLog.end(), m->errorLog.begin(), m->errorLog.end());
+      }
+      return nullptr;
+    }
+    // Unless it was only just read, decode this program's copy.
+    if (copy.empty() && !m->encoded.empty()) {
+      Decoder in(m->encoded.data(), m->encoded.data() + m->encoded.size());
+      in.statements(m->file, copy);
+    }
+    // Its own includes, which can only be cycles while it's active
+    active.push_back(m);
+    expand(copy, errorLog);
+    active.pop_back();
+    return &(copies[m] = std::move(copy));
+  }
+}
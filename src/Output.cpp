@@ -0,0 +1,141 @@
+#include "Output.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace x666 {
+  // The most buffers that an OutputBuffer with a writer thread uses
+  static const size_t maxChunks = 4;
+  void OutputSink::writeAll(
+      const char* const* data, const size_t* sizes, size_t count) {
+    for (size_t i = 0; i < count; ++i) write(data[i], sizes[i]);
+  }
+  void FileOutput::write(const char* data, size_t size) {
+    writeAll(&data, &size, 1);
+  }
+  void FileOutput::writeAll(
+      const char* const* data, const size_t* sizes, size_t count) {
+    std::vector<iovec> iov;
+    for (size_t i = 0; i < count; ++i) {
+      if (sizes[i] != 0)
+        iov.push_back({const_cast<char*>(data[i]), sizes[i]});
+    }
+    size_t next = 0;
+    while (!failed && next < iov.size()) {
+      int n = (int) std::min(iov.size() - next, (size_t) IOV_MAX);
+      ssize_t k = writev(fd, iov.data() + next, n);
+      if (k < 0) {
+        if (errno != EINTR) {
+          failed = true;
+          error = errno;
+        }
+        continue;
+      }
+      // Skip what was written, which can end partway through a buffer
+      size_t left = k;
+      while (next < iov.size() && left >= iov[next].iov_len)
+        left -= iov[next++].iov_len;
+      if (left != 0) {
+        iov[next].iov_base = (char*) iov[next].iov_base + left;
+        iov[next].iov_len -= left;
+      }
+    }
+  }
+  OutputBuffer::OutputBuffer(
+      OutputSink& sink, size_t size, bool flushLines, bool background) :
+      sink(sink), size(size == 0 ? 1 : size), flushLines(flushLines),
+      current(new char[this->size]) {
+    setp(current.get(), current.get() + this->size);
+    if (background) writer = std::thread(&OutputBuffer::writeOut, this);
+  }
+  OutputBuffer::~OutputBuffer() {
+    sync();
+    if (writer.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      queued.notify_one();
+      writer.join();
+    }
+  }
+  OutputBuffer::int_type OutputBuffer::overflow(int_type c) {
+    submit();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+      if (flushLines && c == '\n') submit();
+    }
+    return traits_type::not_eof(c);
+  }
+  std::streamsize OutputBuffer::xsputn(const char* s, std::streamsize n) {
+    std::streamsize done = 0;
+    while (done < n) {
+      if (pptr() == epptr()) submit();
+      size_t k = std::min((size_t) (n - done), (size_t) (epptr() - pptr()));
+      memcpy(pptr(), s + done, k);
+      pbump((int) k);
+      done += k;
+    }
+    if (flushLines && memchr(s, '\n', n) != nullptr) submit();
+    return n;
+  }
+  int OutputBuffer::sync() {
+    submit();
+    if (writer.joinable()) {
+      std::unique_lock<std::mutex> lock(mutex);
+      written.wait(lock, [this] { return queue.empty() && !writing; });
+    }
+    return 0;
+  }
+  void OutputBuffer::submit() {
+    size_t n = pptr() - pbase();
+    if (n == 0) return;
+    if (!writer.joinable()) {
+      sink.write(pbase(), n);
+    } else {
+      std::unique_lock<std::mutex> lock(mutex);
+      queue.push_back({std::move(current), n});
+      queued.notify_one();
+      if (spare.empty() && chunks < maxChunks) {
+        spare.emplace_back(new char[size]);
+        ++chunks;
+      }
+      written.wait(lock, [this] { return !spare.empty(); });
+      current = std::move(spare.back());
+      spare.pop_back();
+    }
+    setp(current.get(), current.get() + size);
+  }
+  // The writer thread
+  void OutputBuffer::writeOut() {
+    std::vector<Chunk> batch;
+    std::vector<const char*> data;
+    std::vector<size_t> sizes;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      queued.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) return;
+      batch.swap(queue);
+      writing = true;
+      lock.unlock();
+      data.clear();
+      sizes.clear();
+      for (const Chunk& c : batch) {
+        data.push_back(c.data.get());
+        sizes.push_back(c.size);
+      }
+      sink.writeAll(data.data(), sizes.data(), batch.size());
+      lock.lock();
+      for (Chunk& c : batch) spare.push_back(std::move(c.data));
+      batch.clear();
+      writing = false;
+      written.notify_all();
+    }
+  }
+}
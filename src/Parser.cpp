@@ -1,7 +1,13 @@
 #include "Parser.h"
 
 #include <assert.h>
+
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+
+#include "Module.h"
 
 namespace x666 {
   // Precedences of operators by their ids
@@ -25,14 +31,118 @@ namespace x666 {
     1, 1, 1, // @ @@ @#
     0x582, 0x280, 0x280, 0x280, // ! & | |*
     0x582, 0x180, 1, // # , #>
+    0x201, 0x201, 0x201, 0x201, 0x201, 0x201, // +<- -<- *<- /<- %<- ~<-
+    1, 1, // #< block
   };
   // Methods specific to Expression-trees
   Expression::~Expression() {}
+  // Point operands at the operands of e, returning how many it has.
+  static size_t operandsOf(Expression* e, ExpressionPtr* operands[2]) {
+    switch (e->id()) {
+      case 2: {
+        BinaryOp* b = static_cast<BinaryOp*>(e);
+        operands[0] = &b->a;
+        operands[1] = &b->b;
+        return 2;
+      }
+      case 3:
+        operands[0] = &static_cast<UnaryOp*>(e)->a;
+        return 1;
+      case 4:
+        operands[0] = &static_cast<Bracket*>(e)->ex;
+        return 1;
+      case 5: {
+        Indexing* ix = static_cast<Indexing*>(e);
+        operands[0] = &ix->a;
+        operands[1] = &ix->b;
+        return 2;
+      }
+    }
+    return 0;
+  }
+  void ExpressionPtr::destroy(Expression* e) {
+    // Take each node's operands before deleting it, so that deleting
+    // a deep tree doesn't recurse once per level.
+    std::vector<Expression*> pending;
+    while (true) {
+      ExpressionPtr* operands[2];
+      size_t count = operandsOf(e, operands);
+      for (size_t i = 0; i < count; ++i) {
+        Expression* o = operands[i]->p;
+        operands[i]->p = nullptr;
+        if (o == nullptr) continue;
+        if (o->extraOwners > 0) --o->extraOwners;
+        else if (o->id() == 1 || o->id() == 6) delete o;
+        else pending.push_back(o);
+      }
+      delete e;
+      if (pending.empty()) return;
+      e = pending.back();
+      pending.pop_back();
+    }
+  }
+  // How deeply e nests, or maxNesting + 1 if it is deeper than that.
+  static size_t nestingOf(Expression* e) {
+    size_t deepest = 0;
+    std::vector<std::pair<Expression*, size_t>> pending = {{e, 1}};
+    while (!pending.empty() && deepest <= maxNesting) {
+      auto [n, depth] = pending.back();
+      pending.pop_back();
+      deepest = std::max(deepest, depth);
+      ExpressionPtr* operands[2];
+      size_t count = operandsOf(n, operands);
+      for (size_t i = 0; i < count; ++i) {
+        if (*operands[i] != nullptr)
+          pending.emplace_back(operands[i]->get(), depth + 1);
+      }
+    }
+    return deepest;
+  }
+  // Build a BinaryOp from its LHS a and RHS b, swapping the operands
+  // for right-associative operators (see the note on BinaryOp).
+  static ExpressionPtr makeBinaryOp(
+      ExpressionPtr a, ExpressionPtr b, Operator o) {
+    if ((precedences[(size_t) o] & 1) == 0)
+      return std::make_unique<BinaryOp>(std::move(a), std::move(b), o);
+    return std::make_unique<BinaryOp>(std::move(b), std::move(a), o);
+  }
+  // Should an operator o (with precedence prec) sink below an
+  // existing operator with precedence aprec?
+  static bool sinksBelow(size_t aprec, Operator o, size_t prec) {
+    return aprec < prec ||
+      (aprec == prec && (precedences[(size_t) o] & 1) != 0);
+  }
+  // Find where a binary operator o goes in the tree at slot: the same
+  // walk as the imbue methods, without recursing.
+  static ExpressionPtr* sink(ExpressionPtr* slot, Operator o, size_t prec) {
+    while (true) {
+      Expression* e = slot->get();
+      if (e->id() == 2) {
+        BinaryOp* n = static_cast<BinaryOp*>(e);
+        if (!sinksBelow(precedences[(size_t) n->o] >> 3, o, prec)) break;
+        slot = (precedences[(size_t) n->o] & 1) == 0 ? &n->b : &n->a;
+      } else if (e->id() == 3) {
+        UnaryOp* n = static_cast<UnaryOp*>(e);
+        if (!sinksBelow(precedences[(size_t) n->o] >> 3, o, prec)) break;
+        slot = &n->a;
+      } else {
+        break;
+      }
+    }
+    return slot;
+  }
+  // Imbue a binary operator o and its RHS b into a, like a->imbue.
+  static ExpressionPtr imbueBinary(
+      ExpressionPtr a, Operator o, size_t prec, ExpressionPtr b) {
+    ExpressionPtr* slot = sink(&a, o, prec);
+    *slot = makeBinaryOp(std::move(*slot), std::move(b), o);
+    return a;
+  }
   ExpressionPtr Expression::imbue(
       ExpressionPtr a,
       Operator o, size_t /*precedence*/,
       ExpressionPtr b) {
-    return std::make_unique<BinaryOp>(std::move(a), std::move(b), o);
+    return makeBinaryOp(std::move(a), std::move(b), o);
   }
   ExpressionPtr Expression::imbueLeft(
       ExpressionPtr b,
@@ -48,8 +158,7 @@ namespace x666 {
   ExpressionPtr Expression::juxtapose(
       ExpressionPtr b,
       ExpressionPtr a) {
-    Expression* ar = a.get();
-    return ar->imbue(
+    return imbueBinary(
       std::move(a),
       Operator::times,
       precedences[(size_t) Operator::times] >> 3,
@@ -60,17 +169,28 @@ namespace x666 {
       ExpressionPtr a) {
     assert(bx->id() == 1);
     Literal* b = dynamic_cast<Literal*>(bx.get());
+    // A negative literal after an operand is really a subtraction.
+    ExpressionPtr negated = nullptr;
     if (std::holds_alternative<IntLiteral>(b->val)) {
       int64_t ival = std::get<IntLiteral>(b->val).n;
-      if (ival < 0) {
-        Expression* ar = a.get();
-        return ar->imbue(
-          std::move(a),
-          Operator::minus,
-          precedences[(size_t) Operator::minus] >> 3,
-          std::make_unique<Literal>(IntLiteral(-ival)));
+      if (ival == INT64_MIN) {
+        negated = std::make_unique<Literal>(BigIntLiteral(-BigInt(ival)));
+      } else if (ival < 0) {
+        negated = std::make_unique<Literal>(IntLiteral(-ival));
+      }
+    } else if (std::holds_alternative<BigIntLiteral>(b->val)) {
+      const BigInt& bval = std::get<BigIntLiteral>(b->val).n;
+      if (bval.isNegative()) {
+        negated = std::make_unique<Literal>(BigIntLiteral(-bval));
       }
     }
+    if (negated != nullptr) {
+      return imbueBinary(
+        std::move(a),
+        Operator::minus,
+        precedences[(size_t) Operator::minus] >> 3,
+        std::move(negated));
+    }
     return Expression::juxtapose(std::move(bx), std::move(a));
   }
   ExpressionPtr Bracket::juxtapose(
@@ -81,7 +201,22 @@ namespace x666 {
     }
     assert(bx->id() == 4);
     Bracket* b = dynamic_cast<Bracket*>(bx.get());
-    return std::make_unique<Indexing>(std::move(a), std::move(b->ex));
+    // Indexing binds tighter than any operator, so it applies to the
+    // rightmost operand of a.
+    ExpressionPtr* target = &a;
+    while (true) {
+      Expression* t = target->get();
+      if (t->id() == 2) {
+        BinaryOp* op = dynamic_cast<BinaryOp*>(t);
+        target = (precedences[(size_t) op->o] & 1) == 0 ? &op->b : &op->a;
+      } else if (t->id() == 3) {
+        target = &dynamic_cast<UnaryOp*>(t)->a;
+      } else {
+        break;
+      }
+    }
+    *target = std::make_unique<Indexing>(std::move(*target), std::move(b->ex));
+    return a;
   }
   ExpressionPtr BinaryOp::imbue(
       ExpressionPtr ax,
@@ -95,7 +230,7 @@ namespace x666 {
     assert(ax->id() == 2);
     BinaryOp* a = dynamic_cast<BinaryOp*>(ax.get());
     size_t aprec = precedences[(size_t) a->o] >> 3;
-    if (aprec >= prec) {
+    if (!sinksBelow(aprec, o, prec)) {
       /*
             o--
            /   \
@@ -103,17 +238,20 @@ namespace x666 {
          /    \
         a->a  a->b
       */
-      return std::make_unique<BinaryOp>(std::move(ax), std::move(b), o);
-    } else { // aprec < prec
+      return makeBinaryOp(std::move(ax), std::move(b), o);
+    } else {
       /*
           a->o
          /    \
         a->a   o--
               /   \
              a->b  b
-        (this case showing the trivial imbuement into a->b)
+        (this case showing the trivial imbuement into a->b;
+        for right-associative a->o, the RHS is a->a instead)
       */
-      a->b = a->b->imbue(std::move(a->b), o, prec, std::move(b));
+      ExpressionPtr& rhs = (precedences[(size_t) a->o] & 1) == 0 ?
+        a->b : a->a;
+      rhs = rhs->imbue(std::move(rhs), o, prec, std::move(b));
       return ax;
     }
   }
@@ -181,7 +319,7 @@ namespace x666 {
     assert(ax->id() == 3);
     UnaryOp* a = dynamic_cast<UnaryOp*>(ax.get());
     size_t aprec = precedences[(size_t) a->o] >> 3;
-    if (aprec >= prec) {
+    if (!sinksBelow(aprec, o, prec)) {
       /*
             o--
            /   \
@@ -189,8 +327,8 @@ namespace x666 {
          /
         a->a
       */
-      return std::make_unique<BinaryOp>(std::move(ax), std::move(b), o);
-    } else { // aprec < prec
+      return makeBinaryOp(std::move(ax), std::move(b), o);
+    } else {
       /*
             a->o
            /
@@ -232,51 +370,77 @@ namespace x666 {
       return bx;
     }
   }
-  void Literal::trace() const {
+  const Expression* BinaryOp::lhs() const {
+    return ((precedences[(size_t) o] & 1) == 0 ? a : b).get();
+  }
+  const Expression* BinaryOp::rhs() const {
+    return ((precedences[(size_t) o] & 1) == 0 ? b : a).get();
+  }
+  Expression* BinaryOp::lhs() {
+    return ((precedences[(size_t) o] & 1) == 0 ? a : b).get();
+  }
+  Expression* BinaryOp::rhs() {
+    return ((precedences[(size_t) o] & 1) == 0 ? b : a).get();
+  }
+  void Literal::trace(std::ostream& out) const {
     switch (val.index()) {
-      case 0: std::cout << std::get<0>(val).name; break;
-      case 1: std::cout << std::get<1>(val).n; break;
-      case 2: std::cout << "\"" << unescape(std::get<2>(val).str) << "\"";
+      case 0: out << std::get<0>(val).name; break;
+      case 1: out << std::get<1>(val).n; break;
+      case 2: out << "\"" << unescape(std::get<2>(val).str) << "\"";
       break;
+      case 3: out << std::get<3>(val).n.toString(); break;
     }
   }
-  void BinaryOp::trace() const {
-    size_t prec = precedences[(size_t) o];
-    std::cout << "(";
-    ((prec & 1) == 0 ? a : b)->trace();
-    std::cout << " " << opsAsStrings[(size_t) o] << " ";
-    ((prec & 1) == 0 ? b : a)->trace();
-    std::cout << ")";
+  void BinaryOp::trace(std::ostream& out) const {
+    out << "(";
+    lhs()->trace(out);
+    out << " " << opsAsStrings[(size_t) o] << " ";
+    rhs()->trace(out);
+    out << ")";
+  }
+  void UnaryOp::trace(std::ostream& out) const {
+    out << opsAsStrings[(size_t) o];
+    a->trace(out);
   }
-  void UnaryOp::trace() const {
-    std::cout << opsAsStrings[(size_t) o];
-    a->trace();
+  void Bracket::trace(std::ostream& out) const {
+    out << "(";
+    if (ex != nullptr) ex->trace(out); // Empty, as in []
+    out << ")";
   }
-  void Bracket::trace() const {
-    std::cout << "(";
-    ex->trace();
-    std::cout << ")";
+  void Indexing::trace(std::ostream& out) const {
+    a->trace(out);
+    out << "[";
+    b->trace(out);
+    out << "]";
   }
-  void Indexing::trace() const {
-    a->trace();
-    std::cout << "[";
-    b->trace();
-    std::cout << "]";
+  void Variable::trace(std::ostream& out) const {
+    out << name;
   }
   void Statement::trace() const {
+    trace(std::cout);
+  }
+  void Statement::trace(std::ostream& out) const {
     if (statementOp != Operator::plus) {
-      std::cout << opsAsStrings[(size_t) statementOp];
+      out << opsAsStrings[(size_t) statementOp];
     }
     if (ex != nullptr) {
-      if (statementOp != Operator::plus) std::cout << ' ';
-      ex->trace();
+      if (statementOp != Operator::plus) out << ' ';
+      ex->trace(out);
     }
   }
+  // Does a statement with op have a body after it, up to the next
+  // clause or &>?
+  static bool opensBody(Operator op) {
+    return op == Operator::ifStmt || op == Operator::ifThenStmt ||
+      op == Operator::whileStmt || op == Operator::repeatStmt ||
+      op == Operator::forStmt;
+  }
   // ParserVisitor used in parseAST::parse()
   class ParserVisitor {
   public:
     ParserVisitor(Parser* p, const LineInfo& li) : p(p), li(li) {}
     bool operator()(Identifier&& i) {
+      i.li = li;
       p->thisLine.push(std::make_unique<Literal>(std::move(i)));
       p->positions.push(li);
       return true;
@@ -291,13 +455,29 @@ namespace x666 {
       p->positions.push(li);
       return true;
     }
+    bool operator()(BigIntLiteral&& i) {
+      p->thisLine.push(std::make_unique<Literal>(std::move(i)));
+      p->positions.push(li);
+      return true;
+    }
     void commitLine() {
       // Commit the current line
-      if (p->thisLine.empty()) {
+      X666_PROBE2(
+        commit, (int) p->currentStatement, p->statementStart.byte);
+      p->spine = {};
+      if (p->tooDeep) {
+        // Drop what there is of the line; its error is logged.
+        while (!p->thisLine.empty()) p->thisLine.pop();
+        while (!p->positions.empty()) p->positions.pop();
+        while (!p->brackets.empty()) p->brackets.pop();
+        p->tooDeep = false;
+      } else if (p->thisLine.empty()) {
         Operator st = p->currentStatement;
         if (st == Operator::plus || st == Operator::minus) {}
         else if (st == Operator::elseStmt || st == Operator::endStmt) {
-          p->statements.push_back({nullptr, st});
+          if (st == Operator::endStmt && p->blockDepth > 0) --p->blockDepth;
+          p->statements.push_back({nullptr, st, p->statementStart});
+          if (st == Operator::elseStmt && p->lazy) p->skipBlock();
         } else {
           p->errorLog.emplace_back(
             LexErrorCode::statementNeedsExpression,
@@ -322,8 +502,17 @@ namespace x666 {
             p->getLastLineInfo());
           while (!p->thisLine.empty()) p->thisLine.pop();
           while (!p->positions.empty()) p->positions.pop();
+        } else if (nestingOf(ex.get()) > maxNesting) {
+          p->errorLog.emplace_back(
+            LexErrorCode::nestedTooDeeply, p->statementStart);
         } else {
-          p->statements.push_back({std::move(ex), st});
+          if (opensBody(st) && st != Operator::ifThenStmt &&
+              ++p->blockDepth == maxNesting + 1) {
+            p->errorLog.emplace_back(
+              LexErrorCode::nestedTooDeeply, p->statementStart);
+          }
+          p->statements.push_back({std::move(ex), st, p->statementStart});
+          if (p->lazy && opensBody(st)) p->skipBlock();
         }
       }
       p->currentStatement = Operator::plus;
@@ -359,22 +548,21 @@ namespace x666 {
       p->thisLine.pop();
       // Now generate a new AST from a token
       size_t generatedExpressions = p->pushExpression();
+      if (p->tooDeep) return false;
       if (generatedExpressions != 1) {
         // Oh no, we can't find anything after this
         p->errorLog.emplace_back(
           LexErrorCode::noRightOperand,
           p->positions.top());
         p->positions.pop();
+        p->spine = {};
         return false;
       }
       ExpressionPtr b = std::move(p->thisLine.top());
       p->thisLine.pop();
       p->positions.pop();
-      Expression* r = (prec & 1) == 0 ? a.get() : b.get();
-      ExpressionPtr ex = (prec & 1) == 0 ?
-        r->imbue(std::move(a), op, prec >> 3, std::move(b)) :
-        r->imbue(std::move(b), op, prec >> 3, std::move(a));
-      p->thisLine.push(std::move(ex));
+      p->thisLine.push(std::move(a));
+      p->imbueTop(op, prec >> 3, std::move(b));
       return true;
     }
     bool parseClosingBracket(const Operator& op) {
@@ -441,6 +629,7 @@ namespace x666 {
       if ((prec & 2) != 0) { // This is a unary operator
         // Now generate a new AST from a token
         size_t generatedExpressions = p->pushExpression();
+        if (p->tooDeep) return false;
         if (generatedExpressions != 1) {
           // Oh no, we can't find anything after this
           p->errorLog.emplace_back(
@@ -448,19 +637,27 @@ namespace x666 {
             p->getLastLineInfo());
           return false;
         }
-        ExpressionPtr a = std::move(p->thisLine.top());
+        ex = std::move(p->thisLine.top());
         p->thisLine.pop();
-        Expression* ar = a.get();
-        ex = ar->imbue(std::move(a), op, prec >> 3);
+        // The same walk as the unary imbue methods, without recursing
+        ExpressionPtr* slot = &ex;
+        while ((*slot)->id() == 2) {
+          BinaryOp* n = static_cast<BinaryOp*>(slot->get());
+          if ((precedences[(size_t) n->o] >> 3) >= (prec >> 3)) break;
+          slot = &n->b;
+        }
+        *slot = std::make_unique<UnaryOp>(std::move(*slot), op);
         p->thisLine.push(std::move(ex));
+        p->spine = {};
       }
+      return true;
     }
   private:
     Parser* p;
     LineInfo li;
   };
-  Parser::Parser(std::istream* fh) :
-    fh(fh), currentStatement(Operator::plus) {}
+  Parser::Parser(std::istream* fh, StreamBuffer* stream) :
+    fh(fh), stream(stream), currentStatement(Operator::plus) {}
   Token Parser::requestToken() {
     Token t = getNextToken(*fh, li);
     if (std::holds_alternative<LexError>(t))
@@ -471,6 +668,8 @@ namespace x666 {
     size_t limit = brackets.empty() ? 0 : brackets.top().thisLineSize;
     size_t count = (thisLine.size() < limit) ? 0 : thisLine.size() - limit;
     if (count <= 1) return;
+    X666_PROBE1(fold, count);
+    spine = {};
     std::stack<ExpressionPtr> e;
     for (size_t i = 0; i < count - 1; ++i) {
       e.push(std::move(thisLine.top()));
@@ -487,8 +686,26 @@ namespace x666 {
     }
     thisLine.push(std::move(r));
   }
+  void Parser::imbueTop(Operator o, size_t prec, ExpressionPtr b) {
+    ExpressionPtr& root = thisLine.top();
+    ExpressionPtr* slot = &root;
+    // Every operator above the last one let it sink below, so they let
+    // one that binds at least as tightly through too.
+    if (spine.root == root.get() && spine.slot != nullptr &&
+        prec >= spine.prec) {
+      slot = spine.slot;
+    }
+    slot = sink(slot, o, prec);
+    *slot = makeBinaryOp(std::move(*slot), std::move(b), o);
+    spine = {root.get(), slot == &root ? nullptr : slot, prec};
+  }
   bool Parser::acceptToken(Token&& t) {
+    X666_PROBE2(accept, t.index(), li.sot);
     bool isNewline = std::holds_alternative<Newline>(t);
+    if (tooDeep && !isNewline && !std::holds_alternative<EndOfFile>(t))
+      return false;
+    if (!isNewline && currentStatement == Operator::plus)
+      statementStart = li;
     bool res = std::visit(ParserVisitor(this, li), std::move(t));
     if (!isNewline && currentStatement == Operator::plus)
       currentStatement = Operator::minus;
@@ -496,6 +713,13 @@ namespace x666 {
     return res;
   }
   size_t Parser::pushExpression() {
+    // Each operand waiting for this one is a level of recursion here.
+    if (pushDepth == maxNesting) {
+      errorLog.emplace_back(LexErrorCode::nestedTooDeeply, li);
+      tooDeep = true;
+      return 0;
+    }
+    ++pushDepth;
     size_t oldBracketsHeight = brackets.size();
     size_t oldThisLineSize = thisLine.size();
     do {
@@ -505,16 +729,72 @@ namespace x666 {
         break;
       }
       acceptToken(std::move(t));
-    } while (oldBracketsHeight != brackets.size());
+    } while (!tooDeep && oldBracketsHeight != brackets.size());
+    --pushDepth;
     return thisLine.size() - oldThisLineSize;
   }
+  void Parser::finishStatement() {
+    expandIncludes();
+    if (traceTo != nullptr) {
+      if (errorLog.empty()) {
+        for (const Statement& st : statements) {
+          st.trace(*traceTo);
+          *traceTo << "\n";
+        }
+      }
+      statements.clear();
+      expanded = 0;
+    }
+    for (; rendered < errorLog.size(); ++rendered) {
+      LexError& e = errorLog[rendered];
+      std::ostringstream snippet;
+      printSnippet(*fh, e.li, snippet);
+      e.snippet = snippet.str();
+    }
+    // Keep the newline before the next statement, where snippets stop
+    // looking back.
+    stream->release(li.byte == 0 ? 0 : li.byte - 1);
+  }
+  void Parser::expandIncludes() {
+    if (includes == nullptr) return;
+    auto first = statements.begin() + expanded;
+    bool any = std::any_of(
+      first, statements.end(),
+      [](const Statement& st) {
+        return st.statementOp == Operator::include;
+      });
+    if (any) {
+      std::vector<Statement> fresh(
+        std::make_move_iterator(first),
+        std::make_move_iterator(statements.end()));
+      statements.erase(first, statements.end());
+      includes->expand(fresh, errorLog);
+      statements.insert(
+        statements.end(),
+        std::make_move_iterator(fresh.begin()),
+        std::make_move_iterator(fresh.end()));
+    }
+    expanded = statements.size();
+  }
+  void Parser::skipBlock() {
+    LineInfo start = li;
+    if (!skipBlockBody(*fh, li, skippedStores)) return;
+    statements.push_back({nullptr, Operator::block, start});
+    blockEnds.emplace(start.byte, li.byte);
+  }
   void Parser::parse() {
+    X666_PROBE0(parse_start);
     while (true) {
       Token t = requestToken();
+      bool end = std::holds_alternative<Newline>(t) ||
+        std::holds_alternative<EndOfFile>(t);
       acceptToken(std::move(t));
+      if (end && stream != nullptr) finishStatement();
       if (std::holds_alternative<EndOfFile>(t)) break;
-      assert(thisLine.size() == positions.size());
+      assert(tooDeep || thisLine.size() == positions.size());
     }
+    expandIncludes();
+    X666_PROBE2(parse_done, statements.size(), errorLog.size());
   }
   const LineInfo& Parser::getLastLineInfo() const {
     return !positions.empty() ? positions.top() : li;
@@ -0,0 +1,181 @@
+#include "Profile.h"
+
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "JIT.h"
+#include "Module.h"
+#include "Program.h"
+
+namespace x666 {
+  // The Profile that SIGPROF samples go to
+  static Profile* volatile sampling = nullptr;
+  Profile::Profile(const Program& program) :
+    program(program), counts(program.statements.size()),
+    samples(program.statements.size() + 1),
+    current(program.statements.size()) {}
+  static uint64_t processCpuNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+  void Profile::onSample(int, siginfo_t*, void* context) {
+    Profile* p = sampling;
+    if (p == nullptr) return;
+    size_t at = p->current;
+#if defined(__x86_64__) && defined(__linux__)
+    // Native code doesn't call enter(), so go by where it stopped.
+    const NativeLoop* loop = p->native;
+    if (loop != nullptr) {
+      const mcontext_t& mc = static_cast<ucontext_t*>(context)->uc_mcontext;
+      size_t i = loop->statementAt((const void*) mc.gregs[REG_RIP]);
+      if (i != SIZE_MAX) at = i;
+    }
+#else
+    (void) context;
+#endif
+    ++p->samples[at];
+  }
+  void Profile::start(unsigned hz) {
+    if (hz == 0) hz = 1;
+    sampling = this;
+    cpuNanos -= processCpuNanos();
+    struct sigaction sa;
+    sa.sa_sigaction = onSample;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigaction(SIGPROF, &sa, nullptr);
+    itimerval timer;
+    long usec = 1000000 / hz;
+    timer.it_interval.tv_sec = usec / 1000000;
+    timer.it_interval.tv_usec = usec % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+  }
+  void Profile::stop() {
+    itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_DFL);
+    sampling = nullptr;
+    cpuNanos += processCpuNanos();
+  }
+  static std::vector<std::string> splitLines(const std::string& s) {
+    std::vector<std::string> lines;
+    std::istringstream in(s);
+    std::string line;
+    while (std::getline(in, line)) lines.push_back(line);
+    return lines;
+  }
+  // What a listing shows for one file: its lines, with the counts and
+  // samples of the statements on each
+  struct FileListing {
+    FileListing(const std::string& source) :
+      lines(splitLines(source)), counts(lines.size()),
+      samples(lines.size()), hasCode(lines.size()) {}
+    std::vector<std::string> lines;
+    std::vector<uint64_t> counts, samples;
+    std::vector<char> hasCode;
+  };
+  static void printListing(
+      std::ostream& out, const FileListing& f, uint64_t total) {
+    out << "     count  samples       %  line\n";
+    for (size_t l = 0; l < f.lines.size(); ++l) {
+      if (f.hasCode[l]) {
+        double percent = total == 0 ? 0 : 100.0 * f.samples[l] / total;
+        out << std::setw(10) << f.counts[l] << ' ';
+        out << std::setw(8) << f.samples[l] << ' ';
+        out << std::setw(6) << std::fixed << std::setprecision(2)
+          << percent << "% ";
+      } else {
+        out << std::string(27, ' ');
+      }
+      out << std::setw(5) << (l + 1) << "  " << f.lines[l] << "\n";
+    }
+  }
+  void Profile::listing(std::ostream& out) const {
+    // By LineInfo::file, so the program itself comes first, then the
+    // files it includes
+    std::map<uint32_t, FileListing> files;
+    files.emplace(0, FileListing(program.source));
+    uint64_t total = samples.back();
+    for (size_t i = 0; i < counts.size(); ++i) {
+      const LineInfo& li = program.statements[i].li;
+      total += samples[i];
+      auto it = files.find(li.file);
+      if (it == files.end()) {
+        const Module* m = includedFile(li.file);
+        if (m == nullptr) continue;
+        it = files.emplace(li.file, FileListing(m->source)).first;
+      }
+      FileListing& f = it->second;
+      if (li.line >= f.lines.size()) continue;
+      f.counts[li.line] += counts[i];
+      f.samples[li.line] += samples[i];
+      f.hasCode[li.line] = true;
+    }
+    // The kernel may deliver fewer samples than asked for, so the CPU
+    // time is measured separately.
+    out << "Profile of " << program.name << ": " << total
+      << " samples over " << cpuNanos / 1e9 << " s of CPU time\n";
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    for (const auto& [file, f] : files) {
+      if (file != 0)
+        out << "\nIncluded file " << includedFile(file)->path << ":\n";
+      printListing(out, f, total);
+    }
+    out.flags(flags);
+    out.precision(precision);
+  }
+  // A statement as a flame graph frame, which can't contain ; or
+  // newlines
+  static std::string frame(const Statement& st) {
+    std::ostringstream s;
+    const Module* m = includedFile(st.li.file);
+    if (m != nullptr) s << m->path << ':';
+    s << 'L' << (st.li.line + 1) << ' ';
+    st.trace(s);
+    std::string f = s.str();
+    for (char& c : f) {
+      if (c == ';') c = ',';
+      else if (c == '\n') c = ' ';
+    }
+    return f;
+  }
+  void Profile::folded(std::ostream& out) const {
+    const std::vector<Statement>& statements = program.statements;
+    // The block each statement is directly inside
+    std::vector<size_t> parent(statements.size(), SIZE_MAX);
+    std::vector<size_t> open;
+    for (size_t i = 0; i < statements.size(); ++i) {
+      Operator op = statements[i].statementOp;
+      if (!open.empty()) parent[i] = open.back();
+      if (op == Operator::endStmt) {
+        if (!open.empty()) open.pop_back();
+      } else if (op == Operator::ifStmt || op == Operator::whileStmt ||
+          op == Operator::repeatStmt || op == Operator::forStmt) {
+        open.push_back(i);
+      }
+    }
+    for (size_t i = 0; i < statements.size(); ++i) {
+      if (samples[i] == 0) continue;
+      std::vector<size_t> stack;
+      for (size_t j = i; j != SIZE_MAX; j = parent[j]) stack.push_back(j);
+      out << program.name;
+      for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+        out << ';' << frame(statements[*it]);
+      out << ' ' << samples[i] << "\n";
+    }
+    if (samples.back() != 0)
+      out << program.name << ";(outside statements) "
+        << samples.back() << "\n";
+  }
+}
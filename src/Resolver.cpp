@@ -0,0 +1,120 @@
+#include "Resolver.h"
+
+namespace x666 {
+  // If ex is a bare identifier, return its name.
+  static const std::string* identifierName(const Expression* ex) {
+    if (ex == nullptr || ex->id() != 1) return nullptr;
+    const Literal* l = dynamic_cast<const Literal*>(ex);
+    if (!std::holds_alternative<Identifier>(l->val)) return nullptr;
+    return &std::get<Identifier>(l->val).name;
+  }
+  // The loop variable of an @# statement: the first operand of its
+  // comma chain.
+  static const Expression* forVariable(const Expression* ex) {
+    while (ex != nullptr && ex->id() == 2) {
+      const BinaryOp* b = dynamic_cast<const BinaryOp*>(ex);
+      if (b->o != Operator::comma) break;
+      ex = b->lhs();
+    }
+    return ex;
+  }
+  size_t Resolver::slotFor(const std::string& name) {
+    auto it = slots.find(name);
+    if (it != slots.end()) return it->second;
+    size_t slot = slotNames.size();
+    slots.emplace(name, slot);
+    slotNames.push_back(name);
+    return slot;
+  }
+  void Resolver::collectStores(const Expression* ex) {
+    if (ex == nullptr) return;
+    switch (ex->id()) {
+      case 2: {
+        const BinaryOp* b = dynamic_cast<const BinaryOp*>(ex);
+        if (b->o == Operator::assign) {
+          const std::string* name = identifierName(b->lhs());
+          if (name != nullptr) assigned.insert(*name);
+        }
+        collectStores(b->a.get());
+        collectStores(b->b.get());
+        break;
+      }
+      case 3:
+        collectStores(dynamic_cast<const UnaryOp*>(ex)->a.get());
+        break;
+      case 4:
+        collectStores(dynamic_cast<const Bracket*>(ex)->ex.get());
+        break;
+      case 5: {
+        const Indexing* ix = dynamic_cast<const Indexing*>(ex);
+        collectStores(ix->a.get());
+        collectStores(ix->b.get());
+        break;
+      }
+    }
+  }
+  void Resolver::rewrite(ExpressionPtr& ex) {
+    if (ex == nullptr) return;
+    switch (ex->id()) {
+      case 1: {
+        const Literal* l = static_cast<const Literal*>(ex.get());
+        if (!std::holds_alternative<Identifier>(l->val)) return;
+        const Identifier& id = std::get<Identifier>(l->val);
+        size_t slot = slotFor(id.name);
+        if (assigned.count(id.name) == 0 &&
+            reported.insert(id.name).second) {
+          if (allowInputs) {
+            inputSlots.push_back(slot);
+          } else {
+            errorLog->emplace_back(LexErrorCode::unassignedVariable, id.li);
+          }
+        }
+        ex = std::make_unique<Variable>(id.name, slot, id.li);
+        break;
+      }
+      case 2: {
+        BinaryOp* b = dynamic_cast<BinaryOp*>(ex.get());
+        rewrite(b->a);
+        rewrite(b->b);
+        break;
+      }
+      case 3:
+        rewrite(dynamic_cast<UnaryOp*>(ex.get())->a);
+        break;
+      case 4:
+        rewrite(dynamic_cast<Bracket*>(ex.get())->ex);
+        break;
+      case 5: {
+        Indexing* ix = dynamic_cast<Indexing*>(ex.get());
+        rewrite(ix->a);
+        rewrite(ix->b);
+        break;
+      }
+    }
+  }
+  bool Resolver::resolve(std::vector<LexError>& log, bool allowInputs) {
+    errorLog = &log;
+    this->allowInputs = allowInputs;
+    return resolveAll(statements);
+  }
+  bool Resolver::resolve(
+      std::vector<Statement>& more, std::vector<LexError>& log) {
+    errorLog = &log;
+    return resolveAll(more);
+  }
+  bool Resolver::resolveAll(std::vector<Statement>& list) {
+    X666_PROBE0(resolve_start);
+    size_t oldErrors = errorLog->size();
+    for (const Statement& st : list) {
+      collectStores(st.ex.get());
+      if (st.statementOp == Operator::forStmt) {
+        const std::string* name = identifierName(forVariable(st.ex.get()));
+        if (name != nullptr) assigned.insert(*name);
+      }
+    }
+    for (Statement& st : list) rewrite(st.ex);
+    X666_PROBE2(
+      resolve_done, slotNames.size(), errorLog->size() - oldErrors);
+    return errorLog->size() == oldErrors;
+  }
+}
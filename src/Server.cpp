@@ -0,0 +1,319 @@
+#include "Server.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <ostream>
+#include <sstream>
+#include <vector>
+
+#include "Module.h"
+#include "Parser.h"
+#include "Program.h"
+
+/*
+ * The protocol, in native byte order since both ends are on one host:
+ *
+ * request:  uint8_t kind, then the program's file name, the client's
+ *           working directory and the source, each a uint64_t length
+ *           and that many bytes
+ * response: any number of (uint32_t length != 0, output bytes),
+ *           then uint32_t 0, int32_t exit status
+ */
+
+namespace x666 {
+  static bool writeAll(int fd, const void* data, size_t size) {
+    const char* p = (const char*) data;
+    while (size > 0) {
+      ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+      if (n <= 0) return false;
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+  static bool readAll(int fd, void* data, size_t size) {
+    char* p = (char*) data;
+    while (size > 0) {
+      ssize_t n = read(fd, p, size);
+      if (n <= 0) return false;
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+  static bool sendOutput(int fd, const char* data, size_t size) {
+    uint32_t n = size;
+    return size == 0 || (writeAll(fd, &n, sizeof(n)) &&
+      writeAll(fd, data, size));
+  }
+  static bool sendStatus(int fd, int32_t status) {
+    uint32_t end = 0;
+    return writeAll(fd, &end, sizeof(end)) &&
+      writeAll(fd, &status, sizeof(status));
+  }
+  static bool openSocket(const std::string& path, sockaddr_un& addr) {
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+  }
+  static constexpr uint64_t maxSource = 1 << 30;
+  static bool sendString(int fd, const std::string& s) {
+    uint64_t length = s.size();
+    return writeAll(fd, &length, sizeof(length)) &&
+      writeAll(fd, s.data(), s.size());
+  }
+  static bool readString(int fd, std::string& s) {
+    uint64_t length;
+    if (!readAll(fd, &length, sizeof(length)) || length > maxSource)
+      return false;
+    s.assign(length, '\0');
+    return readAll(fd, &s[0], length);
+  }
+  // 64-bit FNV-1a, continuing from h
+  static uint64_t hashSource(
+      const std::string& source, uint64_t h = 0xcbf29ce484222325) {
+    for (char c : source) {
+      h ^= (unsigned char) c;
+      h *= 0x100000001b3;
+    }
+    return h;
+  }
+  std::string defaultSocketPath() {
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    if (dir != nullptr && *dir != '\0')
+      return std::string(dir) + "/x666.sock";
+    return "/tmp/x666-" + std::to_string(getuid()) + ".sock";
+  }
+  namespace {
+    struct DiagnosticText : DiagnosticSink {
+      void report(const Diagnostic& d) override { d.print(text); }
+      std::ostringstream text;
+    };
+    // Sends #> output to the client as it is printed.
+    struct SocketOutput : OutputSink {
+      SocketOutput(int fd) : fd(fd) {}
+      void write(const char* data, size_t size) override {
+        if (ok) ok = sendOutput(fd, data, size);
+      }
+      int fd;
+      bool ok = true;
+    };
+  }
+  std::shared_ptr<const Server::Entry> Server::build(
+      Request r, uint64_t key, Source s) {
+    auto e = std::make_shared<Entry>();
+    e->key = key;
+    size_t statements = 0;
+    if (r == Request::trace) {
+      std::istringstream fh(s.text);
+      Includes includes(s.name, std::string(), s.directory);
+      Parser p(&fh);
+      p.includes = &includes;
+      p.parse();
+      std::ostringstream text;
+      e->keep = p.errorLog.empty();
+      e->included.assign(
+        includes.modules().begin(), includes.modules().end());
+      if (p.errorLog.empty()) {
+        text << "Compilation succeeded\n";
+        for (const Statement& st : p.statements) {
+          st.trace(text);
+          text << "\n";
+        }
+      } else {
+        text << "Parsing failed:\n";
+        for (const LexError& le : p.errorLog) {
+          le.print(fh, text);
+        }
+      }
+      e->text = text.str();
+    } else {
+      DiagnosticText diagnostics;
+      CompileOptions options;
+      options.workingDirectory = s.directory;
+      e->program = compile(s.text, s.name, diagnostics, options);
+      if (e->program == nullptr) {
+        e->text = "Parsing failed:\n" + diagnostics.text.str();
+      } else {
+        statements = e->program->statements.size();
+        e->included = e->program->included;
+        e->keep = true;
+      }
+    }
+    e->source = std::move(s);
+    // A rough figure: the program text is kept twice (here and in the
+    // Program), plus an allowance for each statement's tree.
+    e->bytes = sizeof(Entry) + 2 * e->source.text.size() +
+      e->text.size() + statements * 256;
+    return e;
+  }
+  std::shared_ptr<const Server::Entry> Server::lookup(
+      Request r, Source s) {
+    uint64_t key = hashSource(s.directory, hashSource(s.name,
+      hashSource(s.text))) << 1 | (r != Request::trace);
+    std::shared_ptr<const Entry> hit;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto it = index.find(key);
+      if (it != index.end() && (*it->second)->source.text == s.text &&
+          (*it->second)->source.name == s.name &&
+          (*it->second)->source.directory == s.directory)
+        hit = *it->second;
+    }
+    // Checking the included files reads them, so not under the lock.
+    if (hit != nullptr && std::all_of(
+        hit->included.begin(), hit->included.end(),
+        [](const ModuleHandle& m) { return unchanged(*m); })) {
+      std::lock_guard<std::mutex> guard(lock);
+      auto it = index.find(key);
+      if (it != index.end() && *it->second == hit)
+        entries.splice(entries.begin(), entries, it->second);
+      return hit;
+    }
+    // Parse without holding the lock; if two clients race on the same
+    // source, the second one's entry replaces the first.
+    std::shared_ptr<const Entry> e = build(r, key, std::move(s));
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = index.find(key);
+    if (it != index.end()) {
+      usedBytes -= (*it->second)->bytes;
+      entries.erase(it->second);
+      index.erase(it);
+    }
+    if (!e->keep) return e;
+    entries.push_front(e);
+    index[key] = entries.begin();
+    usedBytes += e->bytes;
+    while (usedBytes > cacheBytes && entries.size() > 1) {
+      usedBytes -= entries.back()->bytes;
+      index.erase(entries.back()->key);
+      entries.pop_back();
+    }
+    return e;
+  }
+  void Server::handle(int fd) {
+    uint8_t kind;
+    Source s;
+    if (!readAll(fd, &kind, sizeof(kind)) ||
+        kind > (uint8_t) Request::runNoJit || !readString(fd, s.name) ||
+        !readString(fd, s.directory) || !readString(fd, s.text)) {
+      close(fd);
+      return;
+    }
+    Request r = (Request) kind;
+    try {
+      std::shared_ptr<const Entry> e = lookup(r, std::move(s));
+      int32_t status = 0;
+      bool ok = sendOutput(fd, e->text.data(), e->text.size());
+      if (ok && e->program != nullptr) {
+        SocketOutput out(fd);
+        DiagnosticText diagnostics;
+        RunOptions options;
+        options.jit = r == Request::run;
+        if (!run(*e->program, out, diagnostics, options)) status = 1;
+        std::string text = diagnostics.text.str();
+        ok = out.ok && sendOutput(fd, text.data(), text.size());
+      }
+      if (ok) sendStatus(fd, status);
+    } catch (const std::exception& ex) {
+      // Such as running out of memory: fail this request, not the
+      // server and every other client's with it.
+      std::string text = std::string("x666 --serve: ") + ex.what() + "\n";
+      if (sendOutput(fd, text.data(), text.size())) sendStatus(fd, 1);
+    }
+    close(fd);
+  }
+  void* Server::handleThread(void* connection) {
+    std::unique_ptr<Connection> c(static_cast<Connection*>(connection));
+    c->server->handle(c->fd);
+    return nullptr;
+  }
+  bool Server::serve(std::ostream& log) {
+    sockaddr_un addr;
+    if (!openSocket(socketPath, addr)) {
+      log << "Socket path is too long: " << socketPath << "\n";
+      return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (fd < 0 || bind(fd, (sockaddr*) &addr, sizeof(addr)) != 0 ||
+        listen(fd, 64) != 0) {
+      log << "Can't listen on " << socketPath << ": "
+        << strerror(errno) << "\n";
+      if (fd >= 0) close(fd);
+      return false;
+    }
+    log << "Listening on " << socketPath << "\n";
+    while (true) {
+      int client = accept(fd, nullptr, nullptr);
+      if (client < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        log << "accept failed: " << strerror(errno) << "\n";
+        close(fd);
+        return false;
+      }
+      // The same stack as x666 itself runs on, rather than the
+      // default that std::thread would give
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setstacksize(&attr, threadStackSize);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      pthread_t thread;
+      Connection* c = new Connection{this, client};
+      bool started = pthread_create(&thread, &attr, handleThread, c) == 0;
+      pthread_attr_destroy(&attr);
+      if (!started) {
+        delete c;
+        handle(client);
+      }
+    }
+  }
+  bool sendRequest(
+      const std::string& socketPath, Request r, const std::string& name,
+      const std::string& source, std::ostream& out, int& status) {
+    char* cwd = getcwd(nullptr, 0);
+    if (cwd == nullptr) return false;
+    std::string directory(cwd);
+    free(cwd);
+    sockaddr_un addr;
+    if (!openSocket(socketPath, addr)) return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    if (connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0) {
+      close(fd);
+      return false;
+    }
+    uint8_t kind = (uint8_t) r;
+    if (!writeAll(fd, &kind, sizeof(kind)) || !sendString(fd, name) ||
+        !sendString(fd, directory) || !sendString(fd, source)) {
+      close(fd);
+      return false;
+    }
+    // Once the request is sent, don't fall back to running it locally:
+    // some of its output may already have been printed.
+    status = 1;
+    std::vector<char> buffer;
+    uint32_t n;
+    while (readAll(fd, &n, sizeof(n))) {
+      if (n == 0) {
+        int32_t s;
+        if (readAll(fd, &s, sizeof(s))) status = s;
+        break;
+      }
+      buffer.resize(n);
+      if (!readAll(fd, buffer.data(), n)) break;
+      out.write(buffer.data(), n);
+    }
+    close(fd);
+    return true;
+  }
+}
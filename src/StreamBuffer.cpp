@@ -0,0 +1,53 @@
+#include "StreamBuffer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace x666 {
+  StreamBuffer::int_type StreamBuffer::underflow() {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    // Slide the window up to the released position, then read a chunk
+    // after what is left.
+    size_t offset = gptr() - eback();
+    size_t size = egptr() - eback();
+    size_t drop = 0;
+    if (released > base) drop = std::min(released - base, offset);
+    if (drop > 0) {
+      memmove(window.data(), window.data() + drop, size - drop);
+      base += drop;
+      offset -= drop;
+      size -= drop;
+    }
+    window.resize(size + chunkSize);
+    ssize_t n;
+    do {
+      n = read(fd, window.data() + size, chunkSize);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) n = 0;
+    window.resize(size + n);
+    char* start = window.data();
+    setg(start, start + offset, start + size + n);
+    if (n == 0) return traits_type::eof();
+    return traits_type::to_int_type(*gptr());
+  }
+  StreamBuffer::pos_type StreamBuffer::seekoff(
+      off_type off, std::ios_base::seekdir dir,
+      std::ios_base::openmode which) {
+    if (dir == std::ios_base::beg) return seekpos(off, which);
+    if (dir == std::ios_base::cur)
+      return seekpos(base + (gptr() - eback()) + off, which);
+    return pos_type(off_type(-1));
+  }
+  StreamBuffer::pos_type StreamBuffer::seekpos(
+      pos_type pos, std::ios_base::openmode which) {
+    size_t p = (off_type) pos;
+    size_t size = egptr() - eback();
+    if (!(which & std::ios_base::in) || p < base || p > base + size)
+      return pos_type(off_type(-1));
+    setg(eback(), eback() + (p - base), egptr());
+    return pos;
+  }
+}
@@ -0,0 +1,358 @@
+#include "Types.h"
+
+#include <algorithm>
+#include <ostream>
+
+namespace x666 {
+  std::string typeName(TypeSet t) {
+    static const char* names[] = {"integer", "string", "list", "unset"};
+    std::string name;
+    for (int i = 0; i < 4; ++i) {
+      if ((t & (1 << i)) == 0) continue;
+      if (!name.empty()) name += '|';
+      name += names[i];
+    }
+    return name.empty() ? "-" : name;
+  }
+  static void join(std::vector<TypeSet>& a, const std::vector<TypeSet>& b) {
+    for (size_t i = 0; i < a.size(); ++i) a[i] |= b[i];
+  }
+  // The operands of a chain of commas, in order.
+  static std::vector<Expression*> commaOperands(Expression* ex) {
+    std::vector<Expression*> parts;
+    while (ex->id() == 2) {
+      BinaryOp* b = static_cast<BinaryOp*>(ex);
+      if (b->o != Operator::comma) break;
+      parts.push_back(b->rhs());
+      ex = b->lhs();
+    }
+    parts.push_back(ex);
+    std::reverse(parts.begin(), parts.end());
+    return parts;
+  }
+  // Follows the order in which Interpreter::evaluate visits operands,
+  // since assignments inside an expression change what comes after.
+  TypeSet TypeInference::expr(Expression* ex, State& s) {
+    if (ex == nullptr) return 0;
+    TypeSet t = anyType;
+    switch (ex->id()) {
+      case 1: {
+        size_t kind = static_cast<const Literal*>(ex)->val.index();
+        t = kind == 2 ? stringType : kind == 0 ? anyType : integerType;
+        break;
+      }
+      case 2:
+        t = binary(static_cast<BinaryOp*>(ex), s);
+        break;
+      case 3: {
+        UnaryOp* u = static_cast<UnaryOp*>(ex);
+        expr(u->a.get(), s);
+        bool known = u->o == Operator::minus || u->o == Operator::notStmt ||
+          u->o == Operator::length;
+        t = known ? integerType : 0;
+        break;
+      }
+      case 4: {
+        Bracket* b = static_cast<Bracket*>(ex);
+        if (b->ex == nullptr) {
+          t = listType;
+        } else if (b->bracket == Operator::leftSBracket) {
+          for (Expression* e : commaOperands(b->ex.get())) expr(e, s);
+          t = listType;
+        } else {
+          t = expr(b->ex.get(), s);
+        }
+        break;
+      }
+      case 5: {
+        Indexing* ix = static_cast<Indexing*>(ex);
+        TypeSet a = expr(ix->a.get(), s);
+        expr(ix->b.get(), s);
+        // A character of a string is a string; an element of a list
+        // could be anything.
+        t = a == stringType ? stringType : anyType;
+        break;
+      }
+      case 6: {
+        size_t slot = static_cast<const Variable*>(ex)->slot;
+        variables[slot] |= s[slot];
+        // Reading an unset variable fails rather than giving a value.
+        t = s[slot] & anyType;
+        break;
+      }
+    }
+    ex->type |= t;
+    return t;
+  }
+  TypeSet TypeInference::binary(BinaryOp* b, State& s) {
+    Expression* lhs = b->lhs();
+    Expression* rhs = b->rhs();
+    switch (b->o) {
+      case Operator::comma:
+        for (Expression* e : commaOperands(b)) expr(e, s);
+        return listType;
+      case Operator::andStmt:
+      case Operator::orStmt: {
+        expr(lhs, s);
+        State skipped = s;
+        expr(rhs, s);
+        join(s, skipped);
+        return integerType;
+      }
+      case Operator::questionMark: {
+        expr(lhs, s);
+        State other = s;
+        TypeSet t;
+        if (rhs->id() == 2 &&
+            static_cast<BinaryOp*>(rhs)->o == Operator::colon) {
+          BinaryOp* sel = static_cast<BinaryOp*>(rhs);
+          t = expr(sel->lhs(), s) |
+            expr(sel->rhs(), other);
+          sel->type |= t;
+        } else {
+          // Without a : the false case gives 0.
+          t = expr(rhs, s) | integerType;
+        }
+        join(s, other);
+        return t;
+      }
+      case Operator::colon:
+        return 0; // Only valid after ?
+      default: break;
+    }
+    if (!isAssignment(b->o)) {
+      expr(lhs, s);
+      expr(rhs, s);
+      return b->o == Operator::concat ? stringType : integerType;
+    }
+    if (lhs->id() != 6) return 0; // Fails before evaluating anything
+    size_t slot = static_cast<Variable*>(lhs)->slot;
+    Operator op = assignedOperator(b->o);
+    TypeSet t = expr(rhs, s);
+    if (op != Operator::assign) {
+      // The variable is read after the right side.
+      lhs->type |= s[slot] & anyType;
+      variables[slot] |= s[slot];
+      t = op == Operator::concat ? stringType : integerType;
+    } else {
+      lhs->type |= t;
+    }
+    s[slot] = t;
+    variables[slot] |= t;
+    return t;
+  }
+  void TypeInference::range(size_t i, size_t stop, State& s) {
+    while (i < stop) {
+      Statement& st = statements[i];
+      switch (st.statementOp) {
+        case Operator::ifStmt:
+          i = ifChain(i, s);
+          break;
+        case Operator::whileStmt:
+        case Operator::repeatStmt:
+        case Operator::forStmt:
+          i = loop(i, s);
+          break;
+        case Operator::block:
+          // An unparsed body could do anything.
+          s.assign(slotCount, anyType | unsetType);
+          ++i;
+          break;
+        default:
+          expr(st.ex.get(), s);
+          ++i;
+      }
+    }
+  }
+  size_t TypeInference::ifChain(size_t i, State& s) {
+    State out(slotCount, 0);
+    bool hasElse = false;
+    size_t k = i;
+    while (statements[k].statementOp != Operator::endStmt) {
+      Statement& c = statements[k];
+      if (c.statementOp == Operator::elseStmt) hasElse = true;
+      else expr(c.ex.get(), s);
+      State body = s;
+      range(k + 1, jumps[k], body);
+      join(out, body);
+      k = jumps[k];
+    }
+    if (!hasElse) join(out, s);
+    s = std::move(out);
+    return k + 1;
+  }
+  size_t TypeInference::loop(size_t h, State& s) {
+    Statement& head = statements[h];
+    size_t end = jumps[h];
+    Variable* counter = nullptr;
+    if (head.statementOp == Operator::forStmt) {
+      std::vector<Expression*> parts = commaOperands(head.ex.get());
+      for (size_t i = 1; i < parts.size(); ++i) expr(parts[i], s);
+      if (parts[0]->id() == 6) {
+        counter = static_cast<Variable*>(parts[0]);
+        counter->type |= integerType;
+        s[counter->slot] = integerType;
+        variables[counter->slot] |= integerType;
+      }
+    }
+    State entry = s;
+    State top = entry;
+    while (true) {
+      State body = top, exit;
+      if (head.statementOp == Operator::whileStmt) {
+        expr(head.ex.get(), body);
+        exit = body;
+        range(h + 1, end, body);
+      } else {
+        range(h + 1, end, body);
+        if (head.statementOp == Operator::repeatStmt)
+          expr(head.ex.get(), body);
+        // The &> of an @# adds the step to the counter.
+        exit = body;
+        if (counter != nullptr) {
+          body[counter->slot] = exit[counter->slot] = integerType;
+          // An @# whose start is past its end skips the body.
+          join(exit, entry);
+        }
+      }
+      State next = entry;
+      join(next, body);
+      if (next == top) {
+        s = std::move(exit);
+        return end + 1;
+      }
+      top = std::move(next);
+    }
+  }
+  bool TypeInference::markUnboxed(Expression* ex) {
+    if (ex == nullptr) return false;
+    bool ok = ex->type == integerType;
+    switch (ex->id()) {
+      case 1:
+        ok = ok && static_cast<const Literal*>(ex)->val.index() == 1;
+        break;
+      case 2: {
+        BinaryOp* b = static_cast<BinaryOp*>(ex);
+        bool a = markUnboxed(b->a.get());
+        bool c = markUnboxed(b->b.get());
+        switch (b->o) {
+          case Operator::plus: case Operator::minus: case Operator::times:
+          case Operator::divide: case Operator::modulo:
+          case Operator::equal: case Operator::notEqual:
+          case Operator::less: case Operator::greater:
+          case Operator::lessEqual: case Operator::greaterEqual:
+          case Operator::andStmt: case Operator::orStmt:
+          case Operator::xorStmt:
+          case Operator::questionMark: case Operator::colon:
+            ok = ok && a && c;
+            break;
+          default: ok = false;
+        }
+        break;
+      }
+      case 3: {
+        UnaryOp* u = static_cast<UnaryOp*>(ex);
+        ok = markUnboxed(u->a.get()) && ok &&
+          (u->o == Operator::minus || u->o == Operator::notStmt);
+        break;
+      }
+      case 4: {
+        Bracket* b = static_cast<Bracket*>(ex);
+        ok = markUnboxed(b->ex.get()) && ok &&
+          b->bracket == Operator::leftBracket;
+        break;
+      }
+      case 5: {
+        Indexing* ix = static_cast<Indexing*>(ex);
+        markUnboxed(ix->a.get());
+        markUnboxed(ix->b.get());
+        ok = false;
+        break;
+      }
+    }
+    ex->unboxed = ok;
+    return ok;
+  }
+  void TypeInference::count(const Expression* ex) {
+    if (ex == nullptr) return;
+    ++expressions;
+    if (ex->type == integerType) ++integers;
+    if (ex->type == stringType) ++strings;
+    if (ex->type == listType) ++lists;
+    if (ex->unboxed) ++unboxed;
+    switch (ex->id()) {
+      case 2: {
+        const BinaryOp* b = static_cast<const BinaryOp*>(ex);
+        count(b->a.get());
+        count(b->b.get());
+        break;
+      }
+      case 3: count(static_cast<const UnaryOp*>(ex)->a.get()); break;
+      case 4: count(static_cast<const Bracket*>(ex)->ex.get()); break;
+      case 5: {
+        const Indexing* ix = static_cast<const Indexing*>(ex);
+        count(ix->a.get());
+        count(ix->b.get());
+        break;
+      }
+    }
+  }
+  bool TypeInference::run() {
+    size_t n = statements.size();
+    jumps.assign(n, n);
+    std::vector<size_t> open;
+    for (size_t i = 0; i < n; ++i) {
+      switch (statements[i].statementOp) {
+        case Operator::ifStmt:
+        case Operator::whileStmt:
+        case Operator::repeatStmt:
+        case Operator::forStmt:
+          open.push_back(i);
+          break;
+        case Operator::ifThenStmt:
+        case Operator::elseStmt: {
+          if (open.empty()) return false;
+          Operator top = statements[open.back()].statementOp;
+          if (top != Operator::ifStmt && top != Operator::ifThenStmt)
+            return false;
+          jumps[open.back()] = i;
+          open.back() = i;
+          break;
+        }
+        case Operator::endStmt:
+          if (open.empty()) return false;
+          jumps[open.back()] = i;
+          open.pop_back();
+          break;
+        default: break;
+      }
+    }
+    if (!open.empty()) return false;
+    State s(slotCount, unsetType);
+    range(0, n, s);
+    for (Statement& st : statements) {
+      if (st.statementOp == Operator::forStmt) {
+        for (Expression* e : commaOperands(st.ex.get())) markUnboxed(e);
+      } else {
+        markUnboxed(st.ex.get());
+      }
+      count(st.ex.get());
+    }
+    return true;
+  }
+  void TypeInference::report(
+      std::ostream& out, const std::vector<std::string>& slotNames) const {
+    for (const Statement& st : statements) {
+      std::string t = typeName(st.ex == nullptr ? 0 : st.ex->type);
+      out << t << std::string(t.size() < 16 ? 16 - t.size() : 1, ' ');
+      st.trace(out);
+      out << "\n";
+    }
+    out << "\nVariables:\n";
+    for (size_t i = 0; i < slotCount; ++i)
+      out << "  " << slotNames[i] << ": " << typeName(variables[i]) << "\n";
+    out << "\n" << expressions << " expressions: " << integers
+      << " always integers (" << unboxed << " unboxed), " << strings
+      << " always strings, " << lists << " always lists\n";
+  }
+}
@@ -0,0 +1,204 @@
+#include "Value.h"
+
+#include <iostream>
+
+namespace x666 {
+  // Concatenations shorter than this are copied into a new flat
+  // buffer instead of creating a rope node.
+  constexpr size_t flatConcatLimit = 128;
+  /**
+   * A string representation: either a flat buffer (left == nullptr)
+   * or a rope node whose contents are left followed by right.
+   * Flattening a node replaces it with a flat buffer in place.
+   */
+  struct String::Rep {
+    Rep(std::string&& s) : buf(std::move(s)), len(buf.size()) {}
+    Rep(std::shared_ptr<Rep> l, std::shared_ptr<Rep> r) :
+      left(std::move(l)), right(std::move(r)),
+      len(left->len + right->len) {}
+    ~Rep();
+    bool isFlat() const { return left == nullptr; }
+    void flatten();
+    std::string buf;
+    std::shared_ptr<Rep> left, right;
+    size_t len;
+  };
+  // Release rope nodes iteratively; a rope built by a loop can be
+  // millions of nodes deep.
+  static void releaseAll(std::vector<std::shared_ptr<String::Rep>>& pending) {
+    while (!pending.empty()) {
+      std::shared_ptr<String::Rep> r = std::move(pending.back());
+      pending.pop_back();
+      if (r.use_count() == 1) {
+        if (r->left != nullptr) pending.push_back(std::move(r->left));
+        if (r->right != nullptr) pending.push_back(std::move(r->right));
+      }
+    }
+  }
+  String::Rep::~Rep() {
+    if (isFlat()) return;
+    std::vector<std::shared_ptr<Rep>> pending;
+    pending.push_back(std::move(left));
+    pending.push_back(std::move(right));
+    releaseAll(pending);
+  }
+  void String::Rep::flatten() {
+    if (isFlat()) return;
+    std::string s;
+    s.reserve(len);
+    std::vector<const Rep*> stack{this};
+    while (!stack.empty()) {
+      const Rep* r = stack.back();
+      stack.pop_back();
+      if (r->isFlat()) {
+        s += r->buf;
+      } else {
+        stack.push_back(r->right.get());
+        stack.push_back(r->left.get());
+      }
+    }
+    buf = std::move(s);
+    std::vector<std::shared_ptr<Rep>> pending;
+    pending.push_back(std::move(left));
+    pending.push_back(std::move(right));
+    left = nullptr;
+    right = nullptr;
+    releaseAll(pending);
+  }
+  String::String() : rep(std::make_shared<Rep>(std::string())) {}
+  String::String(std::string&& s) :
+    rep(std::make_shared<Rep>(std::move(s))) {}
+  String::String(const std::string& s) :
+    rep(std::make_shared<Rep>(std::string(s))) {}
+  size_t String::size() const {
+    return rep->len;
+  }
+  const std::string& String::flat() const {
+    rep->flatten();
+    return rep->buf;
+  }
+  int String::compare(const String& other) const {
+    return flat().compare(other.flat());
+  }
+  String String::concat(String a, const String& b) {
+    if (b.empty()) return a;
+    if (a.empty()) return b;
+    if (a.rep.use_count() == 1 && a.rep->isFlat()) {
+      // Nobody else can see a, so append to its buffer in place.
+      a.rep->buf += b.flat();
+      a.rep->len = a.rep->buf.size();
+      return a;
+    }
+    if (a.size() + b.size() < flatConcatLimit) {
+      return String(a.flat() + b.flat());
+    }
+    return String(std::make_shared<Rep>(a.rep, b.rep));
+  }
+  // The digits of 00 to 99, for formatInteger to take two at a time
+  static const char digitPairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  char* formatInteger(int64_t n, char* end) {
+    uint64_t u = n < 0 ? 0 - (uint64_t) n : (uint64_t) n;
+    char* p = end;
+    while (u >= 100) {
+      const char* pair = digitPairs + (u % 100) * 2;
+      u /= 100;
+      *--p = pair[1];
+      *--p = pair[0];
+    }
+    if (u >= 10) {
+      *--p = digitPairs[u * 2 + 1];
+      *--p = digitPairs[u * 2];
+    } else {
+      *--p = (char) ('0' + u);
+    }
+    if (n < 0) *--p = '-';
+    return p;
+  }
+  Value::Value(BigInt&& n) {
+    int64_t small;
+    if (n.toInt64(small)) {
+      v = small;
+    } else {
+      v = std::make_shared<const BigInt>(std::move(n));
+    }
+  }
+  BigInt Value::toBigInt() const {
+    return isInt() ? BigInt(std::get<0>(v)) : *std::get<3>(v);
+  }
+  bool Value::truthy() const {
+    switch (v.index()) {
+      case 0: return std::get<0>(v) != 0;
+      case 1: return !std::get<1>(v).empty();
+      case 2: return !std::get<2>(v)->empty();
+      case 3: return true; // never zero; zero fits in int64_t
+    }
+    return false;
+  }
+  bool Value::toString(String& out) const {
+    switch (v.index()) {
+      case 0: out = String(std::to_string(std::get<0>(v))); return true;
+      case 1: out = std::get<1>(v); return true;
+      case 3: out = String(std::get<3>(v)->toString()); return true;
+    }
+    return false;
+  }
+  void Value::print(std::ostream& out) const {
+    switch (v.index()) {
+      case 0: {
+        char digits[20];
+        char* end = digits + sizeof(digits);
+        char* start = formatInteger(std::get<0>(v), end);
+        out.write(start, end - start);
+        break;
+      }
+      case 1: {
+        const std::string& s = std::get<1>(v).flat();
+        out.write(s.data(), s.size());
+        break;
+      }
+      case 3: out << std::get<3>(v)->toString(); break;
+      case 2: {
+        out << "(";
+        const List& l = *std::get<2>(v);
+        for (size_t i = 0; i < l.size(); ++i) {
+          if (i != 0) out << ", ";
+          if (l.isPacked()) out << l.integers()[i];
+          else l.at(i).print(out);
+        }
+        out << ")";
+        break;
+      }
+    }
+  }
+  void List::reserve(size_t n) {
+    if (packed) ints.reserve(n);
+    else values.reserve(n);
+  }
+  void List::push(Value&& v) {
+    if (packed && v.isInt()) {
+      ints.push_back(std::get<int64_t>(v.v));
+      return;
+    }
+    if (packed) box();
+    values.push_back(std::move(v));
+  }
+  void List::append(const int64_t* p, size_t n) {
+    if (packed) {
+      ints.insert(ints.end(), p, p + n);
+      return;
+    }
+    values.reserve(values.size() + n);
+    for (size_t i = 0; i < n; ++i) values.emplace_back(p[i]);
+  }
+  void List::box() {
+    values.reserve(ints.capacity());
+    for (int64_t n : ints) values.emplace_back(n);
+    std::vector<int64_t>().swap(ints);
+    packed = false;
+  }
+}
@@ -1,21 +1,380 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <variant>
 
+#include "Batch.h"
+#include "BlockLoader.h"
+#include "CBackend.h"
+#include "Farm.h"
+#include "HashCons.h"
+#include "IR.h"
+#include "Interpreter.h"
 #include "Lexer.h"
+#include "Module.h"
+#include "Output.h"
 #include "Parser.h"
+#include "Profile.h"
+#include "Resolver.h"
+#include "Server.h"
+#include "StreamBuffer.h"
+#include "Types.h"
+#include "x666.h"
 
-int main(int argc, char** argv) {
-  if (argc == 1) {
+// Collects diagnostics to be printed after a heading.
+struct DiagnosticLog : x666::DiagnosticSink {
+  void report(const x666::Diagnostic& d) override {
+    diagnostics.push_back(d);
+  }
+  std::vector<x666::Diagnostic> diagnostics;
+};
+
+// A file name of - means stdin.
+static std::string readFile(const char* fname) {
+  std::stringstream buffer;
+  if (strcmp(fname, "-") == 0) {
+    buffer << std::cin.rdbuf();
+  } else {
+    std::ifstream fh(fname);
+    buffer << fh.rdbuf();
+  }
+  return buffer.str();
+}
+
+// If out failed, say why. Returns true if it did.
+static bool writeFailed(const x666::FileOutput& out) {
+  if (!out.failed) return false;
+  std::cerr << "x666: can't write output: " << strerror(out.error) << "\n";
+  return true;
+}
+
+// If profile is set, print an annotated listing to stderr, and if
+// folded is too, write the samples there for flame graphs.
+static int runFile(
+    const char* fname, const x666::CompileOptions& compileOptions,
+    x666::RunOptions options, bool profile, const char* folded) {
+  DiagnosticLog log;
+  x666::ProgramHandle program =
+    x666::compile(readFile(fname), fname, log, compileOptions);
+  if (program == nullptr) {
+    std::cout << "Parsing failed:\n";
+    for (const x666::Diagnostic& d : log.diagnostics) d.print(std::cout);
+    return 0;
+  }
+  x666::FileOutput out(STDOUT_FILENO);
+  x666::Profile p(*program);
+  if (profile) {
+    options.profile = &p;
+    p.start();
+  }
+  bool ok = x666::run(*program, out, log, options);
+  if (profile) {
+    p.stop();
+    std::cout.flush();
+    p.listing(std::cerr);
+    if (folded != nullptr) {
+      std::ofstream fh(folded);
+      p.folded(fh);
+    }
+  }
+  bool failed = writeFailed(out);
+  if (!ok) {
+    for (const x666::Diagnostic& d : log.diagnostics) d.print(std::cout);
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
+
+// Parse each block body only when the program first gets to it.
+static int runLazy(
+    const char* fname, const x666::RunOptions& options,
+    const std::string& includeCache) {
+  std::string source = readFile(fname);
+  std::istringstream fh(source);
+  x666::BlockLoader loader(source, fname, includeCache);
+  bool ok = loader.load();
+  if (ok) {
+    x666::FileOutput file(STDOUT_FILENO);
+    x666::OutputBuffer buffer(
+      file, options.outputBuffer, options.flushLines,
+      options.outputThread);
+    std::ostream out(&buffer);
+    x666::Interpreter in(
+      loader.statements, loader.slotCount(), out, options.jit);
+    in.loadBlocksWith(&loader);
+    ok = in.run();
+    out.flush();
+    bool failed = writeFailed(file);
+    if (!ok && loader.errorLog.empty()) {
+      for (const x666::RuntimeError& re : in.errorLog) re.print(fh);
+      return 1;
+    }
+    if (!ok) {
+      // A body that doesn't parse stops the program where it is, after
+      // whatever it has printed, so it fails like a runtime error.
+      std::cout << "Parsing failed:\n";
+      for (const x666::LexError& le : loader.errorLog) le.print(fh);
+      return 1;
+    }
+    return failed ? 1 : 0;
+  }
+  std::cout << "Parsing failed:\n";
+  for (const x666::LexError& le : loader.errorLog) le.print(fh);
+  return 0;
+}
+
+// Run every file `copies` times, interleaved on a pool of threads.
+static int runFarm(
+    int argc, char** argv, size_t threads, size_t fuel, size_t limit,
+    size_t copies, const x666::CompileOptions& compileOptions) {
+  x666::Farm farm(threads, fuel, limit);
+  for (int i = 0; i < argc; ++i) {
+    DiagnosticLog log;
+    x666::ProgramHandle program =
+      x666::compile(readFile(argv[i]), argv[i], log, compileOptions);
+    if (program == nullptr) {
+      std::cout << argv[i] << ": Parsing failed:\n";
+      for (const x666::Diagnostic& d : log.diagnostics) d.print(std::cout);
+      return 1;
+    }
+    for (size_t j = 0; j < copies; ++j) farm.add(program);
+  }
+  farm.run();
+  int status = 0;
+  for (const auto& in : farm.instances()) {
+    std::cout << in->out.str();
+    if (in->status == x666::Interpreter::Status::failed) {
+      std::cout.flush();
+      std::istringstream source(in->program->source);
+      for (const x666::RuntimeError& re : in->interpreter.errorLog) {
+        re.print(source);
+      }
+      status = 1;
+    }
+    std::cerr << in->program->name << ": "
+      << in->interpreter.executed() << " statements, "
+      << in->slices << " slices, "
+      << in->cpuNanos / 1000000.0 << " ms\n";
+  }
+  return status;
+}
+
+static int runMain(int argc, char** argv) {
+  bool run = false;
+  bool emitIR = false;
+  bool emitC = false;
+  bool batch = false;
+  bool jit = true;
+  bool farm = false;
+  size_t threads = std::thread::hardware_concurrency();
+  size_t fuel = 10000;
+  size_t limit = 0;
+  size_t copies = 1;
+  bool serve = false;
+  bool client = false;
+  std::string socketPath = x666::defaultSocketPath();
+  size_t cacheMB = 256;
+  bool profile = false;
+  bool dedup = false;
+  bool lazy = false;
+  bool types = false;
+  const char* folded = nullptr;
+  x666::CompileOptions compileOptions;
+  // Like stdio, only write each line as it ends for a terminal
+  x666::RunOptions runOptions;
+  runOptions.flushLines = isatty(STDOUT_FILENO);
+  int argi = 1;
+  for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; ++argi) {
+    if (strcmp(argv[argi], "--run") == 0) {
+      run = true;
+    } else if (strcmp(argv[argi], "--emit-ir") == 0) {
+      emitIR = true;
+    } else if (strcmp(argv[argi], "--emit-c") == 0) {
+      emitC = true;
+    } else if (strcmp(argv[argi], "--batch") == 0) {
+      batch = true;
+    } else if (strcmp(argv[argi], "--no-jit") == 0) {
+      jit = false;
+    } else if (strcmp(argv[argi], "--farm") == 0) {
+      farm = true;
+    } else if (strcmp(argv[argi], "--threads") == 0 && argi + 1 < argc) {
+      threads = strtoul(argv[++argi], nullptr, 10);
+    } else if (strcmp(argv[argi], "--fuel") == 0 && argi + 1 < argc) {
+      fuel = strtoul(argv[++argi], nullptr, 10);
+    } else if (strcmp(argv[argi], "--limit") == 0 && argi + 1 < argc) {
+      limit = strtoul(argv[++argi], nullptr, 10);
+    } else if (strcmp(argv[argi], "--serve") == 0) {
+      serve = true;
+    } else if (strcmp(argv[argi], "--client") == 0) {
+      client = true;
+    } else if (strcmp(argv[argi], "--socket") == 0 && argi + 1 < argc) {
+      socketPath = argv[++argi];
+    } else if (strcmp(argv[argi], "--cache-mb") == 0 && argi + 1 < argc) {
+      cacheMB = strtoul(argv[++argi], nullptr, 10);
+    } else if (strcmp(argv[argi], "--dedup") == 0) {
+      dedup = true;
+    } else if (strcmp(argv[argi], "--types") == 0) {
+      types = true;
+    } else if (strcmp(argv[argi], "--lazy") == 0) {
+      run = lazy = true;
+    } else if (strcmp(argv[argi], "--profile") == 0) {
+      run = profile = true;
+    } else if (strcmp(argv[argi], "--folded") == 0 && argi + 1 < argc) {
+      run = profile = true;
+      folded = argv[++argi];
+    } else if (strcmp(argv[argi], "--output-kb") == 0 && argi + 1 < argc) {
+      runOptions.outputBuffer = strtoul(argv[++argi], nullptr, 10) << 10;
+    } else if (strcmp(argv[argi], "--flush-lines") == 0) {
+      runOptions.flushLines = true;
+    } else if (strcmp(argv[argi], "--writer-thread") == 0) {
+      runOptions.outputThread = true;
+    } else if (strcmp(argv[argi], "--copies") == 0 && argi + 1 < argc) {
+      copies = strtoul(argv[++argi], nullptr, 10);
+    } else if (strcmp(argv[argi], "--include-cache") == 0 &&
+        argi + 1 < argc) {
+      compileOptions.includeCache = argv[++argi];
+    } else {
+      std::cerr << "Unknown option " << argv[argi] << "\n";
+      return -1;
+    }
+  }
+  if (serve) {
+    x666::Server server(socketPath, cacheMB << 20);
+    return server.serve(std::cerr) ? 0 : 1;
+  }
+  if (argi == argc) {
     std::cerr << "Please give a file name\n";
     return -1;
   }
-  const char* fname = argv[1];
-  std::fstream fh(fname);
-  x666::Parser p(&fh);
+  if (lazy) {
+    // These need the whole program parsed before it runs.
+    const char* other =
+      types ? "--types" : dedup ? "--dedup" : profile ? "--profile" :
+      emitIR ? "--emit-ir" : emitC ? "--emit-c" : batch ? "--batch" :
+      farm ? "--farm" : nullptr;
+    if (other != nullptr) {
+      std::cerr << "--lazy can't be used with " << other << "\n";
+      return -1;
+    }
+  }
+  if (farm) {
+    if (fuel == 0) fuel = 1;
+    return runFarm(
+      argc - argi, argv + argi, threads, fuel, limit, copies,
+      compileOptions);
+  }
+  if (client && !emitIR && !emitC && !batch && !profile && !dedup &&
+      !lazy && !types) {
+    // Falls through to doing the work here if no server is running.
+    x666::Request request = !run ? x666::Request::trace :
+      jit ? x666::Request::run : x666::Request::runNoJit;
+    int status;
+    if (x666::sendRequest(
+        socketPath, request, argv[argi], readFile(argv[argi]), std::cout,
+        status))
+      return status;
+  }
+  runOptions.jit = jit;
+  if (lazy) {
+    return runLazy(argv[argi], runOptions, compileOptions.includeCache);
+  }
+  if (run && !emitIR && !emitC && !batch) {
+    compileOptions.hashCons = dedup;
+    return runFile(argv[argi], compileOptions, runOptions, profile, folded);
+  }
+  const char* fname = argv[argi];
+  bool fromStdin = strcmp(fname, "-") == 0;
+  if (fromStdin && batch) {
+    std::cerr << "--batch reads rows from stdin, so the program must be "
+      "a file\n";
+    return -1;
+  }
+  // A trace only looks at each statement once, so it can parse stdin
+  // as it arrives; the other modes need all of it. Nothing is printed
+  // until the end, though, since the first line says whether all of
+  // it parsed: until then a plain trace keeps the text it will print,
+  // not the statements.
+  bool streaming = fromStdin && !emitIR && !emitC;
+  std::ostringstream traced;
+  x666::StreamBuffer input(0);
+  std::istream stream(&input);
+  std::stringstream whole;
+  std::fstream file;
+  std::istream* fhp = &file;
+  if (streaming) {
+    fhp = &stream;
+  } else if (fromStdin) {
+    whole.str(readFile(fname));
+    fhp = &whole;
+  } else {
+    file.open(fname);
+  }
+  std::istream& fh = *fhp;
+  x666::Includes includes(fname, compileOptions.includeCache);
+  x666::Parser p(&fh, streaming ? &input : nullptr);
+  p.includes = &includes;
+  if (streaming && !dedup && !types) p.traceTo = &traced;
   p.parse();
+  x666::Resolver r(p.statements);
+  if ((emitIR || emitC || batch || types) && p.errorLog.empty())
+    r.resolve(p.errorLog, batch);
   if (p.errorLog.empty()) {
-    std::cout << "Compilation succeeded\n";
+    if (batch) {
+      // Rows come from stdin; the program's free variables are columns.
+      x666::Batch b(p.statements, r.slotNames, r.inputSlots);
+      std::vector<x666::RuntimeError> errors;
+      if (!b.compile(errors)) {
+        for (const x666::RuntimeError& re : errors) {
+          re.print(fh);
+        }
+        return 1;
+      }
+      return b.run(std::cin, std::cout, fh) ? 0 : 1;
+    }
+    if (emitC) {
+      std::vector<x666::RuntimeError> errors;
+      if (!x666::emitC(p.statements, r.slotNames, fname, std::cout, errors)) {
+        for (const x666::RuntimeError& re : errors) {
+          re.print(fh);
+        }
+        return 1;
+      }
+      return 0;
+    }
+    if (emitIR) {
+      x666::ir::Function f;
+      std::vector<x666::RuntimeError> errors;
+      if (!x666::ir::build(p.statements, r.slotNames, f, errors)) {
+        for (const x666::RuntimeError& re : errors) {
+          re.print(fh);
+        }
+        return 1;
+      }
+      x666::ir::optimize(f);
+      f.dump(std::cout);
+      return 0;
+    }
+    if (dedup) {
+      // Only the report shows: the trace is the same either way.
+      x666::HashConser h(p.statements);
+      h.run();
+      h.report(std::cerr);
+    }
+    std::cout << "Compilation succeeded\n" << traced.str();
+    if (types) {
+      x666::TypeInference t(p.statements, r.slotCount());
+      if (t.run()) {
+        t.report(std::cout, r.slotNames);
+        return 0;
+      }
+      std::cerr << "Blocks don't match up, so no types were inferred\n";
+    }
     for (const x666::Statement& st : p.statements) {
       st.trace();
       std::cout << "\n";
@@ -27,4 +386,32 @@ int main(int argc, char** argv) {
     }
   }
   return 0;
-}
\ No newline at end of file
+}
+
+// Run on a stack of x666::threadStackSize, like the server's threads,
+// so that every way of running a program has the same room to recurse.
+
+struct MainArguments {
+  int argc;
+  char** argv;
+  int status;
+};
+
+static void* runMainThread(void* p) {
+  MainArguments* args = static_cast<MainArguments*>(p);
+  args->status = runMain(args->argc, args->argv);
+  return nullptr;
+}
+
+int main(int argc, char** argv) {
+  MainArguments args = {argc, argv, 0};
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, x666::threadStackSize);
+  pthread_t thread;
+  bool started = pthread_create(&thread, &attr, runMainThread, &args) == 0;
+  pthread_attr_destroy(&attr);
+  if (!started) return runMain(argc, argv);
+  pthread_join(thread, nullptr);
+  return args.status;
+}
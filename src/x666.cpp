@@ -0,0 +1,87 @@
+#include "x666.h"
+
+#include <ostream>
+#include <sstream>
+
+#include "HashCons.h"
+#include "Interpreter.h"
+#include "Module.h"
+#include "Output.h"
+#include "Parser.h"
+#include "Program.h"
+#include "Resolver.h"
+#include "Types.h"
+
+namespace x666 {
+  void Diagnostic::print(std::ostream& out) const {
+    if (kind == Kind::runtime) out << "Runtime error";
+    else out << "Error";
+    if (!file.empty()) out << " in " << file;
+    out << " at line " << line << " column " << column << ": ";
+    out << message << "\n" << snippet;
+  }
+  template<typename E>
+  static Diagnostic diagnose(
+      Diagnostic::Kind kind, const E& e, const char* messages[],
+      const std::string& source) {
+    Diagnostic d;
+    d.kind = kind;
+    d.line = e.li.line + 1;
+    d.column = e.li.col + 1;
+    d.message = messages[(int) e.c];
+    const Module* m = includedFile(e.li.file);
+    if (m != nullptr) d.file = m->path;
+    std::istringstream fh(source);
+    std::ostringstream snippet;
+    printSnippet(fh, e.li, snippet);
+    d.snippet = snippet.str();
+    return d;
+  }
+  ProgramHandle compile(
+      std::string source, std::string name, DiagnosticSink& diagnostics,
+      const CompileOptions& options) {
+    auto program = std::make_shared<Program>();
+    program->name = std::move(name);
+    program->source = std::move(source);
+    std::istringstream fh(program->source);
+    Includes includes(
+      program->name, options.includeCache, options.workingDirectory);
+    Parser p(&fh);
+    p.includes = &includes;
+    p.parse();
+    Resolver r(p.statements);
+    if (p.errorLog.empty()) r.resolve(p.errorLog);
+    if (!p.errorLog.empty()) {
+      for (const LexError& le : p.errorLog) {
+        diagnostics.report(diagnose(
+          Diagnostic::Kind::parse, le, lexErrorMessages, program->source));
+      }
+      return nullptr;
+    }
+    if (options.hashCons) HashConser(p.statements).run();
+    TypeInference(p.statements, r.slotCount()).run();
+    program->statements = std::move(p.statements);
+    program->slotNames = std::move(r.slotNames);
+    program->included.assign(
+      includes.modules().begin(), includes.modules().end());
+    return program;
+  }
+  bool run(
+      const Program& program, OutputSink& out, DiagnosticSink& diagnostics,
+      const RunOptions& options) {
+    OutputBuffer buffer(
+      out, options.outputBuffer, options.flushLines, options.outputThread);
+    std::ostream os(&buffer);
+    Interpreter in(
+      program.statements, program.slotNames.size(), os, options.jit);
+    in.profileWith(options.profile);
+    bool ok = in.run();
+    os.flush();
+    for (const RuntimeError& re : in.errorLog) {
+      diagnostics.report(diagnose(
+        Diagnostic::Kind::runtime, re, runtimeErrorMessages,
+        program.source));
+    }
+    return ok;
+  }
+}
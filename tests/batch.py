@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# Check x666 --batch against running the program once per row.
+# Run with: tests/batch.py [path/to/x666]
+#
+# Each program is run over rows of inputs that the kernels handle
+# (small ints, 0, masks that differ row to row) and rows that they hand
+# to the interpreter: overflow, division by zero, a variable read
+# before it is assigned, an input that is too big or not an integer,
+# or a missing column. The rows are repeated past Batch::blockSize, so
+# that rows which fall back sit in more than one block. The expected
+# output for a row is what --run prints for the program with the
+# inputs assigned on its first line, which --batch leaves as a
+# comment. Exits with status 1 if any case fails.
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+x666 = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else "./x666")
+failures = 0
+
+# name: (inputs, program without its first line)
+programs = {
+    "masks": ("a,b,c",
+        "s<-a*b-c\n"
+        "??s>1000&b/=0\n"
+        "  s<-s/b\n"
+        "?&s<0|c=7\n"
+        "  s<-0\n"
+        "!!\n"
+        "  s%<-7\n"
+        "&>\n"
+        "#>(s%2=0)?s:-s\n"
+        "#>!a|b=0\n"),
+    "arithmetic": ("a,b",
+        "#>a+b\n"
+        "#>a-b\n"
+        "#>a*b\n"
+        "#>-a\n"
+        "#>a/b\n"
+        "#>a%b\n"),
+    "conditionally assigned": ("a,b",
+        "??a>0\n"
+        "  t<-a\n"
+        "?&-1>a\n"
+        "  t<-b\n"
+        "&>\n"
+        "#>t+b\n"),
+}
+values = ["0", "1", "-1", "2", "7", "-7", "1000", "4611686018427387904",
+    "9223372036854775807", "-9223372036854775808",
+    "99999999999999999999", "-99999999999999999999", "x", ""]
+# Mostly values the kernels run, so that each block has both kinds
+common = ["0", "1", "-1", "2", "7", "-7", "1000", "3", "12", "-40"]
+
+# The x666 for an input cell, as Batch::runRow binds it
+def literal(cell):
+    if cell == "-9223372036854775808":
+        return "-9223372036854775807-1"
+    if cell.lstrip("-").isdigit():
+        return cell
+    return '"' + cell + '"'
+
+def x666run(path):
+    p = subprocess.run([x666, "--run", path], stdout=subprocess.PIPE,
+        stderr=subprocess.DEVNULL, timeout=60)
+    return p.stdout.decode(), p.returncode
+
+random.seed(666)
+with tempfile.TemporaryDirectory() as d:
+    path = os.path.join(d, "p.666")
+    rowsPath = os.path.join(d, "rows.csv")
+    for name, (columns, body) in programs.items():
+        names = columns.split(",")
+        rows = []
+        for _ in range(60):
+            rows.append([random.choice(common) for _ in names])
+        for _ in range(40):
+            rows.append([random.choice(values) for _ in names])
+        rows.append(["1"] * (len(names) - 1)) # Missing a column
+        # What each distinct row prints on its own
+        expected = {}
+        for row in rows:
+            key = ",".join(row)
+            if key in expected:
+                continue
+            if len(row) < len(names):
+                expected[key] = None
+                continue
+            with open(path, "w") as f:
+                f.write(",".join("%s<-%s" % (n, literal(v))
+                    for n, v in zip(names, row)) + "\n" + body)
+            expected[key] = x666run(path)
+        with open(path, "w") as f:
+            f.write("## " + columns + "\n" + body)
+        copies = 1 + 1500 // len(rows)
+        want, status = "", 0
+        with open(rowsPath, "w") as f:
+            f.write(columns + "\n")
+            line = 1
+            for _ in range(copies):
+                for row in rows:
+                    key = ",".join(row)
+                    f.write(key + "\n")
+                    line += 1
+                    if expected[key] is None:
+                        want += "Row error at input line %d: no column %s\n" \
+                            % (line, names[-1])
+                        status = 1
+                    else:
+                        out, rc = expected[key]
+                        want += out
+                        if rc != 0:
+                            status = 1
+        with open(rowsPath) as rowsFile:
+            p = subprocess.run([x666, "--batch", path], stdin=rowsFile,
+                stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                timeout=120)
+        got = p.stdout.decode()
+        if got != want or p.returncode != status:
+            failures += 1
+            print("%s: got status %d, expected %d" %
+                (name, p.returncode, status))
+            for i, (a, b) in enumerate(zip(got.splitlines(),
+                    want.splitlines())):
+                if a != b:
+                    print("  first difference at output line %d:\n"
+                        "    got      %r\n    expected %r" % (i + 1, a, b))
+                    break
+
+sys.exit(1 if failures else 0)
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# Check the C backend against the interpreter: compile the output of
+# x666 --emit-c for each program with cc -Wall -Wextra -Werror, run it,
+# and compare its output and exit status with x666 --run.
+# Run with: tests/cbackend.py path/to/cc [path/to/x666]
+#
+# The C runtime prints the line of a runtime error but not the snippet
+# of source under it, so those two lines are left out of --run's
+# output. Exits with status 1 if any case fails.
+import os
+import subprocess
+import sys
+import tempfile
+
+cc = sys.argv[1]
+x666 = os.path.abspath(sys.argv[2] if len(sys.argv) > 2 else "./x666")
+runtime = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+    "..", "runtime")
+failures = 0
+
+programs = {
+    "arithmetic": (
+        "#>2+3*4-5\n#>-7/2\n#>-7%2\n#>7%-2\n#>-(3-10)\n"
+        "#>1=1\n#>1/=1\n#>2<3\n#>2>3\n#>2<=2\n#>3>=4\n#>!0\n#>!5\n"
+        "#>3&0\n#>3&4\n#>0|5\n#>0|0\n#>1?2:3\n#>0?2:3\n"),
+    "strings": (
+        "s<-\"ab\"\n#>s~\"cd\"\n#>s~1\n#>#s\n#>s=\"ab\"\n#>s/=\"ab\"\n"
+        "t<-\"\"\n@#i,1,5\n  t~<-i\n&>\n#>t\n#>\"tab\\there\"\n"),
+    "lists": (
+        "l<-[1,2,3]\n#>l\n#>l[0]+l[2]\n#>#l\n"
+        "m<-[\"a\",[5,6]]\n#>m[1][0]\n#>[]\n"),
+    "big integers": (
+        "a<-99999999999999999999\n#>a\n#>a+1\n#>a*a\n#>-a\n#>a/7\n#>a%7\n"
+        "#>a-a\n#>a>1\n#>a=a\n#>9223372036854775807+1\n"
+        "#>-9223372036854775807-2\n#>4611686018427387904*2\n"
+        "#>(-9223372036854775807-1)/-1\n#>-(-9223372036854775807-1)\n"),
+    "promotion in a loop": (
+        "t<-1\n@#i,1,100\n  t*<-3\n&>\n#>t\n#>t%1000000007\n"
+        "@t>10\n  t/<-1000\n&>\n#>t\n"),
+    "conditions": (
+        "@#i,1,15\n  ??i%15=0\n    #>\"fizzbuzz\"\n  ?&i%5=0\n"
+        "    #>\"buzz\"\n  ?&i%3=0\n    #>\"fizz\"\n  !!\n    #>i\n  &>\n&>\n"),
+    "loops": (
+        "i<-0\n@i<5\n  i+<-1\n&>\n#>i\n@@i=0\n  i-<-1\n&>\n#>i\n"
+        "@#j,10,1,-4\n  #>j\n&>\n#>j\n"),
+    "division by zero": "#>1\nx<-0\n#>10/x\n#>2\n",
+    "big division by zero": "#>99999999999999999999%0\n",
+    "wrong type": "#>1\n#>\"a\"-1\n",
+    "index out of range": "l<-[1,2]\n#>l[1]\n#>l[2]\n",
+    "unassigned variable": "??0\n  x<-1\n&>\n#>1\n#>2 + x\n",
+    "compound assignment of an unassigned variable": (
+        "??0\n  x<-1\n&>\n  x+<-1\n"),
+    "zero step": "@#i,1,5,0\n  #>i\n&>\n",
+    "for step overflows": (
+        "@#i,9223372036854775806,9223372036854775807\n  #>i\n&>\n"),
+    "big for bound": "@#i,1,99999999999999999999\n  #>i\n&>\n",
+    "swap in a loop": (
+        "a<-1\nb<-\"x\"\n@#i,1,5\n  t<-a\n  a<-b\n  b<-t\n&>\n#>a\n#>b\n"),
+    "string grown and read": (
+        "s<-\"\"\n@#i,1,200\n  s~<-i%10\n  ??#s%50=0\n    #>s\n  &>\n"
+        "&>\n#>#s\n"),
+    "lists shared": "l<-[1,[2]]\nm<-l\n@#i,1,3\n  m<-[m,l]\n&>\n#>m\n",
+    "error in a while condition": (
+        "i<-3\n@10/i>1\n  i-<-1\n&>\n#>i\n"),
+    "loop variable made a string": (
+        "@#i,1,30\n  ??i=20\n    i<-\"x\"\n  &>\n&>\n"),
+    "unassigned in a loop": (
+        "@#i,1,5\n  ??i=3\n    #>u\n  &>\n  ??i=4\n    u<-1\n  &>\n&>\n"),
+}
+
+with tempfile.TemporaryDirectory() as d:
+    path = os.path.join(d, "p.666")
+    cPath = os.path.join(d, "p.c")
+    binary = os.path.join(d, "p")
+    for name, text in programs.items():
+        with open(path, "w") as f:
+            f.write(text)
+        p = subprocess.run([x666, "--run", path], stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL, timeout=60)
+        expected = []
+        lines = p.stdout.decode().splitlines(True)
+        i = 0
+        while i < len(lines):
+            expected.append(lines[i])
+            i += 3 if lines[i].startswith("Runtime error") else 1
+        expected = ("".join(expected), p.returncode)
+        with open(cPath, "w") as f:
+            subprocess.run([x666, "--emit-c", path], stdout=f, check=True,
+                timeout=60)
+        build = subprocess.run(
+            [cc, "-Wall", "-Wextra", "-Werror", "-I", runtime, "-o", binary,
+                cPath], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+            timeout=120)
+        if build.returncode != 0:
+            failures += 1
+            print("%s: the C doesn't compile:\n%s" %
+                (name, build.stdout.decode()))
+            continue
+        p = subprocess.run([binary], stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL, timeout=60)
+        got = (p.stdout.decode(), p.returncode)
+        if got != expected:
+            failures += 1
+            print("%s: --run gave status %d and output:\n%s"
+                "the C gave status %d and output:\n%s" %
+                (name, expected[1], expected[0], got[1], got[0]))
+
+sys.exit(1 if failures else 0)
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# Check that the JIT doesn't change what programs do: run each loop
+# program with and without --no-jit and compare the output and exit
+# status, then the same with --profile, comparing how many times it
+# counted each line too. Run with: tests/jit.py [path/to/x666]
+#
+# A loop is compiled once it has gone round 8 times, so each one here
+# runs for longer than that, and most only print after they finish
+# (loops that print aren't compiled). The cases cover native code for
+# each loop kind, deopts back to the interpreter on overflow (where
+# the value goes on as a BigInt) and on errors, and loops that deopt
+# until they are given up on. Exits with status 1 if any case fails.
+import os
+import subprocess
+import sys
+import tempfile
+
+x666 = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else "./x666")
+failures = 0
+
+# The count and source columns of a --profile listing, without the
+# samples, which vary from run to run
+def counts(listing):
+    return "".join(line[:10] + line[27:] + "\n"
+        for line in listing.splitlines()[1:])
+
+programs = {
+    "while": (
+        "t<-0\ni<-0\n@i<1000\n  t+<-i%7*3-i/5\n  i+<-1\n&>\n#>t\n#>i\n"),
+    "negative operands": (
+        "t<-0\ni<--500\n@i<=700\n  t+<-i/7+i%7-(-i)%3\n  i+<-1\n&>\n"
+        "#>t\n"),
+    "repeat until": (
+        "i<-0\nt<-1\n@@i>=50\n  t<-t*3%1000003\n  i+<-1\n&>\n#>t\n"),
+    "repeat runs once": "i<-100\n@@i>50\n  i+<-1\n&>\n#>i\n",
+    "for": "t<-0\n@#i,1,1000\n  t+<-i*i\n&>\n#>t\n#>i\n",
+    "for with a negative step": (
+        "t<-0\n@#i,100,1,-3\n  t<-t*2+i\n  t%<-1000007\n&>\n#>t\n#>i\n"),
+    "for with a step past the end": (
+        "t<-0\n@#i,1,100,7\n  t+<-i\n&>\n#>t\n#>i\n"),
+    "for that doesn't run": "t<-5\n@#i,10,1\n  t<-0\n&>\n#>t\n",
+    "for near the top of int64": (
+        "t<-0\n@#i,9223372036854775700,9223372036854775790,10\n"
+        "  t+<-i%1000\n&>\n#>t\n#>i\n"),
+    "for near the bottom of int64": (
+        "t<-0\n@#i,-9223372036854775700,-9223372036854775790,-10\n"
+        "  t+<-1\n&>\n#>t\n"),
+    "overflow to BigInt": (
+        "t<-1\ni<-0\n@i<100\n  t*<-3\n  i+<-1\n&>\n#>t\n#>i\n"),
+    "overflow in the middle of a statement": (
+        "t<-1\nu<-0\ni<-0\n@i<80\n  u<-t*2-t\n  t*<-2\n  i+<-1\n&>\n"
+        "#>t\n#>u\n"),
+    "overflow then back to ints": (
+        "n<-0\nt<-0\n@#k,1,30\n  t<-1\n  i<-0\n  @i<70\n    t*<-2\n"
+        "    i+<-1\n  &>\n  n+<-t%1000\n&>\n#>n\n"),
+    "negating the smallest int64": (
+        "m<--9223372036854775807-1\ni<-0\nt<-0\n@i<20\n"
+        "  ??i=15\n    t<--m\n  !!\n    t<-i\n  &>\n  i+<-1\n&>\n#>t\n"),
+    "smallest int64 over -1": (
+        "m<--9223372036854775807-1\ni<-0\nt<-0\n@i<20\n"
+        "  ??i=15\n    t<-m/(0-1)\n  &>\n  i+<-1\n&>\n#>t\n"),
+    "division by zero": (
+        "t<-0\ni<-10\n@i>-10\n  t+<-100/i\n  i-<-1\n&>\n#>t\n"),
+    "modulo by zero": (
+        "t<-0\ni<-10\n@i>-10\n  t+<-100%i\n  i-<-1\n&>\n#>t\n"),
+    "for step overflows": (
+        "t<-0\n@#i,9223372036854775700,9223372036854775807,5\n"
+        "  t+<-1\n&>\n#>t\n"),
+    "short-circuit and": (
+        "t<-0\n@#i,-20,20\n  ??i/=0&100/i>3\n    t+<-1\n  &>\n&>\n#>t\n"),
+    "short-circuit or": (
+        "t<-0\n@#i,-20,20\n  ??i=0|100/i>3\n    t+<-1\n  &>\n&>\n#>t\n"),
+    "and or values": (
+        "t<-0\n@#i,0,40\n  t+<-(i%3&i%5)+(i%4|i%6)*10\n&>\n#>t\n"),
+    "conditions": (
+        "a<-0\nb<-0\nc<-0\n@#i,0,99\n  ??i%15=0\n    a+<-1\n"
+        "  ?&i%5=0\n    b+<-1\n  ?&!(i%3)\n    c+<-1\n  !!\n"
+        "    c-<-1\n  &>\n  a+<-(i<=50)+(i>=50)*2+(i/=7)\n&>\n"
+        "#>a\n#>b\n#>c\n"),
+    "ternary": (
+        "t<-0\n@#i,0,50\n  t+<-(i%2=0)?i:-i\n&>\n#>t\n"),
+    "nested loops": (
+        "t<-0\n@#i,1,30\n  j<-0\n  @j<i\n    t+<-i*j\n    j+<-1\n  &>\n"
+        "&>\n#>t\n"),
+    "printing loop": "@#i,1,20\n  #>i*i\n&>\n",
+    "type change": (
+        "t<-0\ni<-0\n@i<30\n  ??i=20\n    t<-\"s\"\n  !!\n    t<-i\n"
+        "  &>\n  i+<-1\n&>\n#>t\n"),
+    "string in the loop": (
+        "t<-0\ni<-0\n@i<30\n  t+<-i\n  i+<-1\n  ??i=25\n    t<-t~\"!\"\n"
+        "  &>\n&>\n#>t\n"),
+    "unassigned variable": (
+        "t<-0\ni<-0\n@i<30\n  ??i=40\n    u<-1\n  &>\n  ??i>20\n"
+        "    t+<-u\n  &>\n  i+<-1\n&>\n#>t\n"),
+    "loop variable made a string": (
+        "t<-0\n@#i,1,30\n  t+<-i\n  ??i=20\n    i<-\"x\"\n  &>\n&>\n#>t\n"),
+}
+
+with tempfile.TemporaryDirectory() as d:
+    path = os.path.join(d, "p.666")
+    for name, text in programs.items():
+        with open(path, "w") as f:
+            f.write(text)
+        for mode in ["--run", "--profile"]:
+            results = []
+            for options in [[], ["--no-jit"]]:
+                try:
+                    p = subprocess.run(
+                        [x666, mode] + options + [path],
+                        stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                        timeout=60)
+                    out = p.stdout.decode()
+                    if mode == "--profile":
+                        out += counts(p.stderr.decode())
+                    results.append((out, p.returncode))
+                except subprocess.TimeoutExpired:
+                    results.append(("(timed out)\n", -1))
+            if results[0] != results[1]:
+                failures += 1
+                print("%s %s: with the JIT, status %d and output:\n%s"
+                    "without it, status %d and output:\n%s" %
+                    (name, mode, results[0][1], results[0][0],
+                        results[1][1], results[1][0]))
+
+sys.exit(1 if failures else 0)
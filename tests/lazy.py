@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+# Check how x666 --lazy reports errors in block bodies it parses late.
+# Run with: tests/lazy.py [path/to/x666]
+#
+# A body is only parsed when the program gets to it, so its errors come
+# after whatever ran before it, and the exit status is 1 as for a
+# runtime error. Options that need the whole program parsed up front
+# are refused. Exits with status 1 if any case fails.
+import os
+import subprocess
+import sys
+import tempfile
+
+x666 = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else "./x666")
+failures = 0
+
+# name: (program, options, expected stdout, expected status)
+cases = {
+    "late parse error": (
+        "#> 1\n?? 1\n  x <- \n&>\n#> 2\n", [],
+        "1\nParsing failed:\n"
+        "Error at line 3 column 4: Right operand missing\n"
+        "  x <- \n ^~\n", 1),
+    "unreached parse error": (
+        "#> 1\n?? 0\n  x <- \n&>\n#> 2\n", [], "1\n2\n", 0),
+    "runtime error in a body": (
+        "#> 1\n?? 1\n  #> 1 / 0\n&>\n", [], None, 1),
+}
+for option in ["--types", "--dedup", "--profile", "--emit-ir", "--emit-c",
+    "--batch", "--farm"]:
+    cases["with " + option] = ("#> 1\n", [option], "", 255)
+
+with tempfile.TemporaryDirectory() as d:
+    path = os.path.join(d, "p.666")
+    for name, (text, options, expected, status) in cases.items():
+        with open(path, "w") as f:
+            f.write(text)
+        p = subprocess.run(
+            [x666, "--lazy"] + options + [path], stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL, timeout=60)
+        out = p.stdout.decode()
+        if p.returncode != status or (expected is not None and
+            out != expected):
+            failures += 1
+            print("%s: got status %d and output:\n%s" %
+                (name, p.returncode, out))
+
+sys.exit(1 if failures else 0)
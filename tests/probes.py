@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+# Check that an x666 built with X666_PROBES has every probe listed in
+# include/Probes.h, by reading its .note.stapsdt section.
+# Run with: tests/probes.py path/to/readelf [path/to/x666]
+# Exits with status 1 if any probe is missing.
+import os
+import subprocess
+import sys
+
+readelf = sys.argv[1]
+x666 = os.path.abspath(sys.argv[2] if len(sys.argv) > 2 else "./x666")
+probes = {
+    "token", "accept", "fold", "commit", "lex_error", "runtime_error",
+    "parse_start", "parse_done", "resolve_start", "resolve_done",
+    "run_start", "run_done",
+}
+
+notes = subprocess.run(
+    [readelf, "-n", x666], stdout=subprocess.PIPE, check=True,
+    timeout=60).stdout.decode()
+found = set()
+provider = None
+for line in notes.splitlines():
+    line = line.strip()
+    if line.startswith("Provider: "):
+        provider = line[len("Provider: "):]
+    elif line.startswith("Name: ") and provider == "x666":
+        found.add(line[len("Name: "):])
+missing = sorted(probes - found)
+if missing:
+    print("Missing probes: " + ", ".join(missing))
+sys.exit(1 if missing else 0)
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Check that x666 --client prints what x666 does by itself.
+# Run with: tests/server.py [path/to/x666]
+#
+# Starts a server on a socket of its own, then runs each case directly
+# and through the server from the same directory, comparing output and
+# exit status: the programs in examples/, some that fail to parse or to
+# run, and programs that include others with #<. Those cases edit the
+# files they include between runs, to catch the server answering from a
+# stale cache. Exits with status 1 if any case differs, or if the server
+# has died by the end.
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+x666 = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else "./x666")
+modes = [[], ["--run"], ["--run", "--no-jit"]]
+examples = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+    "..", "examples")
+failures = 0
+
+# name: program
+programs = {
+    "loop": "s <- 0\n@# i, 1, 100000\n  s +<- i\n&>\n#> s\n",
+    "big integers": "x <- 9223372036854775807\n#> x + x\n#> -x * x\n",
+    "strings": "a <- \"beo \" ~ \"ponno\"\n#> a\n#> a ~ 3\n",
+    "parse error": "x <- \n#> 1\n",
+    "runtime error": "#> 1\n#> 1 / 0\n#> 2\n",
+    "unassigned variable": "#> y\n",
+    # As deep as programs may nest (see maxNesting), and far deeper
+    "nesting at the limit": "#>" + "(" * 1999 + "1" + ")" * 1999 + "\n",
+    "deep nesting": "#>" + "(" * 200000 + "1" + ")" * 200000 + "\n",
+    "deep prefix chain": "#>" + "- " * 200000 + "1\n",
+}
+
+def write(path, text):
+    os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+    with open(path, "w") as f:
+        f.write(text)
+
+def invoke(args, cwd, stdin):
+    p = subprocess.run(
+        [x666] + args, cwd=cwd, input=stdin.encode() if stdin else None,
+        stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, timeout=60)
+    return p.stdout.decode(), p.returncode
+
+def check(name, args, cwd, stdin=None):
+    global failures
+    for mode in modes:
+        direct = invoke(mode + args, cwd, stdin)
+        client = invoke(
+            ["--client", "--socket", socket] + mode + args, cwd, stdin)
+        if direct != client:
+            failures += 1
+            print("%s %s differs:\n--- direct\n%s(%d)\n--- client\n%s(%d)"
+                % (name, " ".join(mode), direct[0], direct[1], client[0],
+                client[1]))
+
+with tempfile.TemporaryDirectory() as d:
+    socket = os.path.join(d, "x666.sock")
+    server = subprocess.Popen(
+        [x666, "--serve", "--socket", socket], stderr=subprocess.DEVNULL)
+    try:
+        for _ in range(100):
+            if os.path.exists(socket):
+                break
+            time.sleep(0.05)
+        else:
+            sys.exit("The server didn't start")
+        for name in sorted(os.listdir(examples)):
+            check(name, [os.path.join(examples, name)], examples)
+        for name, text in programs.items():
+            write(os.path.join(d, "p.666"), text)
+            check(name, ["p.666"], d)
+            check(name + " from stdin", ["-"], d, text)
+        write(os.path.join(d, "lib/h.666"), "x <- 5\n")
+        write(os.path.join(d, "main.666"), "#< \"lib/h.666\"\n#> x\n")
+        check("include", ["main.666"], d)
+        check("include from elsewhere", [os.path.join(d, "main.666")], "/")
+        check("include from stdin", ["-"], d, "#< \"lib/h.666\"\n#> x\n")
+        # Same main program, edited include
+        write(os.path.join(d, "lib/h.666"), "x <- 7\n")
+        check("edited include", ["main.666"], d)
+        write(os.path.join(d, "lib/h.666"), "x <- \n")
+        check("include with an error", ["main.666"], d)
+        # Errors name the file relative to where x666 was run
+        check("include with an error, from the parent",
+            [os.path.join(os.path.basename(d), "main.666")],
+            os.path.dirname(d))
+        write(os.path.join(d, "lib/h.666"), "x <- 1 / 0\n")
+        check("include with a runtime error", ["main.666"], d)
+        os.remove(os.path.join(d, "lib/h.666"))
+        check("missing include", ["main.666"], d)
+        write(os.path.join(d, "lib/h.666"), "x <- 9\n")
+        check("restored include", ["main.666"], d)
+        if server.poll() is not None:
+            failures += 1
+            print("The server died")
+    finally:
+        server.kill()
+        server.wait()
+
+sys.exit(1 if failures else 0)